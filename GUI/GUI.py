@@ -1,6 +1,7 @@
 import sys # Only needed for access to command line arguments
 
 import time
+import queue
 
 import logging
 
@@ -291,66 +292,30 @@ def read_PSoC(self, signals): #we can add the parameter signals if we wanna do s
 
         elif char_buffer == b'A':
             logging.info('A')
-            data_buffer = bytearray()                
-
-            while True:
-                char_buffer = self.serial_worker.read(1)
-                
-                if char_buffer != b'Z':
-                    data_buffer += char_buffer
-                else:
-                    break   
-            
-            current_vector = np.zeros(5)
-            voltage_vector = np.zeros(5)
-
-            index_current = 0
-            index_voltage = 0
-
-
-            for i in range(0, len(data_buffer), 2):
-                two_bytes = data_buffer[i:i+2]
-                logging.info(two_bytes)
-
-                #byte_16 = data_buffer[2*i] + data_buffer[2*i+1] #MSB + LSB
-                #logging.info(data_buffer)
-                #logging.info(byte_16)
-
-                int_16 = int.from_bytes(two_bytes, 'big', signed=True)
-
-                logging.info(int_16)
-
-                if index_current < 5:
-                    int_16 = self.convert_range(int_16, 0, 255, 0, 31.9)
-                    if index_current == 3 or index_current == 4:
-                        current_vector[index_current] = -int_16
-                    else:
-                        current_vector[index_current] = int_16
-                    index_current+=1
-                elif index_voltage < 5:
-                    int_16 = self.convert_range(int_16, -2048, 2048, -1024, 1024)
-                    voltage_vector[index_voltage] = int_16
-                    index_voltage+=1
-
-            current_vector =  current_vector / 1000
-            [R, Q] = np.polyfit(np.fliplr([current_vector])[0],np.fliplr([voltage_vector])[0], deg=1)
-
-            self.TIA_resistance = R
-
-            logging.info(current_vector)
-            logging.info(voltage_vector)
-            logging.info("R: {}.".format(R))
-            logging.info("Q: {}.".format(Q))
-
-            R_byte = int(np.round(R/1000)).to_bytes(1, 'big')
-            Q_byte = int(np.round(Q)).to_bytes(1, 'big', signed=True)
-            logging.info("R_byte: {}.".format(R_byte))
-            logging.info("Q_byte: {}.".format(Q_byte))
-
-            data_to_send = b'A' + b'\x01' + R_byte + Q_byte + b'Z'
-            logging.info("data_to_send: {}.".format(data_to_send))    
-
-            self.serial_worker.send(data_to_send)
+            #The fit is done on the PSoC (Q16.16, big endian): nA per ADC count (4) + offset (4) 
+            #+ linearity error in ppm (2) + number of points (1) + [IDAC code, ADC counts, residual/256] (2+2+2) per point + tail
+            data_buffer = self.serial_worker.read(11)
+
+            nA_per_count = int.from_bytes(data_buffer[0:4], 'big', signed=True) / 65536
+            offset = int.from_bytes(data_buffer[4:8], 'big', signed=True) / 65536
+            linearity_ppm = int.from_bytes(data_buffer[8:10], 'big', signed=False)
+            n_points = data_buffer[10]
+
+            points_buffer = self.serial_worker.read(6*n_points + 1)
+            for i in range(0, 6*n_points, 6):
+                idac_code = int.from_bytes(points_buffer[i:i+2], 'big', signed=True)
+                counts = int.from_bytes(points_buffer[i+2:i+4], 'big', signed=True)
+                residual = int.from_bytes(points_buffer[i+4:i+6], 'big', signed=True) / 256
+                logging.info("I: {} nA, ADC: {}, residual: {} counts.".format(idac_code*125, counts, residual))
+
+            #0.5 mV for each ADC count (config2, +- 1.024 V)
+            if nA_per_count != 0:
+                self.TIA_resistance = abs(0.5e-3 / (nA_per_count*1e-9))
+
+            logging.info("nA per count: {}.".format(nA_per_count))
+            logging.info("Offset: {}.".format(offset))
+            logging.info("Linearity error: {} ppm.".format(linearity_ppm))
+            logging.info("R: {}.".format(self.TIA_resistance))
 
             #Kill read worker
             self.TIA_initialize_btn.setText("Re-Initialize TIA") 
@@ -409,15 +374,10 @@ def read_PSoC(self, signals): #we can add the parameter signals if we wanna do s
                 two_bytes = data_buffer[i:i+2]
 
                 if index_current < len(current_vector):
-                    int_16 = int.from_bytes(two_bytes, 'big', signed=True)  
-                    logging.info(int_16)  
-                    int_16 = self.convert_range(int_16, -2048, 2048, -1024, 1024)
-                    if index_current < len(current_vector) : # changing sign to the first half of current vector (when negative tensions)
-                                                               # are imposed -> CHECK if calculations are right  
-                        int_16 = -int_16
-                    
-                    #•int_16 = int_16 / 19468
-                    current_vector[index_current] = int_16 / self.TIA_resistance #mA, mV -> do it inside the draw
+                    current_nA = decode_sample(two_bytes)
+                    logging.info(current_nA)  
+                    #the PSoC applies the TIA calibration, samples arrive as calibrated currents
+                    current_vector[index_current] = current_nA * 1e-6 #mA
                     index_current+=1
                 elif index_voltage < len(voltage_vector):
                     int_16 = int.from_bytes(two_bytes, 'big', signed=False)  
@@ -441,6 +401,7 @@ def read_PSoC(self, signals): #we can add the parameter signals if we wanna do s
                 self.start_voltage_field.setDisabled(False)
                 self.pulse_inc_field.setDisabled(False)
                 self.pulse_height_field.setDisabled(False)
+                self.cycles_field.setDisabled(False)
                 self.save_changes_btn.setDisabled(False)
                 self.restore_default_btn.setDisabled(False)
                 self.type_cv.setDisabled(False)
@@ -473,6 +434,232 @@ def read_PSoC(self, signals): #we can add the parameter signals if we wanna do s
                   
 
 
+        elif char_buffer == b'N':
+            logging.info('N')
+            #last cycle of a multi-cycle CV as it was measured (2 bytes each, see decode_sample) + ZZ, the averaged cycle follows with M
+            data_buffer = bytearray()
+            Z_flag = False
+            while True:
+                char_buffer = self.serial_worker.read(1)
+                if char_buffer != b'Z':
+                    if Z_flag:
+                        data_buffer += b'Z'
+                    data_buffer += char_buffer
+                    Z_flag = False
+                elif not Z_flag:
+                    Z_flag = True
+                else:
+                    break
+            self.last_cycle_stored = np.array([decode_sample(data_buffer[i:i+2])
+                                               for i in range(0, len(data_buffer) - 1, 2)])
+            logging.info("Last cycle: {} samples.".format(len(self.last_cycle_stored)))
+
+        elif char_buffer == b'T':
+            logging.info('T')
+            #state of the strip: state (0 no strip, 1 dry strip, 2 wet strip) + current (nA, 2) + waiting + tail
+            data_buffer = self.serial_worker.read(5)
+            strip_states = ["No strip inserted", "Apply the sample to the strip", "Strip filled"]
+            state = data_buffer[0] if data_buffer[0] < len(strip_states) else 0
+            current = int.from_bytes(data_buffer[1:3], 'big', signed=True)
+            logging.info("Strip: {}, {} nA.".format(strip_states[state], current))
+
+            if not data_buffer[3]: #the run has been refused or the wait is over, nothing else will arrive
+                self.glucose_lcd.display('')
+                self.start_stop_btn.setText("Start") 
+                self.start_stop_btn.setStyleSheet("background-color: green") 
+                self.start_stop_btn_ca.setText("Start")
+                self.start_stop_btn_ca.setStyleSheet("background-color: green") 
+
+                #Kill read worker
+                self.read_worker.is_killed = True
+                self.read_worker.killed()
+
+        elif char_buffer == b'Q':
+            logging.info('Q')
+            #answer to the stop: samples of the truncated measure (2) + tail
+            #also sent with 0 samples when a run is refused during a TIA calibration
+            data_buffer = self.serial_worker.read(3)
+            n_samples = int.from_bytes(data_buffer[0:2], 'big')
+            logging.info("Measure stopped after {} samples.".format(n_samples))
+            if n_samples == 0: #nothing was running or the run was refused, no measure follows
+                self.read_worker.is_killed = True
+                self.read_worker.killed()
+
+        elif char_buffer == b'H':
+            logging.info('H')
+            #auto-range of the TIA: status (0 ok, 1 saturated and stopped) + number of changes
+            #+ [first sample (2), resistor index] for each change + tail. The samples are already in nA
+            data_buffer = self.serial_worker.read(2)
+            n_changes = data_buffer[1]
+            changes_buffer = self.serial_worker.read(3*n_changes + 1)
+            resistor_list = [20, 30, 40, 80, 120, 250, 500, 1000] #kOhm
+            self.range_changes = [(int.from_bytes(changes_buffer[i:i+2], 'big'), resistor_list[changes_buffer[i+2] & 0x07])
+                                  for i in range(0, 3*n_changes, 3)]
+            for sample, resistor in self.range_changes:
+                logging.info("TIA resistor {} kOhm from sample {}.".format(resistor, sample))
+            if data_buffer[0] == 1:
+                logging.warning("The current is out of range also with the lowest TIA resistor, the measure has been stopped.")
+
+        elif char_buffer == b'K':
+            logging.info('K')
+            #Cottrell fit of the CA pulse i = a + b/sqrt(t) (Q16.16, big endian): b (4) + a (4) + error of b (4)
+            #+ samples (2) + converged (1) + tail
+            data_buffer = self.serial_worker.read(16)
+            b = int.from_bytes(data_buffer[0:4], 'big', signed=True) / 65536
+            a = int.from_bytes(data_buffer[4:8], 'big', signed=True) / 65536
+            b_error = int.from_bytes(data_buffer[8:12], 'big', signed=True) / 65536
+            n_samples = int.from_bytes(data_buffer[12:14], 'big')
+            logging.info("Cottrell fit: b = {} +- {} nA*s^0.5, a = {} nA, {} samples, converged: {}.".format(
+                b, b_error, a, n_samples, data_buffer[14]))
+            self.cottrell_stored = (b, b_error, a)
+
+        elif char_buffer == b'G':
+            logging.info('G')
+            #glucose computed on the PSoC: glucose (mg/dL, 2) + averaged current (nA, 2) + tail
+            data_buffer = self.serial_worker.read(5)
+            glucose = int.from_bytes(data_buffer[0:2], 'big', signed=True)
+            current = int.from_bytes(data_buffer[2:4], 'big', signed=True)
+            logging.info("Glucose: {} mg/dL, current: {} nA.".format(glucose, current))
+
+            self.glucoseCA_stored = glucose
+            if glucose < 0:
+                self.glucose_lcd.display('Error')
+            else:
+                self.glucose_lcd.display(glucose)
+
+            #Kill read worker
+            self.read_worker.is_killed = True
+            self.read_worker.killed()
+
+        elif char_buffer == b'D':
+            logging.info('D')
+            #glucose measured with the button of the device: state + glucose (mg/dL, 2) + current (nA, 2)
+            #+ seconds since the measure (2) + tail
+            data_buffer = self.serial_worker.read(8)
+            states = ["No measure", "Measuring", "Done", "Failed"]
+            state = states[data_buffer[0]] if data_buffer[0] < len(states) else "Unknown"
+            glucose = int.from_bytes(data_buffer[1:3], 'big', signed=True)
+            current = int.from_bytes(data_buffer[3:5], 'big', signed=True)
+            age = int.from_bytes(data_buffer[5:7], 'big')
+            logging.info("Button measure: {}, glucose {} mg/dL, current {} nA, {} s ago.".format(
+                state, glucose, current, age))
+            if data_buffer[0] == 2:
+                self.glucoseCA_stored = glucose
+                self.glucose_lcd.display(glucose)
+
+            #Kill read worker
+            self.read_worker.is_killed = True
+            self.read_worker.killed()
+
+        elif char_buffer == b'I':
+            logging.info('I')
+            #watchdog reset: cause + tasks missing + blocking task + procedure + step (2) + steps (2)
+            #+ resets (2) + uptime (s, 4) + tail. Sent at power on after a reset, or asked with H
+            data_buffer = self.serial_worker.read(15)
+            if data_buffer[0] == 0:
+                logging.info("No watchdog reset saved on the device.")
+            else:
+                tasks = {0x01: "main loop", 0x02: "procedure tick", 0x04: "sending", 0x08: "EEPROM write"}
+                missing = [name for bit, name in tasks.items() if data_buffer[1] & bit]
+                step = int.from_bytes(data_buffer[4:6], 'big')
+                steps = int.from_bytes(data_buffer[6:8], 'big')
+                resets = int.from_bytes(data_buffer[8:10], 'big')
+                uptime = int.from_bytes(data_buffer[10:14], 'big')
+                procedure = chr(data_buffer[3]) if data_buffer[3] else "none"
+                logging.warning("Watchdog reset after {} s: stuck in {}, procedure {} at step {} of {} ({} resets).".format(
+                    uptime, ", ".join(missing) or "unknown", procedure, step, steps, resets))
+
+        elif char_buffer == b'W':
+            logging.info('W')
+            #impedance sweep: points + [frequency (mHz, 4), modulus (ohm, 4), phase (0.01 deg, 2)] for each point + tail
+            n_points = self.serial_worker.read(1)[0]
+            points_buffer = self.serial_worker.read(10*n_points + 1)
+            self.eis_stored = [(int.from_bytes(points_buffer[i:i+4], 'big') / 1000,
+                                int.from_bytes(points_buffer[i+4:i+8], 'big'),
+                                int.from_bytes(points_buffer[i+8:i+10], 'big', signed=True) / 100)
+                               for i in range(0, 10*n_points, 10)]
+            for frequency, modulus, phase in self.eis_stored:
+                logging.info("{} Hz: |Z| = {} Ohm, phase {} deg.".format(frequency, modulus, phase))
+
+            #Kill read worker
+            self.read_worker.is_killed = True
+            self.read_worker.killed()
+
+        elif char_buffer == b'X':
+            logging.info('X')
+            #isrs of one step of the last procedure: average cycles (4) + max cycles (4) + max step rate (Hz, 4) + DAC levels per step + tail
+            data_buffer = self.serial_worker.read(14)
+            average_cycles = int.from_bytes(data_buffer[0:4], 'big')
+            max_cycles = int.from_bytes(data_buffer[4:8], 'big')
+            max_rate = int.from_bytes(data_buffer[8:12], 'big')
+            levels = data_buffer[12]
+            logging.info("Step: {} cycles on average, {} max, {} DAC levels. Maximum step rate: {} steps/s.".format(
+                average_cycles, max_cycles, levels, max_rate))
+
+        elif char_buffer == b'U':
+            logging.info('U')
+            #upload of a waveform: command + status + next chunk expected + values received (2) + tail
+            data_buffer = self.serial_worker.read(6)
+            received = int.from_bytes(data_buffer[3:5], 'big')
+            logging.info("Upload command {}: status {}, next chunk {}, {} values received.".format(
+                data_buffer[0], data_buffer[1], data_buffer[2], received))
+            if hasattr(self, 'upload_answers'):
+                self.upload_answers.put((data_buffer[0], data_buffer[1], data_buffer[2]))
+
+        elif char_buffer == b'O':
+            logging.info('O')
+            #procedure of the flash library selected: id + steps (2, 0 if not in the library) + tail
+            data_buffer = self.serial_worker.read(4)
+            steps = int.from_bytes(data_buffer[1:3], 'big')
+            if steps == 0:
+                logging.info("Procedure {} is not in the library.".format(data_buffer[0]))
+            else:
+                logging.info("Procedure {} ready: {} steps.".format(data_buffer[0], steps))
+
+        elif char_buffer == b'J':
+            logging.info('J')
+            #queue of jobs run by the PSoC: command or event + job id + jobs left + tail
+            data_buffer = self.serial_worker.read(4)
+            queue_events = ["Job added", "Queue started", "Queue cleared", "Queue status",
+                            "Job started", "Queue done", "Queue aborted"]
+            event = queue_events[data_buffer[0]] if data_buffer[0] < len(queue_events) else "Unknown"
+            logging.info("{}: job {}, {} jobs left.".format(event, data_buffer[1], data_buffer[2]))
+            if data_buffer[0] == 4: #the next frames are the results of this job
+                self.job_id = data_buffer[1]
+
+        elif char_buffer == b'L':
+            logging.info('L')
+            #Journal of the measurements saved on the PSoC, the second byte is the command
+            #entry: run id (2) + timestamp (4) + glucose (2) + procedure (1) + flags (1), big endian
+            command = self.serial_worker.read(1)[0]
+            if command == 0: #clock synced
+                data_buffer = self.serial_worker.read(2)
+                logging.info("Journal entries: {}.".format(data_buffer[0]))
+            elif command == 1: #list
+                data_buffer = self.serial_worker.read(3)
+                n_entries = data_buffer[2]
+                entries_buffer = self.serial_worker.read(10*n_entries + 1)
+                for i in range(0, 10*n_entries, 10):
+                    run_id = int.from_bytes(entries_buffer[i:i+2], 'big')
+                    timestamp = int.from_bytes(entries_buffer[i+2:i+6], 'big')
+                    glucose = int.from_bytes(entries_buffer[i+6:i+8], 'big', signed=True)
+                    logging.info("Run {}: time {}, procedure {}, glucose {} mg/dL, flags {}.".format(
+                        run_id, timestamp, chr(entries_buffer[i+8]), glucose, entries_buffer[i+9]))
+            elif command == 2: #one entry with the compressed trace
+                data_buffer = self.serial_worker.read(25)
+                run_id = int.from_bytes(data_buffer[0:2], 'big')
+                trace_points = data_buffer[20]
+                trace_first = int.from_bytes(data_buffer[21:23], 'big', signed=True)
+                trace_step = int.from_bytes(data_buffer[23:25], 'big')
+                trace_buffer = self.serial_worker.read(trace_points)
+                trace = [trace_first]
+                for i in range(trace_points - 1):
+                    trace.append(trace[-1] + int.from_bytes(trace_buffer[i:i+1], 'big', signed=True)*trace_step)
+                logging.info("Run {}: trace {} nA.".format(run_id, trace))
+            else: #cleared
+                self.serial_worker.read(1)
+                logging.info("Journal cleared.")
+
         elif char_buffer == b'R':
             logging.info('R')
         elif char_buffer == b'S':
@@ -489,6 +676,120 @@ def read_PSoC(self, signals): #we can add the parameter signals if we wanna do s
 
     return data_array #this will be the result signal
 
+UPLOAD_WINDOW = 4 #chunks sent without waiting for their answer, RX_FRAMES queued by the PSoC
+UPLOAD_FRAME_MAX = 25 #bytes of a command, DATA_MAX_READING_SIZE on the PSoC
+
+def encode_waveform(values):
+    """
+    @brief Tokens of the upload: runs of the previous value, 7 bit deltas or 12 bit absolute values.
+    The PSoC refuses the values above the range of its DAC (status 7), they are not truncated
+    """
+    tokens = []
+    previous = 0
+    i = 0
+    for value in values:
+        if not 0 <= int(value) <= 0xFFF:
+            raise ValueError("DAC value {} out of the 12 bit range".format(value))
+    while i < len(values):
+        value = int(values[i])
+        delta = value - previous
+        if i > 0 and delta == 0:
+            run = 1
+            while run < 64 and i + run < len(values) and int(values[i + run]) == value:
+                run += 1
+            tokens.append(bytes([0x80 | (run - 1)]))
+            i += run
+            continue
+        if -64 <= delta <= 63:
+            tokens.append(bytes([delta & 0x7F]))
+        else:
+            tokens.append(bytes([0xC0 | (value >> 8), value & 0xFF]))
+        previous = value
+        i += 1
+    return tokens
+
+def upload_crc8(data, crc=0):
+    """
+    @brief CRC-8 (polynomial 0x07) of the chunks
+    """
+    for byte in data:
+        crc ^= byte
+        for bit in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def escape_command(header, body):
+    """
+    @brief header + body + Z, 'Z' and 0x7D in the body are escaped with 0x7D and xor 0x20 (BT_ESCAPE on the PSoC)
+    """
+    frame = bytearray(header)
+    for byte in body:
+        if byte in (0x5A, 0x7D):
+            frame += bytes([0x7D, byte ^ 0x20])
+        else:
+            frame.append(byte)
+    return bytes(frame + b'Z')
+
+def upload_command(body):
+    """
+    @brief U + escaped body + Z
+    """
+    return escape_command(b'U', body)
+
+def journal_command(command, value=0):
+    """
+    @brief Journal commands: 0 sync the clock to the epoch value, 1 list from the entry value,
+    2 fetch the run id value, 3 clear
+    """
+    if command == 0:
+        body = bytes([0]) + int(value).to_bytes(4, 'big')
+    elif command == 1:
+        body = bytes([1, value])
+    elif command == 2:
+        body = bytes([2]) + value.to_bytes(2, 'big')
+    else:
+        body = bytes([3])
+    return escape_command(b'L', body)
+
+def eis_command(bias, amplitude, first, last, points):
+    """
+    @brief Impedance sweep: bias (mV), amplitude (mV), first and last frequency (0.1 Hz), points
+    """
+    body = int(bias).to_bytes(2, 'big', signed=True) + bytes([amplitude]) + \
+        int(first).to_bytes(2, 'big') + int(last).to_bytes(2, 'big') + bytes([points])
+    return escape_command(b'W', body)
+
+def glucose_curve_command(slope, intercept, sample, window):
+    """
+    @brief Glucose calibration curve saved in the EEPROM: glucose = slope*current + intercept (mg/dL, nA),
+    the current averaged over sample +- window
+    """
+    body = bytes([4]) + int(round(slope * 65536)).to_bytes(4, 'big', signed=True) + \
+        int(round(intercept * 65536)).to_bytes(4, 'big', signed=True) + int(sample).to_bytes(2, 'big') + bytes([window])
+    return escape_command(b'R', body)
+
+def upload_frames(values, rate, store=0):
+    """
+    @brief Commands to upload the DAC values: begin, chunks and end
+    @param rate steps per second
+    @param store 1 to save the waveform also in the EEPROM of the PSoC
+    """
+    begin = upload_command(bytes([0]) + len(values).to_bytes(2, 'big') + rate.to_bytes(2, 'big') + bytes([store]))
+    chunks = []
+    payload = b''
+    for token in encode_waveform(values):
+        candidate = payload + token
+        body = bytes([1, len(chunks) & 0xFF]) + candidate
+        if len(upload_command(body + bytes([upload_crc8(body[1:])]))) > UPLOAD_FRAME_MAX:
+            body = bytes([1, len(chunks) & 0xFF]) + payload
+            chunks.append(upload_command(body + bytes([upload_crc8(body[1:])])))
+            candidate = token
+        payload = candidate
+    if payload:
+        body = bytes([1, len(chunks) & 0xFF]) + payload
+        chunks.append(upload_command(body + bytes([upload_crc8(body[1:])])))
+    return begin, chunks, upload_command(bytes([2]))
+
 def conv16_8(MSB, LSB):
 
     value16 = b''
@@ -497,6 +798,16 @@ def conv16_8(MSB, LSB):
 
     return value16
 
+def decode_sample(two_bytes):
+    """
+    @brief Current of a sample of the PSoC in nA: exponent (2 bit) + signed mantissa (14 bit), mantissa * 4^exponent / 8
+    """
+    code = int.from_bytes(two_bytes, 'big', signed=False)
+    mantissa = code & 0x3FFF
+    if mantissa >= 0x2000:
+        mantissa -= 0x4000
+    return mantissa * 4**(code >> 14) / 8
+
 
 
 ###############
@@ -707,6 +1018,11 @@ class MainWindow(QMainWindow):
         #self.measure_glucose_btn.setIcon(QIcon("SP_MediaPlay")) #icon
         self.measure_glucose_btn.clicked.connect(self.measure_glucose)
 
+        #Last measure made with the button of the device, without the GUI
+        self.button_result_btn = QPushButton(self)
+        self.button_result_btn.setText("Last device measure")
+        self.button_result_btn.clicked.connect(self.read_button_result)
+
         ## Glucose concentration (mg/dL) LCD
         self.glucose_lcd = QLCDNumber()
         #self.glucose_lcd.setFixedWidth(100)
@@ -720,8 +1036,10 @@ class MainWindow(QMainWindow):
         """!
         @brief Calculate glucose measurement by chronoamperometry and calibration with standard values (stored on EEPROM)
         """
-        #Send CA parameters to PSoC
-        data_to_send = b'C\x00\x02X\x82\x7fZ' #values from calibration
+        #The PSoC runs the CA with the default values and computes the glucose with the
+        #calibration curve saved in its EEPROM, G|0|Z sends back only the glucose (G|1|Z also the trace)
+        #the third byte set to 1 makes the PSoC wait for the strip to be filled and start by itself
+        data_to_send = b'G\x00\x01Z'
         logging.info(data_to_send)
         
         self.serial_worker.send(data_to_send)      
@@ -730,8 +1048,26 @@ class MainWindow(QMainWindow):
         self.read_worker.signals.result.connect(self.print_output) #just a test function
         self.threadpool.start(self.read_worker)
 
-        #self.glucose_stored = int(-122.0998 + (368393.2303*current_axis[50])) --> IT IS DONE INSIDE DRAW_CA
+        #self.glucose_stored = int(-122.0998 + (368393.2303*current_axis[50])) --> IT IS DONE ON THE PSOC
         #self.glucose_lcd.display(self.glucose_stored)
+
+    def read_reset_report(self):
+        """!
+        @brief Read the report of the last watchdog reset of the device, saved in its EEPROM
+        """
+        self.serial_worker.send(b'HZ')
+
+        self.read_worker = ReadWorker(read_PSoC, self)
+        self.threadpool.start(self.read_worker)
+
+    def read_button_result(self):
+        """!
+        @brief Read the last glucose measured with the button of the device, also while the GUI was not connected
+        """
+        self.serial_worker.send(b'KZ')
+
+        self.read_worker = ReadWorker(read_PSoC, self)
+        self.threadpool.start(self.read_worker)
         
         
     #####################
@@ -751,7 +1087,13 @@ class MainWindow(QMainWindow):
         self.type_cv_data = b'\x00' #data_buffer[4]
         self.pulse_inc_data = b'\x01' #data_buffer[5]
         self.pulse_height_data = b'\x02' #data_buffer[6]
-        self.tail_data = b'Z' #data_buffer[7]
+        self.swv_mode_data = b'\x00' #data_buffer[7] -> 0 all the samples, 1 net current of each SWV step, 2 forward, reverse and net
+        self.cycles_data = b'\x01' #data_buffer[8] -> cycles averaged on the PSoC
+        self.last_cycle_data = b'\x00' #data_buffer[9] -> 1 to receive also the last cycle (N)
+        self.tail_data = b'Z' #data_buffer[10]
+
+        ## Array to store the last cycle of a multi-cycle CV
+        self.last_cycle_stored = np.array([])
 
         ## Array to store measurements
         self.current_stored = np.array([])
@@ -805,7 +1147,7 @@ class MainWindow(QMainWindow):
 
         self.scan_rate_field = QSpinBox()
         self.scan_rate_field.setMinimum(1)
-        self.scan_rate_field.setMaximum(10)
+        self.scan_rate_field.setMaximum(1000) #above 127 mV/s the fast scan is used, in steps of 10 mV/s
         self.scan_rate_field.setSuffix(" mV/s")
         self.scan_rate_field.setValue(5)
         self.scan_rate_field.valueChanged.connect(self.update_scan_rate)
@@ -854,6 +1196,15 @@ class MainWindow(QMainWindow):
         self.pulse_height_field.valueChanged.connect(self.update_pulse_height)
 
 
+        #Cycles averaged on the PSoC
+        self.cycles_label = QLabel("Cycles")
+        self.cycles_field = QSpinBox()
+        self.cycles_field.setMinimum(1)
+        self.cycles_field.setMaximum(50)
+        self.cycles_field.setValue(1)
+        self.cycles_field.valueChanged.connect(self.update_cycles)
+
+
         # Widgets are hidden by default and are shown if SWVoltammetry is chosen
         self.pulse_inc_label.hide()
         self.pulse_inc_field.hide()
@@ -931,6 +1282,8 @@ class MainWindow(QMainWindow):
         @brief Save parameter into variable when changing it
         """
         scan_rate_int = self.scan_rate_field.value()
+        if scan_rate_int > 127: #fast scan: bit 7 set, the other bits are tens of mV/s
+            scan_rate_int = 0x80 | round(scan_rate_int / 10)
         self.scan_rate_data = scan_rate_int.to_bytes(1, 'big')
         logging.info(scan_rate_int)
         logging.info(self.scan_rate_data)
@@ -957,6 +1310,16 @@ class MainWindow(QMainWindow):
         logging.info(self.pulse_height_data)
 
 
+    def update_cycles(self):
+        """
+        @brief Save parameter into variable when changing it
+        """
+        cycles_int = self.cycles_field.value()
+        self.cycles_data = cycles_int.to_bytes(1, 'big')
+        logging.info(cycles_int)
+        logging.info(self.cycles_data)
+
+
     def start_cv(self, checked):
         """
         @brief Start the cyclic voltammetry (voltage supply and current measurement)
@@ -972,6 +1335,7 @@ class MainWindow(QMainWindow):
             self.start_voltage_field.setDisabled(True)
             self.pulse_inc_field.setDisabled(True)
             self.pulse_height_field.setDisabled(True)
+            self.cycles_field.setDisabled(True)
             self.save_changes_btn.setDisabled(True)
             self.restore_default_btn.setDisabled(True)
             self.type_cv.setDisabled(True)
@@ -985,11 +1349,14 @@ class MainWindow(QMainWindow):
             #self.type_cv_data => data_buffer[4]
             #self.pulse_inc_data => data_buffer[5]
             #self.pulse_height_data => data_buffer[6]
+            #self.swv_mode_data => data_buffer[7]
+            #self.cycles_data => data_buffer[8]
+            #self.last_cycle_data => data_buffer[9]
 
             #Send CV parameters to PSoC
             self.header_data = b'B' #data_buffer[0] -> CV_parametri state
             self.tail_data = b'Z'
-            self.data_buffer = self.header_data + self.scan_rate_data + self.start_voltage_data + self.end_voltage_data + self.type_cv_data + self.pulse_inc_data + self.pulse_height_data + self.tail_data
+            self.data_buffer = self.header_data + self.scan_rate_data + self.start_voltage_data + self.end_voltage_data + self.type_cv_data + self.pulse_inc_data + self.pulse_height_data + self.swv_mode_data + self.cycles_data + self.last_cycle_data + self.tail_data
             logging.info(self.data_buffer)
             self.serial_worker.send(self.data_buffer)             
 
@@ -1011,14 +1378,16 @@ class MainWindow(QMainWindow):
             self.start_voltage_field.setDisabled(False)
             self.pulse_inc_field.setDisabled(False)
             self.pulse_height_field.setDisabled(False)
+            self.cycles_field.setDisabled(False)
             self.save_changes_btn.setDisabled(False)
             self.restore_default_btn.setDisabled(False)
             self.type_cv.setDisabled(False)
             self.import_data_btn.setDisabled(False)
             self.export_data_btn.setDisabled(False)
 
-            self.read_worker.is_killed = True
-            self.read_worker.killed()
+            #the PSoC stops the measure within one step and sends what has been measured (Q + the usual frames)
+            if not self.read_worker.is_killed:
+                self.serial_worker.send(b'QZ')
     
     def print_output(self, s): #Debugging function to see the "test" signal of the ReadWorker
         print('result: ',s)  
@@ -1145,6 +1514,7 @@ class MainWindow(QMainWindow):
             #Disable the pulse_inc and pulse_height parameters and widgets since it's used only for SWC
             self.pulse_inc_data = int_0.to_bytes(1, 'big') #data_buffer[5]
             self.pulse_height_data = int_0.to_bytes(1, 'big') #data_buffer[6]
+            self.swv_mode_data = int_0.to_bytes(1, 'big') #data_buffer[7]
             self.pulse_inc_label.hide()
             self.pulse_inc_field.hide()
             self.pulse_height_label.hide()
@@ -1153,6 +1523,8 @@ class MainWindow(QMainWindow):
             int_1 = 1 #byte: 00000001
             self.type_cv_data = int_1.to_bytes(1, 'big') #Go to data_buffer[4]
             logging.info(self.type_cv_data)
+            # the PSoC sends the net current (forward - reverse) of each step, one voltage for each step
+            self.swv_mode_data = int_1.to_bytes(1, 'big') #data_buffer[7]
             
             self.pulse_inc_label.show()
             self.pulse_inc_field.show()
@@ -1381,8 +1753,9 @@ class MainWindow(QMainWindow):
             self.import_data_btn_ca.setDisabled(False)
             self.export_data_btn_ca.setDisabled(False)
 
-            self.read_worker.is_killed = True
-            self.read_worker.killed()
+            #the PSoC stops the measure within one step and sends what has been measured (Q + the usual frames)
+            if not self.read_worker.is_killed:
+                self.serial_worker.send(b'QZ')
 
     def draw_CA(self, current_axis, voltage_axis):
         """!
@@ -1471,6 +1844,62 @@ class MainWindow(QMainWindow):
 
         logging.info("Exporting CA measures to file {}.txt".format(filename))          
 
+    def upload_waveform(self, values, rate, store=0):
+        """
+        @brief Upload DAC values to the PSoC, played with the D command. Call it from a worker thread:
+        the chunks are sent UPLOAD_WINDOW at a time and the answers are read by read_PSoC. After an error
+        the PSoC tells the next chunk it expects and the upload goes on from it
+        @return True if the waveform has been set on the PSoC
+        """
+        begin, chunks, end = upload_frames(values, rate, store)
+        self.upload_answers = queue.Queue()
+        if self.read_worker.is_killed:
+            self.read_worker = ReadWorker(read_PSoC, self)
+            self.threadpool.start(self.read_worker)
+
+        self.serial_worker.send(begin)
+        try:
+            answer = self.upload_answers.get(timeout=5)
+        except queue.Empty:
+            return False
+        if answer[1] != 0:
+            logging.info("Upload refused: status {}.".format(answer[1]))
+            return False
+
+        acked = 0 #chunks decoded by the PSoC
+        sent = 0
+        resent_from = None #the errors of the chunks already in flight are not a new loss
+        while acked < len(chunks):
+            while sent < len(chunks) and sent - acked < UPLOAD_WINDOW:
+                self.serial_worker.send(chunks[sent])
+                sent += 1
+            try:
+                command, status, expected = self.upload_answers.get(timeout=5)
+            except queue.Empty:
+                sent = acked #nothing heard, send again from the first chunk not decoded
+                continue
+            if command != 1:
+                continue
+            expected_chunk = acked + ((expected - acked) & 0xFF) #the PSoC counts the chunks on 8 bits
+            if status == 0:
+                acked = expected_chunk
+                resent_from = None
+            elif status in (1, 2): #corrupted or lost chunk: go back to the one expected
+                if expected_chunk != resent_from:
+                    acked = expected_chunk
+                    sent = expected_chunk
+                    resent_from = expected_chunk
+            else:
+                logging.info("Upload stopped: status {}.".format(status))
+                return False
+
+        self.serial_worker.send(end)
+        try:
+            answer = self.upload_answers.get(timeout=30) #saving in the EEPROM takes a while
+        except queue.Empty:
+            return False
+        return answer[1] == 0
+
     def import_data_ca(self):
         """
         @brief Import data (measurements and values) to external file 
@@ -1589,6 +2018,7 @@ class MainWindow(QMainWindow):
         layout_glucose.addWidget(self.measure_glucose_btn, 0, 0)
         layout_glucose.addWidget(self.glucose_lcd, 0, 1)
         layout_glucose.addWidget(self.glucose_sufix, 0, 2)
+        layout_glucose.addWidget(self.button_result_btn, 1, 0)
         widget_glucose = QWidget()
         widget_glucose.setLayout(layout_glucose)
 
@@ -1614,10 +2044,12 @@ class MainWindow(QMainWindow):
         layout_control_panel_cv.addWidget(self.pulse_inc_field, 4, 1) 
         layout_control_panel_cv.addWidget(self.pulse_height_label, 5, 0) 
         layout_control_panel_cv.addWidget(self.pulse_height_field, 5, 1) 
-        layout_control_panel_cv.addWidget(self.save_changes_btn, 6, 0) 
-        layout_control_panel_cv.addWidget(self.restore_default_btn, 6, 1)
-        layout_control_panel_cv.addWidget(self.start_stop_btn, 7, 0)
-        layout_control_panel_cv.addWidget(QWidget(), 7, 1)     
+        layout_control_panel_cv.addWidget(self.cycles_label, 6, 0) 
+        layout_control_panel_cv.addWidget(self.cycles_field, 6, 1) 
+        layout_control_panel_cv.addWidget(self.save_changes_btn, 7, 0) 
+        layout_control_panel_cv.addWidget(self.restore_default_btn, 7, 1)
+        layout_control_panel_cv.addWidget(self.start_stop_btn, 8, 0)
+        layout_control_panel_cv.addWidget(QWidget(), 8, 1)     
         widget_control_panel_cv = QWidget()
         widget_control_panel_cv.setLayout(layout_control_panel_cv)
 
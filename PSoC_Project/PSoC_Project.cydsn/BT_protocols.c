@@ -16,6 +16,8 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include "BT_protocols.h"
+#include "parametric_lut.h"
+#include "watchdog_management.h"
 
 /* **************************************************************
    ******************   UART RECEIVE DATA ***********************
@@ -64,6 +66,22 @@ void errorBT(void){
     
 }
 
+/* the bytes of the command between the header and the TAIL are copied in frame[]
+   (DATA_MAX_READING_SIZE bytes), without the escapes, and their number is returned
+*/
+uint8_t BT_Unescape(volatile uint8_t data_buffer[], uint8_t frame[]){
+    uint8_t length = 0;
+    
+    for(uint8_t i=1; i<DATA_MAX_READING_SIZE && data_buffer[i] != TAIL; i++){
+        uint8_t byte = data_buffer[i];
+        if(byte == BT_ESCAPE && i+1 < DATA_MAX_READING_SIZE){
+            byte = data_buffer[++i] ^ BT_ESCAPE_XOR;
+        }
+        frame[length++] = byte;
+    }
+    return length;
+}
+
 /* **************************************************************
    ******************   BT SENDING MANAGER **********************
    **************************************************************
@@ -77,58 +95,109 @@ void errorBT(void){
                     
 */
 
-void BT_sending_manager(uint8_t* data_long_BT_man, int sending_size){
+void BT_sending_manager(const volatile uint8_t* data_long_BT_man, int sending_size){
     
-    int index=0;
-    for(index = 0; index < sending_size; index++){
-        if(index<DATA_MAX_SENDING_SIZE){
-            data_to_send[index] = data_long_BT_man[index];
-        } else {
-            if((index%DATA_MAX_SENDING_SIZE)==0&&(index!=0)){ // filled one array to send, we call the sending function
-                //writeBT(DATA_MAX_SENDING_SIZE);
-                UART_BT_PutArray(data_to_send, DATA_MAX_SENDING_SIZE); // pass the data_buffer[0] address and the buffer size 
-                                                    // +1 because we added the tail 
-            // clean the sending array
-            for(uint8_t i=0; i<DATA_MAX_SENDING_SIZE ; i++){
-                data_to_send[i] = 0;
-            }
-        }
-            
-            data_to_send[index%DATA_MAX_SENDING_SIZE] = data_long_BT_man[index]; 
-        }
+    uint8_t outer_block = watchdog_BlockBegin(WATCHDOG_SEND); // the main is blocked until the end
+    BT_SendBegin(data_long_BT_man, sending_size);
+    while(BT_SendFrame()){
+        watchdog_CheckIn(WATCHDOG_SEND); // a stuck UART is left to the watchdog
     }
-    // sending of extra "last piece" of array which does not reach the SENDING SIZE
-    // this is not needed in out case, our measures arrays will always be 2*lut_legth
-    
-    data_to_send[index%DATA_MAX_SENDING_SIZE] = TAIL;
-    data_to_send[(index%DATA_MAX_SENDING_SIZE)+1] = TAIL; //tail added at the end of the array
+    watchdog_BlockEnd(outer_block);
+}
+
+/* the same array can be sent one frame at a time, so that the main can do some
+   work between two frames: BT_SendBegin() and then BT_SendFrame() until it
+   returns false. The last frame ends with the two TAIL bytes, alone if they
+   do not fit after the last data */
+
+static const volatile uint8_t* frame_data; // array sent by BT_SendFrame()
+static int frame_size;
+static int frame_index;
+
+void BT_SendBegin(const volatile uint8_t* data, int size){
+    frame_data = data;
+    frame_size = size;
+    frame_index = 0;
+}
+
+uint8_t BT_SendFrame(void){ // true while there are frames left
     
-    UART_BT_PutArray(data_to_send, (index%DATA_MAX_SENDING_SIZE)+2); // pass the data_buffer[0] address and the buffer size 
-                                                    // +1 because we added the tail 
+    int length = frame_size - frame_index;
+    uint8_t last = (length <= DATA_MAX_SENDING_SIZE - 2); // room for the tail
+    if(length > DATA_MAX_SENDING_SIZE){
+        length = DATA_MAX_SENDING_SIZE;
+    }
+    for(int i = 0; i < length; i++){
+        data_to_send[i] = frame_data[frame_index + i];
+    }
+    frame_index += length;
+    if(last){
+        data_to_send[length] = TAIL;
+        data_to_send[length+1] = TAIL; //tail added at the end of the array
+        length += 2;
+    }
+    UART_BT_PutArray(data_to_send, length);
     // clean the sending array
     for(uint8_t i=0; i<DATA_MAX_SENDING_SIZE ; i++){
         data_to_send[i] = 0;
     }
+    return !last;
 }
 
 
-void sendMeasures(void){ // called by the ISR when the measures are finished 
+static volatile uint8_t* measures_data; // data_long of the procedure sent by sendMeasuresFrame()
+static uint16_t measures_data_size;
+static uint8_t measures_state = MEASURES_SENT;
+
+void sendMeasuresBegin(void){ // the measures of the procedure just finished, then its voltages
     
-    BT_sending_manager(data_long, lut_length*2); // send the measured voltages  
+    measures_data = data_long;
+    measures_data_size = data_long_size;
+    measures_state = MEASURES_SENDING_SAMPLES;
+    BT_SendBegin(measures_data, measures_length*2); // send the measured voltages  
+}
+
+uint8_t sendMeasuresFrame(void){ // one frame, returns the state of the sending after it
     
-    for(int i=0; i<DATA_LONG_SIZE; i++){
-        data_long[i]=0; 
+    if(measures_state == MEASURES_SENT || BT_SendFrame()){
+        return measures_state;
+    }
+    if(measures_state == MEASURES_SENDING_VOLTAGES){
+        measures_state = MEASURES_SENT;
+        return measures_state;
     }
     
-    for(int i = 0; i < lut_length; i++){ //create the array and send the imposed voltages
-        uint8_t LSB_data = waveform_lut[i] & 0xFF;
-        uint8_t MSB_data = waveform_lut[i] >> 8;
-        data_long[2*i] = MSB_data; // i = 0 -> 0 e 1 , i = 2 -> 
-        data_long[2*i+1] = LSB_data;
+    for(int i=0; i<measures_data_size; i++){
+        measures_data[i]=0; 
     }
-    CyDelay(500);
     
-    BT_sending_manager(data_long, lut_length*2); // incompatible pointers, if it's an issue copy 
-                                                  // waveform lut inside on data long 
+    // the voltages are made while the look up table of the procedure is still there
+    uint16_t voltages_length = measures_length;
+    if (swv_mode == SWV_SEND_RAW) {
+        for(int i = 0; i < voltages_length; i++){ //create the array and send the imposed voltages
+            uint16_t value = LUT_Value(i); // the CA has no look up table in memory
+            uint8_t LSB_data = value & 0xFF;
+            uint8_t MSB_data = value >> 8;
+            measures_data[2*i] = MSB_data; // i = 0 -> 0 e 1 , i = 2 -> 
+            measures_data[2*i+1] = LSB_data;
+        }
+    } else { // square wave computed on the device: one voltage for each step, the middle of the pulse
+        voltages_length = swv_steps;
+        for(int i = 0; i < swv_steps; i++){
+            uint16_t step_value = (waveform_lut[2*i] + waveform_lut[2*i+1]) / 2;
+            measures_data[2*i] = step_value >> 8;
+            measures_data[2*i+1] = step_value & 0xFF;
+        }
+    }
+    
+    BT_SendBegin(measures_data, voltages_length*2); // the voltages follow the ZZ of the measures, the GUI reads them in the same frame
+    measures_state = MEASURES_SENDING_VOLTAGES; // from now on the next procedure can be set
+    return measures_state;
+}
+
+void sendStopped(uint16_t samples){ // answer to STOP_PROCEDURE: Q|samples of the truncated measure that follows (0 if nothing was running)|Z
+    uint8_t frame[4] = {STOPPED_DATA, samples >> 8, samples & 0xFF, TAIL}; // not data_to_send, the main could be using it
+    
+    UART_BT_PutArray(frame, 4);
 }
 /* [] END OF FILE */
@@ -7,12 +7,17 @@
 
 
 #if !defined(BT_PROTOCOLS_H)
-#define DAC_H
+#define BT_PROTOCOLS_H
 
 #include <project.h>
 #include "globals.h"
 #include <stdio.h>
     
+// state of the sending of the measures, sendMeasuresFrame()
+#define MEASURES_SENT               0
+#define MEASURES_SENDING_SAMPLES    1
+#define MEASURES_SENDING_VOLTAGES   2   // the look up table of the procedure is no longer needed
+    
 /***************************************
 *        Function Prototypes
 ***************************************/  
@@ -20,8 +25,13 @@
 void readBT(void);
 void writeBT(int);
 void errorBT(void);
-void BT_sending_manager(uint8_t* data_long_BT_man, int sending_size);
-void sendMeasures(void);
+uint8_t BT_Unescape(volatile uint8_t data_buffer[], uint8_t frame[]);
+void BT_sending_manager(const volatile uint8_t* data_long_BT_man, int sending_size);
+void BT_SendBegin(const volatile uint8_t* data, int size);
+uint8_t BT_SendFrame(void);
+void sendMeasuresBegin(void);
+uint8_t sendMeasuresFrame(void);
+void sendStopped(uint16_t samples);
 
 
 /***************************************
@@ -36,10 +46,10 @@ volatile extern uint8_t data_buffer[DATA_MAX_READING_SIZE]; // input buffer -- i
 volatile extern uint8_t temp[DATA_MAX_READING_SIZE]; //-- it was added into the globals.c as static 
 
 
-volatile extern uint8_t data_long[DATA_LONG_SIZE]; // entire data to send array
+volatile extern uint8_t *data_long; // entire data to send array
 volatile extern uint8_t data_to_send[DATA_MAX_SENDING_SIZE]; // one seding iteration array
 
-volatile extern uint16_t waveform_lut[MAX_LUT_SIZE+5];
+volatile extern uint16_t *waveform_lut;
     
 #endif
 
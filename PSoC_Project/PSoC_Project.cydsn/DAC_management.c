@@ -10,6 +10,42 @@
 
 #include "DAC_management.h"
 #include "globals.h"
+#include "string.h"
+
+static void dac_vdac_set_value(uint16_t value);
+static void dac_dvdac_start(void);
+
+static const dac_backend_t dac_vdac = {
+    VDAC_source_Start, VDAC_source_Sleep, VDAC_source_Wakeup, dac_vdac_set_value,
+    VIRTUAL_GROUND / 16, VDAC_channel
+};
+static const dac_backend_t dac_dvdac = {
+    dac_dvdac_start, DVDAC_Sleep, DVDAC_Wakeup, DAC_DitherSetValue,
+    VIRTUAL_GROUND, DVDAC_channel  //VIRTUAL_GROUND / 1 mV
+};
+
+/* Dither patterns of the DVDAC, in flash. The 16 bytes starting at 
+ * dac_dither_stair[value] are the same pattern DVDAC_SetValue() writes for value:
+ * stair[k] = k/16, so (value + i)/16 is the integer part for the first 16 - fraction
+ * bytes and the integer part + 1 for the others. Aligned so it does not cross 64k
+ * (the DMA address is 16 bit) */
+#define DAC_STAIR_1(h)  (h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h),(h)
+#define DAC_STAIR_4(h)  DAC_STAIR_1(h), DAC_STAIR_1((h)+1), DAC_STAIR_1((h)+2), DAC_STAIR_1((h)+3)
+#define DAC_STAIR_16(h) DAC_STAIR_4(h), DAC_STAIR_4((h)+4), DAC_STAIR_4((h)+8), DAC_STAIR_4((h)+12)
+#define DAC_STAIR_64(h) DAC_STAIR_16(h), DAC_STAIR_16((h)+16), DAC_STAIR_16((h)+32), DAC_STAIR_16((h)+48)
+
+CY_ALIGN(DAC_DITHER_TABLE_ALIGN)
+static const uint8 dac_dither_stair[DAC_DITHER_TABLE_SIZE] = {
+    DAC_STAIR_64(0), DAC_STAIR_64(64), DAC_STAIR_64(128), DAC_STAIR_64(192),
+    DAC_STAIR_1(DVDAC_INTEGER_PORTION_MAX_VALUE)  // the max value keeps 255 in all the bytes
+};
+static uint8 dac_dither_td = CY_DMA_INVALID_TD;
+
+const dac_backend_t *dac_backend = &dac_vdac;
+void (*dac_set_value)(uint16_t value) = dac_vdac_set_value;
+dac_profile_t dac_profile;
+dac_profile_t adc_profile;
+uint8_t dac_profile_levels;
 
 
 /******************************************************************************
@@ -19,7 +55,8 @@
 * Summary:
 *  Start the correct voltage source.  
 *  Figure what source is being used, set the  correct AMux settings and start 
-*  the correct source
+*  the correct source. The backend of the source is bound here once, so the
+*  other DAC functions (and the dac isr) do not check the source every time
 *
 * Parameters:
 *
@@ -27,22 +64,28 @@
 *  Global variables:
 *  selected_voltage_source:  voltage source that is set to run, 
 *      [VDAC_IS_VDAC or VDAC_IS_DVDAC]
+*  dac_backend: functions of the source
 *
 *******************************************************************************/
 
 void DAC_Start(void) {
-    selected_voltage_source = helper_check_voltage_source();  // check which DAC is being used
+#if (DAC_BACKEND == DAC_BACKEND_RUNTIME)
+    selected_voltage_source = helper_check_voltage_source();  // check which DAC is being used (RAM copy)
+#else
+    selected_voltage_source = DAC_BACKEND;  // DAC fixed at compile time
+#endif
     
     if (selected_voltage_source == VDAC_IS_DVDAC) {
-        DVDAC_Start();
-        dac_ground_value = VIRTUAL_GROUND;  //VIRTUAL_GROUND / 1 mV the value of the DAC that will make 0 V across the working and aux electrodes 
-        AMux_V_source_Select(DVDAC_channel);
+        dac_backend = &dac_dvdac;
     }
     else {
-        VDAC_source_Start();
-        dac_ground_value = VIRTUAL_GROUND / 16;  // value of dac to make 0 V across working and aux electrodes
-        AMux_V_source_Select(VDAC_channel);
+        dac_backend = &dac_vdac;
     }
+    dac_set_value = dac_backend->SetValue;
+    
+    dac_ground_value = dac_backend->ground_value;
+    dac_backend->Start();
+    AMux_V_source_Select(dac_backend->channel);
 }
 
 /******************************************************************************
@@ -62,12 +105,7 @@ void DAC_Start(void) {
 *******************************************************************************/
 
 void DAC_Sleep(void) {
-    if (selected_voltage_source == VDAC_IS_DVDAC) {
-        DVDAC_Sleep();
-    }
-    else {
-        VDAC_source_Sleep();
-    }
+    dac_backend->Sleep();
 }
 
 
@@ -88,38 +126,133 @@ void DAC_Sleep(void) {
 *******************************************************************************/
 
 void DAC_Wakeup(void) {
-    if (selected_voltage_source == VDAC_IS_DVDAC) {
-        DVDAC_Wakeup();
-    }
-    else {
-        VDAC_source_Wakeup();
-    }
+    dac_backend->Wakeup();
+}
+
+/******************************************************************************
+* Function Name: DAC_MaxValue
+*******************************************************************************
+*
+* Summary:
+*  Highest value of the voltage source selected in the parameters, also
+*  before DAC_Start(): the values above it would be truncated by the DAC
+*
+*******************************************************************************/
+
+uint16_t DAC_MaxValue(void) {
+    return helper_check_voltage_source() == VDAC_IS_DVDAC ? DVDAC_DVDAC_MAX_VALUE : DAC_VDAC_MAX_VALUE;
 }
 
 
 /******************************************************************************
-* Function Name: DAC_SetValue
+* Function Name: dac_vdac_set_value
 *******************************************************************************
 *
 * Summary:
-*  Set the value of the correct voltage source
+*  Set the value of the VDAC writing directly its data register, as 
+*  VDAC_source_SetValue() does on the PSoC 5LP (the double write is needed
+*  only on the PSoC 5A). DAC_SetValue() calls it through dac_set_value
 *
 * Parameters:
-*  uint16_t value: number to place in the appropriate DAC
+*  uint16_t value: number to place in the VDAC, 8 bits
 *
-* Global variables:
-*  selected_voltage_source:  voltage source that is set to run, 
-*      [VDAC_IS_VDAC or VDAC_IS_DVDAC]
+*******************************************************************************/
+
+static void dac_vdac_set_value(uint16_t value) {
+    VDAC_source_Data = (uint8)value;
+}
+
+/******************************************************************************
+* Function Name: dac_dvdac_start
+*******************************************************************************
+*
+* Summary:
+*  Start the DVDAC and move its DMA channel on a transfer descriptor that
+*  reads the dither patterns from dac_dither_stair[] in flash instead of the
+*  SRAM array of the component. The TD loops on itself over 16 bytes like the
+*  one of the component, the channel is the one of the component
 *
 *******************************************************************************/
 
-void DAC_SetValue(uint16_t value) {
+static void dac_dvdac_start(void) {
+    DVDAC_Start();
     
-    if (selected_voltage_source == VDAC_IS_DVDAC) {
-        DVDAC_SetValue(value);
+    (void) CyDmaChDisable(DVDAC_DMA__DRQ_NUMBER);
+    if (dac_dither_td == CY_DMA_INVALID_TD) {
+        dac_dither_td = CyDmaTdAllocate();
+        (void) CyDmaTdSetConfiguration(dac_dither_td, DVDAC_DITHERED_ARRAY_SIZE, dac_dither_td,
+                                       (uint8) CY_DMA_TD_INC_SRC_ADR);
     }
-    else {
-        VDAC_source_SetValue(value);
+    (void) CyDmaTdSetAddress(dac_dither_td, LO16((uint32)&dac_dither_stair[dac_ground_value]),
+                             LO16((uint32)DVDAC_VDAC8_Data_PTR));
+    (void) CyDmaChSetExtendedAddress(DVDAC_DMA__DRQ_NUMBER, HI16((uint32)dac_dither_stair),
+                                     HI16(CYDEV_PERIPH_BASE));
+    (void) CyDmaChSetInitialTd(DVDAC_DMA__DRQ_NUMBER, dac_dither_td);
+    (void) CyDmaChEnable(DVDAC_DMA__DRQ_NUMBER, 1u);
+}
+
+/******************************************************************************
+* Function Name: DAC_DitherSetValue
+*******************************************************************************
+*
+* Summary:
+*  Set the value of the DVDAC. Instead of filling the 16 bytes of the dither
+*  array like DVDAC_SetValue(), only the source address of the DMA is moved
+*  on the precomputed pattern, so a step costs the same as with the VDAC
+*
+* Parameters:
+*  uint16_t value: number to place in the DVDAC, 12 bits
+*
+*******************************************************************************/
+
+void DAC_DitherSetValue(uint16_t value) {
+    if (value > DVDAC_DVDAC_MAX_VALUE) {
+        value = DVDAC_DVDAC_MAX_VALUE;
+    }
+    (void) CyDmaTdSetAddress(dac_dither_td, LO16((uint32)&dac_dither_stair[value]),
+                             LO16((uint32)DVDAC_VDAC8_Data_PTR));
+}
+
+/******************************************************************************
+* Function Name: DAC_ProfileStart
+*******************************************************************************
+*
+* Summary:
+*  Enable the DWT cycle counter of the Cortex-M3 and clear the statistics of
+*  the dac and adc isrs, called when a procedure is started
+*
+* Parameters:
+*  uint8_t levels: DAC levels of each step of the procedure, LUT_Levels()
+*
+*******************************************************************************/
+
+void DAC_ProfileStart(uint8_t levels) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    memset(&dac_profile, 0, sizeof(dac_profile_t));
+    memset(&adc_profile, 0, sizeof(dac_profile_t));
+    dac_profile_levels = levels;
+}
+
+/******************************************************************************
+* Function Name: DAC_ProfileAdd
+*******************************************************************************
+*
+* Summary:
+*  Add the cycles of one step of an isr to its statistics
+*
+* Parameters:
+*  dac_profile_t *profile: dac_profile or adc_profile
+*  uint32_t cycles: DWT cycles of the step
+*
+*******************************************************************************/
+
+void DAC_ProfileAdd(dac_profile_t *profile, uint32_t cycles) {
+    profile->steps++;
+    profile->total_cycles += cycles;
+    if (cycles > profile->max_cycles) {
+        profile->max_cycles = cycles;
     }
 }
 
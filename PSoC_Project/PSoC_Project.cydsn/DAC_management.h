@@ -22,11 +22,59 @@
 #define VDAC_channel 0
     
     
+/**************************************
+*        Backend selection
+**************************************/
+    
+// DAC_BACKEND_RUNTIME: the DAC is chosen by the user and bound once by DAC_Start()
+// DAC_BACKEND_VDAC / DAC_BACKEND_DVDAC: only one DAC is used, DAC_SetValue() is 
+// resolved at compile time (for the VDAC a single register write)
+#define DAC_BACKEND_RUNTIME 0
+#define DAC_BACKEND_VDAC    VDAC_IS_VDAC
+#define DAC_BACKEND_DVDAC   VDAC_IS_DVDAC
+#define DAC_BACKEND         DAC_BACKEND_RUNTIME
+
+#define DAC_VDAC_MAX_VALUE  255u    // 8 bit VDAC
+    
+// dither patterns of the DVDAC: one byte for each 12 bit value plus one pattern
+#define DAC_DITHER_TABLE_SIZE   ((DVDAC_INTEGER_PORTION_MAX_VALUE + 2u) * DVDAC_DITHERED_ARRAY_SIZE)
+#define DAC_DITHER_TABLE_ALIGN  8192u
+    
+// 1: send the cycles of the dac isr (P frame) at the end of every procedure. The cycles of
+// the dac and adc isrs are always counted with the DWT cycle counter, for the BENCHMARK command
+#define DAC_PROFILE         0
+    
+    
+/***************************************
+*        Structures
+***************************************/
+    
+typedef struct {
+    void (*Start)(void);
+    void (*Sleep)(void);
+    void (*Wakeup)(void);
+    void (*SetValue)(uint16_t value);
+    uint16_t ground_value;  // value of the DAC that makes 0 V across working and aux electrodes
+    uint8_t channel;        // AMux_V_source channel
+} dac_backend_t;
+
+typedef struct {
+    uint32_t steps;
+    uint32_t total_cycles;
+    uint32_t max_cycles;
+} dac_profile_t;
+    
+    
 /***************************************
 *        Variables
 ***************************************/     
     
 extern uint16_t dac_ground_value;
+extern const dac_backend_t *dac_backend;       // DAC bound by DAC_Start()
+extern void (*dac_set_value)(uint16_t value);  // copy of dac_backend->SetValue, one load less in the isr
+extern dac_profile_t dac_profile;   // dac isr, one entry for each step
+extern dac_profile_t adc_profile;   // adc isr, one entry for each sample
+extern uint8_t dac_profile_levels;  // DAC levels of each step of the procedure timed
     
     
 /***************************************
@@ -36,7 +84,22 @@ extern uint16_t dac_ground_value;
 void DAC_Start(void);
 void DAC_Sleep(void);
 void DAC_Wakeup(void);
-void DAC_SetValue(uint16_t value);
+uint16_t DAC_MaxValue(void);
+void DAC_DitherSetValue(uint16_t value);
+void DAC_ProfileStart(uint8_t levels);
+void DAC_ProfileAdd(dac_profile_t *profile, uint32_t cycles);
+
+#if (DAC_BACKEND == DAC_BACKEND_VDAC)
+    #define DAC_SetValue(value) (VDAC_source_Data = (uint8)(value))  // no call at all
+#elif (DAC_BACKEND == DAC_BACKEND_DVDAC)
+    #define DAC_SetValue(value) DAC_DitherSetValue(value)
+#else
+    #define DAC_SetValue(value) dac_set_value(value)
+#endif
+
+// cycles of the work of an isr, added to profile (dac_profile or adc_profile)
+#define DAC_PROFILE_BEGIN()         uint32_t dac_profile_start = DWT->CYCCNT
+#define DAC_PROFILE_END(profile)    DAC_ProfileAdd(&(profile), DWT->CYCCNT - dac_profile_start)
     
 #endif
 /* [] END OF FILE */
@@ -3,6 +3,8 @@
 *
 * Description:
 *  Protocols to calibrate the current measuring circuitry i.e. TIA / delta sigma ADC with an IDAC
+*  The IDAC sweep is run by the isr_adc (PWM_isr tick) in the background, the main 
+*  only polls TIA_CalibrationTask() to do the fit when the sweep is over
 *
 *********************************************************************************/
 #include <project.h>
@@ -12,140 +14,786 @@
 
 #include "TIA_calibrate.h"
 #include "BT_protocols.h"
+#include "watchdog_management.h"
 
 //extern char LCD_str[];  // for debug
 const uint16_t calibrate_TIA_resistor_list[]= {20, 30, 40, 80, 120, 250, 500, 1000};
-uint16_t static ADC_value;
 
-int16_t valore;
-int16_t valore_s;
+tia_fit_t tia_fit = {25L << TIA_FIT_SHIFT, 0}; // nominal 20 kOhm until the first calibration is done
+uint8_t tia_calibration_length = 0; // bytes of tia_calibration_values to send, 0 if no calibration is done
+
+// state of the sweep, shared with the isr
+static volatile uint8_t cal_state = TIA_CAL_IDLE;
+static volatile uint8_t cal_point;     // step of the sweep in progress
+static volatile uint8_t cal_tick;      // ticks spent on the current step
+static volatile int32_t cal_sum;       // sum of the ADC conversions of the current step
+static uint8_t cal_points;
+static uint8_t cal_averages;
+static uint8_t cal_resistor_index = TIA_RESISTOR_DEFAULT_VALUE_INDEX;
+static uint8_t cal_offset_check;  // 1 if the running sweep is the single point drift check
+static uint8_t cal_background;    // 1 if started by TIA_DriftScheduler, nothing is sent to the GUI
+static uint32_t last_drift_check_ms;
+
+// auto-range of the running procedure
+static uint8_t range_index = TIA_RESISTOR_DEFAULT_VALUE_INDEX; // resistor in use, cal_resistor_index when idle
+static int32_t range_nA_per_count_q16 = 25L << TIA_FIT_SHIFT;  // tia_fit scaled to the resistor in use
+static uint8_t range_status;
+static uint8_t range_up_samples;
+static uint8_t range_clip_samples;
+static uint8_t range_changes_number;
+static uint8_t range_changes[3*TIA_RANGE_MAX_CHANGES]; // sample of the change (2, MSB first) + new resistor index
+
+static int16_t cal_residuals[TIA_CAL_MAX_POINTS]; // y - fit, in 1/256 counts
+static uint16_t cal_linearity_ppm;                // max |residual| over the fitted full scale
+
+// PWM and isr settings of the procedures, restored at the end of the sweep
+static cyisraddress saved_adc_vector;
+static uint16_t saved_pwm_period;
+static uint16_t saved_pwm_compare;
 
 /***************************************
 * Forward function references
 ***************************************/
 static void Calibrate_Hardware_Wakeup(void);
-static void calibrate_step(uint16_t IDAC_value, uint8 IDAC_index);
+static void calibrate_set_idac(int16_t IDAC_value);
+static void calibrate_fit(void);
+static void calibrate_residuals(void);
+static void calibrate_fill_frame(void);
+static void calibrate_restore_timer(void);
+static void calibrate_start(void);
 static void Calibrate_Hardware_Sleep(void);
+static void range_apply(uint8_t resistor_index);
+static CY_ISR_PROTO(calibrateInterrupt);
 
 /******************************************************************************
 * Function Name: calibrate_TIA
 *******************************************************************************
 *
 * Summary:
-*  Calibrate the TIA circuit each time the current gain settings are changed
+*  Calibrate the TIA circuit each time the current gain settings are changed.
+*  Blocking version of the sweep with the default number of points and averages,
+*  used at power on before the main loop is started
+*
+* Parameters:
+*  uint8 TIA_resistor_value_index: index of which TIA resistor to use
 *
 * Global variables:
-*  uint8 TIA_resistor_value_index: index of which TIA resistor to use, Supplied by UART input
-*  uint8 ADC_buffer_index: which ADC buffer is used, gain = 2**ADC_buffer_index
+*  tia_fit: gain and offset fitted on the calibration points
 *
 * Return:
-*  array of 20 bytes is loaded into the USB IN ENDPOINT (into the computer)
+*  tia_calibration_values is filled with the TIA_SET frame of the new fit
 *
 *******************************************************************************/
 
 void calibrate_TIA(uint8 TIA_resistor_value_index /*uint8 ADC_buffer_index -> this maybe remove*/) {
-    // The IDAC only 
-    IDAC_calibrate_Start();
-    IDAC_calibrate_SetValue(0);
-    // start the hardware required
-    Calibrate_Hardware_Wakeup();
-    CyDelay(100);
-    // decide what currents to use based on TIA resistor and ADC buffer settings
-    uint16_t resistor_value = calibrate_TIA_resistor_list[TIA_resistor_value_index];
-    //uint var = 2;
-    uint16_t IDAC_setting = 0;
+    TIA_StartCalibration(TIA_resistor_value_index, TIA_CAL_POINTS_DEFAULT, TIA_CAL_AVERAGES_DEFAULT);
+    while (!TIA_CalibrationTask()) {
+        // the sweep is done by calibrateInterrupt
+    }
+}
+
+/******************************************************************************
+* Function Name: TIA_StartCalibration
+*******************************************************************************
+*
+* Summary:
+*  Start an N points IDAC sweep, symmetric around 0 A and as wide as the IDAC 
+*  and the ADC range allow, K ADC conversions are averaged for each point.
+*  Returns immediately: the steps are done by calibrateInterrupt at each PWM_isr tick
+*
+* Parameters:
+*  uint8 resistor_value_index: index of which TIA resistor to use
+*  uint8 n_points: number of IDAC steps, 0 for TIA_CAL_POINTS_DEFAULT
+*  uint8 n_averages: conversions averaged for each step, 0 for TIA_CAL_AVERAGES_DEFAULT
+*
+* Global variables:
+*  calibrate_array: filled with the IDAC codes of the sweep
+*
+*******************************************************************************/
+
+void TIA_StartCalibration(uint8_t resistor_value_index, uint8_t n_points, uint8_t n_averages) {
+    if (cal_state == TIA_CAL_RUNNING) {
+        return;
+    }
+    if (n_points < 2 || n_points > TIA_CAL_MAX_POINTS) {
+        n_points = TIA_CAL_POINTS_DEFAULT;
+    }
+    if (n_averages == 0 || n_averages > TIA_CAL_MAX_AVERAGES) {
+        n_averages = TIA_CAL_AVERAGES_DEFAULT;
+    }
+    cal_points = n_points;
+    cal_averages = n_averages;
+    cal_resistor_index = resistor_value_index;
+    cal_offset_check = 0;
+    cal_background = 0;
     
-    /* ADC_buffer_index management */
-//  uint8 ADC_buffer_value = pow(var, ADC_buffer_index); ** we are not giving the ADC_buffer_index to the function**
+    // decide what currents to use based on TIA resistor and ADC buffer settings
+    uint16_t resistor_value = calibrate_TIA_resistor_list[resistor_value_index & 0x07];
     uint8_t ADC_buffer_value =  2*1; // ADC_buffer_index = 1 
+    // calculate the IDAC value needed to get half of the ADC range
+    // the 8000 is because the IDAC has a 1/8 uA per bit and 8000=1000mV/(1/8 uA per bit)
+    int32_t max_code = 8000/(ADC_buffer_value*resistor_value);
+    if (max_code > IDAC_MAX_CODE) {  // the 20k resistor would need more than the IDAC can give
+        max_code = IDAC_MAX_CODE;
+    }
+    
+    // evenly spaced codes from -max_code (sink) to +max_code (source)
+    for (int i = 0; i < n_points; i++) {
+        calibrate_array[i] = (int16_t)(-max_code + (2*max_code*i)/(n_points-1));
+    }
+    calibrate_start();
+}
+
+/******************************************************************************
+* Function Name: calibrate_start
+*******************************************************************************
+*
+* Summary:
+*  Take the PWM_isr tick and the isr_adc from the procedures and start the sweep
+*  over the cal_points codes already saved in calibrate_array
+*
+*******************************************************************************/
+
+static void calibrate_start(void) {
+    // take the PWM tick from the procedures
+    saved_adc_vector = isr_adc_GetVector();
+    saved_pwm_period = PWM_isr_ReadPeriod();
+    saved_pwm_compare = PWM_isr_ReadCompare();
     
-    // set input current to zero and read ADC
+    IDAC_calibrate_Start();
+    Calibrate_Hardware_Wakeup();
+    calibrate_set_idac(calibrate_array[0]);
     ADC_SigDel_StartConvert();
-    calibrate_step(IDAC_setting, 2);
-    // calculate the IDAC value needed to get a 1 Volt in the ADC
-    // the 8000 is because the IDAC has a 1/8 uA per bit and 8000=1000mV/(1/8 uA per bit)
-    float32 transfer = 8000./(ADC_buffer_value*resistor_value);
-    int transfer_int = (int) transfer;
-    if (transfer_int > 250) {  // the TIA needs too much current, reduce needs by half.  Is needed for the 20k resistor setting
-        transfer_int /= 2;
-    }
-    //    LCD_Position(0,0);
-//    sprintf(LCD_str, "in:%d |%d| ", resistor_value, ADC_buffer_value);
-//    LCD_PrintString(LCD_str);
-    // is not DRY but not sure how to fix
-    IDAC_calibrate_SetPolarity(IDAC_calibrate_SINK);
-    calibrate_step(transfer_int, 0);
-    calibrate_step(transfer_int/2, 1);
-    IDAC_calibrate_SetPolarity(IDAC_calibrate_SOURCE);
-    calibrate_step(transfer_int/2, 3);
-    calibrate_step(transfer_int, 4);
-    IDAC_calibrate_SetValue(0);
+    
+    cal_point = 0;
+    cal_tick = 0;
+    cal_sum = 0;
+    cal_state = TIA_CAL_RUNNING;
+    
+    PWM_isr_Wakeup();
+    PWM_isr_WritePeriod(TIA_CAL_TICK_PERIOD - 1);
+    PWM_isr_WriteCompare(TIA_CAL_TICK_PERIOD / 2);
+    isr_adc_SetVector(calibrateInterrupt);
+    isr_adc_Enable();
+}
+
+/******************************************************************************
+* Function Name: calibrateInterrupt
+*******************************************************************************
+*
+* Summary:
+*  One tick of the sweep: wait TIA_CAL_SETTLE_TICKS after the IDAC step, then 
+*  sum cal_averages conversions and move to the next IDAC code
+*
+*******************************************************************************/
+
+static CY_ISR(calibrateInterrupt) {
+    cal_tick++;
+    if (cal_tick <= TIA_CAL_SETTLE_TICKS) {
+        return;
+    }
+    cal_sum += ADC_SigDel_GetResult16();
+    if (cal_tick < TIA_CAL_SETTLE_TICKS + cal_averages) {
+        return;
+    }
+    
+    // rounded average of the step
+    int32_t half = cal_averages / 2;
+    calibrate_array[cal_point + TIA_CAL_MAX_POINTS] = (int16_t)((cal_sum >= 0 ? cal_sum + half : cal_sum - half) / cal_averages);
+    
+    cal_point++;
+    cal_tick = 0;
+    cal_sum = 0;
+    if (cal_point < cal_points) {
+        calibrate_set_idac(calibrate_array[cal_point]);
+    } else {
+        isr_adc_Disable();
+        cal_state = TIA_CAL_DONE;
+    }
+}
+
+/******************************************************************************
+* Function Name: TIA_CalibrationTask
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop. When the sweep is over puts the hardware back to
+*  sleep, fits the points and prepares the TIA_SET frame. 
+*  When the drift check is over, compares the offset with the fitted one and
+*  starts a full background sweep if it moved more than TIA_DRIFT_THRESHOLD_COUNTS
+*
+* Return:
+*  1 if a calibration requested by the GUI has just been completed, 0 otherwise
+*
+*******************************************************************************/
+
+uint8_t TIA_CalibrationTask(void) {
+    if (cal_state != TIA_CAL_DONE) {
+        return 0;
+    }
+    calibrate_restore_timer();
+    calibrate_set_idac(0);
+    Calibrate_Hardware_Sleep();
+    cal_state = TIA_CAL_IDLE;
+    
+    if (cal_offset_check) {
+        int32_t drift_q16 = ((int32_t)calibrate_array[TIA_CAL_MAX_POINTS] << TIA_FIT_SHIFT) - tia_fit.offset_q16;
+        if (labs(drift_q16) > ((int32_t)TIA_DRIFT_THRESHOLD_COUNTS << TIA_FIT_SHIFT)) {
+            TIA_StartCalibration(cal_resistor_index, TIA_CAL_POINTS_DEFAULT, TIA_CAL_AVERAGES_DEFAULT);
+            cal_background = 1;
+        }
+        return 0;
+    }
+    
+    calibrate_fit();
+    range_apply(cal_resistor_index);
+    calibrate_residuals();
+    calibrate_fill_frame();
+    watchdog_SaveCalibration(cal_resistor_index);  // used again after a watchdog reset
+    
+    return !cal_background;
+}
+
+/******************************************************************************
+* Function Name: TIA_CalibrationRunning
+*******************************************************************************
+*
+* Summary:
+*  Check if the PWM_isr tick and the TIA are used by the calibration sweep
+*
+*******************************************************************************/
+
+uint8_t TIA_CalibrationRunning(void) {
+    return cal_state != TIA_CAL_IDLE;
+}
+
+/******************************************************************************
+* Function Name: TIA_CalibrationRequested
+*******************************************************************************
+*
+* Summary:
+*  Check if the running sweep has been requested by the GUI, which waits for
+*  its TIA_SET frame: it is not aborted, the procedures are refused until the
+*  end of it. A sweep started in background can be aborted
+*
+*******************************************************************************/
+
+uint8_t TIA_CalibrationRequested(void) {
+    return cal_state != TIA_CAL_IDLE && !cal_background;
+}
+
+/******************************************************************************
+* Function Name: TIA_RestoreCalibration
+*******************************************************************************
+*
+* Summary:
+*  Use a calibration done before a watchdog reset: tia_fit and
+*  tia_calibration_values have already been copied back, the fit is applied
+*  to the resistor without repeating the sweep
+*
+* Parameters:
+*  uint8 resistor_index: TIA resistor of the calibration
+*
+*******************************************************************************/
+
+void TIA_RestoreCalibration(uint8_t resistor_index) {
+    cal_resistor_index = resistor_index;
+    range_apply(cal_resistor_index);
+}
+
+/******************************************************************************
+* Function Name: TIA_AbortCalibration
+*******************************************************************************
+*
+* Summary:
+*  Stop the sweep (e.g. a procedure has to start), the previous fit is kept.
+*  Only for a sweep in background, see TIA_CalibrationRequested()
+*
+*******************************************************************************/
+
+void TIA_AbortCalibration(void) {
+    if (cal_state == TIA_CAL_IDLE) {
+        return;
+    }
+    isr_adc_Disable();
+    calibrate_restore_timer();
+    calibrate_set_idac(0);
     Calibrate_Hardware_Sleep();
+    cal_state = TIA_CAL_IDLE;
+}
+
+/******************************************************************************
+* Function Name: TIA_DriftScheduler
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop only while no procedure is running and no command
+*  is waiting. Every TIA_DRIFT_CHECK_PERIOD_MS starts a single point (0 A) 
+*  check of the offset, which takes a few tens of ms in background
+*
+* Parameters:
+*  uint32_t now_ms: current time from helper_Millis()
+*
+*******************************************************************************/
+
+void TIA_DriftScheduler(uint32_t now_ms) {
+    if (cal_state != TIA_CAL_IDLE) {
+        return;
+    }
+    if ((uint32_t)(now_ms - last_drift_check_ms) < TIA_DRIFT_CHECK_PERIOD_MS) {
+        return;
+    }
+    last_drift_check_ms = now_ms;
+    
+    cal_points = 1;
+    cal_averages = TIA_DRIFT_AVERAGES;
+    cal_offset_check = 1;
+    cal_background = 1;
+    calibrate_array[0] = 0;
+    calibrate_start();
+}
+
+/******************************************************************************
+* Function Name: TIA_YieldToCommand
+*******************************************************************************
+*
+* Summary:
+*  Called when a command arrives from the GUI: a drift check or a re-fit started
+*  by the scheduler is dropped at once (the previous fit is kept), a sweep 
+*  requested by the GUI goes on
+*
+*******************************************************************************/
+
+void TIA_YieldToCommand(void) {
+    if (cal_background) {
+        TIA_AbortCalibration();
+    }
+}
+
+/******************************************************************************
+* Function Name: calibrate_set_idac
+*******************************************************************************
+*
+* Summary:
+*  Set the calibration IDAC to a signed code, the polarity follows the sign
+*
+* Parameters:
+*  int16_t IDAC_value: value to set the calibration IDAC to before measuring with the ADC,
+*                      negative when the IDAC is sinking current
+*
+*******************************************************************************/
+
+static void calibrate_set_idac(int16_t IDAC_value) {
+    // the sinked currents are saved as negative, so that the fitted current has the sign used by the GUI
+    if (IDAC_value < 0) {
+        IDAC_calibrate_SetPolarity(IDAC_calibrate_SINK);
+        IDAC_calibrate_SetValue((uint8_t)(-IDAC_value));
+    } else {
+        IDAC_calibrate_SetPolarity(IDAC_calibrate_SOURCE);
+        IDAC_calibrate_SetValue((uint8_t)IDAC_value);
+    }
+}
+
+/******************************************************************************
+* Function Name: calibrate_restore_timer
+*******************************************************************************
+*
+* Summary:
+*  Give the PWM_isr and the isr_adc back to the procedures
+*
+*******************************************************************************/
+
+static void calibrate_restore_timer(void) {
+    isr_adc_SetVector(saved_adc_vector);
+    PWM_isr_WritePeriod(saved_pwm_period);
+    PWM_isr_WriteCompare(saved_pwm_compare);
+    PWM_isr_Sleep();
+}
+
+/******************************************************************************
+* Function Name: calibrate_fit
+*******************************************************************************
+*
+* Summary:
+*  Least squares fit counts = gain*I + offset on the averaged sweep points, in fixed
+*  point so that the gain is not quantised. The sums are 64 bit, with IDAC
+*  currents up to 31875 nA they do not overflow even after the Q16 shift.
+*  The gain is stored inverted so TIA_CountsToCurrent does not need a division.
+*
+* Global variables:
+*  calibrate_array: array of saved IDAC and ADC values
+*  tia_fit: updated only if the points are not degenerate
+*
+*******************************************************************************/
+
+static void calibrate_fit(void) {
+    int64_t n = cal_points;
+    int64_t sum_x = 0, sum_x2 = 0, sum_xy = 0, sum_y = 0;
     
+    for(int i=0; i<cal_points; i++){
+        int64_t x = (int64_t)calibrate_array[i] * IDAC_NA_PER_BIT; // nA
+        int64_t y = calibrate_array[i+TIA_CAL_MAX_POINTS];          // counts
+        sum_x  += x;
+        sum_x2 += x*x;
+        sum_y  += y;
+        sum_xy += x*y;
+    }
     
-    /* regressione lineare per calcolare R (V = R*I + q)
-    float sum_x = 0, sum_x2 = 0, sum_xy = 0, sum_y = 0, R, q;
-    for(int i=0; i<Number_calibration_points; i++){
-        sum_x = sum_x + calibrate_array[i];
-        sum_x2 = sum_x2 + calibrate_array[i]*calibrate_array[i];
-        sum_y = calibrate_array[i+Number_calibration_points];
-        sum_xy = sum_xy + calibrate_array[i]*calibrate_array[i+Number_calibration_points]; 
-    }
-    
-    q = (Number_calibration_points*sum_xy - sum_x*sum_y)/(Number_calibration_points*sum_x2 - (sum_x*sum_x));
-    R = (sum_y - q*sum_x)/Number_calibration_points;
-    */
-    // dobbiamo mandarla alla GUI
-    if(connection_state){ //TIA_calibrate -- BT already connected
-        for(int i=0; i<Number_calibration_points*2; i++){
-            uint8_t LSB_data = calibrate_array[i] & 0xFF;
-            uint8_t MSB_data = calibrate_array[i] >> 8;
-            data_to_send[2*i+1] = MSB_data;
-            data_to_send[2*i+2] = LSB_data;
+    int64_t den = n*sum_x2 - sum_x*sum_x;
+    int64_t num = n*sum_xy - sum_x*sum_y;
+    if (den == 0 || num == 0) { // all the points at the same current or the ADC is not responding
+        return;                 // keep the previous fit
+    }
+    
+    int64_t gain_q16 = (num << TIA_FIT_SHIFT) / den; // counts per nA
+    tia_fit.nA_per_count_q16 = (int32_t)((den << TIA_FIT_SHIFT) / num);
+    tia_fit.offset_q16 = (int32_t)(((sum_y << TIA_FIT_SHIFT) - gain_q16*sum_x) / n);
+}
+
+/******************************************************************************
+* Function Name: calibrate_residuals
+*******************************************************************************
+*
+* Summary:
+*  Distance of each averaged point from the fitted line and linearity error,
+*  i.e. the largest residual over the span of the fitted line in the sweep
+*
+* Global variables:
+*  cal_residuals: residual of each point in 1/256 of ADC count
+*  cal_linearity_ppm: linearity error in ppm of the swept range
+*
+*******************************************************************************/
+
+static void calibrate_residuals(void) {
+    int64_t max_residual = 0;
+    
+    for (int i = 0; i < cal_points; i++) {
+        int64_t current_q16 = ((int64_t)calibrate_array[i] * IDAC_NA_PER_BIT) << TIA_FIT_SHIFT;
+        int64_t fitted_q16 = (current_q16 << TIA_FIT_SHIFT) / tia_fit.nA_per_count_q16 + tia_fit.offset_q16;
+        int64_t residual = (((int64_t)calibrate_array[i+TIA_CAL_MAX_POINTS] << TIA_FIT_SHIFT) - fitted_q16)
+                           >> (TIA_FIT_SHIFT - TIA_RESIDUAL_SHIFT);
+        
+        if (residual > INT16_MAX) {
+            residual = INT16_MAX;
+        } else if (residual < INT16_MIN) {
+            residual = INT16_MIN;
         }
-        data_to_send[0] = TIA_SET; // header 
-        writeBT((Number_calibration_points*4)+1); 
-    } else { //TIA_initialize -- BT not connected
-        for(int i=0; i<Number_calibration_points*2; i++){
-            uint8_t LSB_data = calibrate_array[i] & 0xFF;
-            uint8_t MSB_data = calibrate_array[i] >> 8;
-            tia_calibration_values[2*i+1] = MSB_data;
-            tia_calibration_values[2*i+2] = LSB_data;
+        cal_residuals[i] = (int16_t)residual;
+        if (llabs(residual) > max_residual) {
+            max_residual = llabs(residual);
         }
-        tia_calibration_values[0] = TIA_SET;
     }
     
-    // se necessario salvare localmente, salvare in EEPROM 
-  
+    // span of the fitted line from the first to the last point, in 1/256 counts
+    int64_t span_nA = (int64_t)(calibrate_array[cal_points-1] - calibrate_array[0]) * IDAC_NA_PER_BIT;
+    int64_t span = llabs(((span_nA << (TIA_FIT_SHIFT + TIA_RESIDUAL_SHIFT)) / tia_fit.nA_per_count_q16));
+    int64_t ppm = span ? (max_residual * 1000000) / span : UINT16_MAX;
+    cal_linearity_ppm = ppm > UINT16_MAX ? UINT16_MAX : (uint16_t)ppm;
+}
+
+/******************************************************************************
+* Function Name: calibrate_fill_frame
+*******************************************************************************
+*
+* Summary:
+*  Prepare the TIA_SET frame in tia_calibration_values, all values big endian:
+*  A|nA per count (4)|offset (4)|linearity ppm (2)|N|N x [IDAC code (2)|counts (2)|residual (2)]
+*  It is sent with TIA_INITIALIZATION or at the end of TIA_CALIBRATE
+*
+*******************************************************************************/
+
+static void calibrate_fill_frame(void) {
+    uint8_t i = 0;
+    
+    tia_calibration_values[i++] = TIA_SET;
+    for (int b = 24; b >= 0; b -= 8) {
+        tia_calibration_values[i++] = (uint8_t)(tia_fit.nA_per_count_q16 >> b);
+    }
+    for (int b = 24; b >= 0; b -= 8) {
+        tia_calibration_values[i++] = (uint8_t)(tia_fit.offset_q16 >> b);
+    }
+    tia_calibration_values[i++] = cal_linearity_ppm >> 8;
+    tia_calibration_values[i++] = cal_linearity_ppm & 0xFF;
+    tia_calibration_values[i++] = cal_points;
+    
+    for (int p = 0; p < cal_points; p++) {
+        tia_calibration_values[i++] = (uint16_t)calibrate_array[p] >> 8;
+        tia_calibration_values[i++] = (uint16_t)calibrate_array[p] & 0xFF;
+        tia_calibration_values[i++] = (uint16_t)calibrate_array[p+TIA_CAL_MAX_POINTS] >> 8;
+        tia_calibration_values[i++] = (uint16_t)calibrate_array[p+TIA_CAL_MAX_POINTS] & 0xFF;
+        tia_calibration_values[i++] = (uint16_t)cal_residuals[p] >> 8;
+        tia_calibration_values[i++] = (uint16_t)cal_residuals[p] & 0xFF;
+    }
+    tia_calibration_length = i;
 }
 
 /******************************************************************************
-* Function Name: calibrate_step
+* Function Name: TIA_CountsToCurrent
 *******************************************************************************
 *
 * Summary:
-*  Gets a single calibration data point by setting the calibration IDAC and reading
-*  the ADC count and saving them in the calibration_array
+*  Apply the TIA fit to an ADC reading. Called by the ADC isr for each sample, 
+*  only one 64 bit multiplication is done. The gain of the fit is already
+*  scaled to the resistor chosen by the auto-range
 *
 * Parameters:
-*  uint16_t IDAC_value: value to set the calibration  IDAC to before measuring with the ADC
-*  uint8 IDAC_index: index of where in calibration_array to save the IDAC and ADC data
+*  int16_t adc_counts: result of ADC_SigDel_GetResult16()
 *
-* Global variables:
-*  calibration_array: array of saved IDAC and ADC values
+* Return:
+*  current in 1/8 nA (TIA_CURRENT_SHIFT), the whole range of the TIA
+*
+*******************************************************************************/
+
+int32_t TIA_CountsToCurrent(int16_t adc_counts) {
+    int64_t delta_q16 = ((int64_t)adc_counts << TIA_FIT_SHIFT) - tia_fit.offset_q16;
+    const uint8_t shift = 2*TIA_FIT_SHIFT - TIA_CURRENT_SHIFT;
+    
+    return (int32_t)((delta_q16 * range_nA_per_count_q16 + (1LL << (shift - 1))) >> shift);
+}
+
+/******************************************************************************
+* Function Name: TIA_CountsToNanoAmps
+*******************************************************************************
+*
+* Return:
+*  current of an ADC reading in nA, saturated to the int16 range. Used where
+*  only a threshold is checked (strip)
+*
+*******************************************************************************/
+
+int16_t TIA_CountsToNanoAmps(int16_t adc_counts) {
+    return TIA_CurrentToNanoAmps(TIA_CountsToCurrent(adc_counts));
+}
+
+/******************************************************************************
+* Function Name: TIA_CurrentToNanoAmps
+*******************************************************************************
+*
+* Parameters:
+*  int32_t current: 1/8 nA
+*
+* Return:
+*  current rounded to nA, saturated to the int16 range
+*
+*******************************************************************************/
+
+int16_t TIA_CurrentToNanoAmps(int32_t current) {
+    current = (current + (1 << (TIA_CURRENT_SHIFT - 1))) >> TIA_CURRENT_SHIFT;
+    if (current > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (current < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)current;
+}
+
+/******************************************************************************
+* Function Name: TIA_SampleEncode
+*******************************************************************************
+*
+* Summary:
+*  Pack a current in the 16 bit sample saved in data_long and sent to the GUI:
+*  the smallest exponent whose mantissa fits is used, so the small currents
+*  keep the 1/8 nA and the large ones (low resistors) are not clipped.
+*  Saturated beyond the largest exponent
+*
+* Parameters:
+*  int32_t current: 1/8 nA
+*
+* Return:
+*  exponent (bits 15-14) | mantissa (bits 13-0, two's complement)
+*
+*******************************************************************************/
+
+uint16_t TIA_SampleEncode(int32_t current) {
+    uint8_t exponent = 0;
+    int32_t mantissa = current;
+    
+    while (exponent < TIA_SAMPLE_EXPONENT_MAX &&
+           (mantissa > TIA_SAMPLE_MANTISSA_MAX || mantissa < -TIA_SAMPLE_MANTISSA_MAX - 1)) {
+        exponent++;  // a factor 4 for each exponent, rounded once from the current
+        mantissa = (current + (1L << (2*exponent - 1))) >> 2*exponent;
+    }
+    if (mantissa > TIA_SAMPLE_MANTISSA_MAX) {
+        mantissa = TIA_SAMPLE_MANTISSA_MAX;
+    } else if (mantissa < -TIA_SAMPLE_MANTISSA_MAX - 1) {
+        mantissa = -TIA_SAMPLE_MANTISSA_MAX - 1;
+    }
+    return ((uint16_t)exponent << TIA_SAMPLE_MANTISSA_BITS) | ((uint16_t)mantissa & ((1 << TIA_SAMPLE_MANTISSA_BITS) - 1));
+}
+
+/******************************************************************************
+* Function Name: TIA_SampleDecode
+*******************************************************************************
+*
+* Parameters:
+*  uint16_t sample: sample of data_long, see TIA_SampleEncode()
+*
+* Return:
+*  current in 1/8 nA
+*
+*******************************************************************************/
+
+int32_t TIA_SampleDecode(uint16_t sample) {
+    int32_t mantissa = sample & ((1 << TIA_SAMPLE_MANTISSA_BITS) - 1);
+    
+    if (mantissa > TIA_SAMPLE_MANTISSA_MAX) {  // sign of the 14 bit mantissa
+        mantissa -= 1 << TIA_SAMPLE_MANTISSA_BITS;
+    }
+    return mantissa * (1 << 2*(sample >> TIA_SAMPLE_MANTISSA_BITS));
+}
+
+/******************************************************************************
+* Function Name: TIA_RangeStart
+*******************************************************************************
+*
+* Summary:
+*  Called when a procedure starts: begin with the calibrated resistor and
+*  clear the list of the changes
+*
+*******************************************************************************/
+
+void TIA_RangeStart(void) {
+    range_status = TIA_RANGE_OK;
+    range_up_samples = 0;
+    range_clip_samples = 0;
+    range_changes_number = 0;
+    range_apply(cal_resistor_index);
+}
+
+/******************************************************************************
+* Function Name: TIA_RangeCheck
+*******************************************************************************
+*
+* Summary:
+*  Called by the adc isr after each sample. Near to the clipping the resistor is
+*  at least halved at once; if the signal would stay below TIA_RANGE_LOW_COUNTS
+*  with the next higher resistor for TIA_RANGE_UP_SAMPLES samples in a row, the
+*  resistor is raised. The new resistor is used from the next sample, so the
+*  samples already converted to currents are not changed. If the lowest resistor
+*  clips too the procedure has to be stopped
+*
+* Parameters:
+*  int16_t adc_counts: result of ADC_SigDel_GetResult16()
+*  uint16_t sample: index of the sample in data_long
+*
+* Return:
+*  TIA_RANGE_OK or TIA_RANGE_SATURATED
+*
+*******************************************************************************/
+
+uint8_t TIA_RangeCheck(int16_t adc_counts, uint16_t sample) {
+    uint8_t next_index = range_index;
+
+    if (abs(adc_counts) >= TIA_RANGE_HIGH_COUNTS) {
+        range_up_samples = 0;
+        if (range_index == 0) {
+            if (++range_clip_samples >= TIA_RANGE_ABORT_SAMPLES) {
+                range_status = TIA_RANGE_SATURATED;
+            }
+            return range_status;
+        }
+        next_index = 0;
+        for (uint8_t i = range_index; i > 0; i--) {  // highest resistor that is not more than half of this one
+            if (2*calibrate_TIA_resistor_list[i-1] <= calibrate_TIA_resistor_list[range_index]) {
+                next_index = i-1;
+                break;
+            }
+        }
+    }
+    else {
+        range_clip_samples = 0;
+        int32_t delta = abs(((int32_t)adc_counts << TIA_FIT_SHIFT) - tia_fit.offset_q16) >> TIA_FIT_SHIFT;
+        if (range_index < TIA_RES_FEEDBACK_MAX &&
+            delta*calibrate_TIA_resistor_list[range_index+1] < (int32_t)TIA_RANGE_LOW_COUNTS*calibrate_TIA_resistor_list[range_index]) {
+            if (++range_up_samples >= TIA_RANGE_UP_SAMPLES) {
+                next_index = range_index + 1;
+            }
+        }
+        else {
+            range_up_samples = 0;
+        }
+    }
+
+    if (next_index != range_index && range_changes_number < TIA_RANGE_MAX_CHANGES) {
+        range_changes[3*range_changes_number]   = (sample + 1) >> 8;  // first sample with the new resistor
+        range_changes[3*range_changes_number+1] = (sample + 1) & 0xFF;
+        range_changes[3*range_changes_number+2] = next_index;
+        range_changes_number++;
+        range_up_samples = 0;
+        range_apply(next_index);
+    }
+    return range_status;
+}
+
+/******************************************************************************
+* Function Name: TIA_RangeStop
+*******************************************************************************
+*
+* Summary:
+*  Called when the procedure is finished, the calibrated resistor is set back
+*  so that the drift check and the next procedure find it
+*
+*******************************************************************************/
+
+void TIA_RangeStop(void) {
+    range_apply(cal_resistor_index);
+}
+
+/******************************************************************************
+* Function Name: TIA_RangeStatus
+*******************************************************************************
+*
+* Summary:
+*  TIA_RANGE_SATURATED if the last procedure has been stopped because it clipped
+*
+*******************************************************************************/
+
+uint8_t TIA_RangeStatus(void) {
+    return range_status;
+}
+
+/******************************************************************************
+* Function Name: TIA_RangeSendStatus
+*******************************************************************************
+*
+* Summary:
+*  Send the auto-range of the last procedure to the GUI:
+*  H|status|changes|[first sample (2), resistor index] for each change|Z
+*  The samples are already calibrated currents, the list tells the resolution of each part
+*
+*******************************************************************************/
+
+void TIA_RangeSendStatus(void) {
+    uint8_t frame[TIA_RANGE_FRAME_SIZE + 1];
+    uint8_t i = 0;
+
+    frame[i++] = RANGE_DATA;
+    frame[i++] = range_status;
+    frame[i++] = range_changes_number;
+    for (uint8_t j = 0; j < 3*range_changes_number; j++) {
+        frame[i++] = range_changes[j];
+    }
+    frame[i++] = TAIL;
+    UART_BT_PutArray(frame, i);
+}
+
+/******************************************************************************
+* Function Name: range_apply
+*******************************************************************************
+*
+* Summary:
+*  Set the TIA resistor and scale the fit, done with the calibrated resistor,
+*  by the ratio of the nominal values
 *
 *******************************************************************************/
 
-static void calibrate_step(uint16_t IDAC_value, uint8 IDAC_index) {
-    IDAC_calibrate_SetValue(IDAC_value);
-    CyDelay(100);  // allow the ADC to settle
-    ADC_value = ADC_SigDel_GetResult16(); //la funzione restituisce un int16, noi lo salviamo in un uint16, il uC come fa a capire?
-    valore = ADC_SigDel_GetResult16();
-    valore_s = valore & 0x0FFF;
-   
-    calibrate_array[IDAC_index] = IDAC_value;
-    calibrate_array[IDAC_index + Number_calibration_points] = ADC_value;
-    // visto che usiamo la UART salviamo i dati in un array, salviamo le correnti da posiz. 0 a 4 e le tensioni da posiz. 5 a 10
+static void range_apply(uint8_t resistor_index) {
+    range_index = resistor_index & TIA_RES_FEEDBACK_MAX;
+    TIA_SetResFB(range_index);
+    range_nA_per_count_q16 = (int32_t)(((int64_t)tia_fit.nA_per_count_q16 * calibrate_TIA_resistor_list[cal_resistor_index & 0x07])
+                                       / calibrate_TIA_resistor_list[range_index]);
 }
 
 /******************************************************************************
@@ -26,7 +26,56 @@
 #define AMux_TIA_calibrat_ch 0
 #define AMux_TIA_measure_ch 1    
 
-uint16_t calibrate_array[2* Number_calibration_points ];
+#define IDAC_NA_PER_BIT     125 // the IDAC has a 1/8 uA per bit
+#define IDAC_MAX_CODE       255
+#define TIA_FIT_SHIFT       16  // gain and offset of the fit are kept in Q16.16
+#define TIA_RESIDUAL_SHIFT  8   // residuals are sent in 1/256 of ADC count
+
+// samples of data_long: exponent (2 bit) + signed mantissa (14 bit), current = mantissa * 4^exponent / 8 nA.
+// From 1/8 nA up to +-65 uA, finer than one ADC count with every resistor (0.5 nA at 1 MOhm, 25 nA at 20 kOhm)
+#define TIA_CURRENT_SHIFT       3       // currents of the samples in 1/8 nA
+#define TIA_SAMPLE_MANTISSA_BITS 14
+#define TIA_SAMPLE_MANTISSA_MAX ((1 << (TIA_SAMPLE_MANTISSA_BITS - 1)) - 1)
+#define TIA_SAMPLE_EXPONENT_MAX 3       // each step of the exponent is a factor 4
+
+#define TIA_CAL_TICK_PERIOD (FREQ_CLOCK_PWM/1000) // the sweep isr is called every 1 ms
+#define TIA_CAL_SETTLE_TICKS 20 // ms to wait after each IDAC step before averaging
+
+// idle time check of the TIA offset drift (temperature)
+#define TIA_DRIFT_CHECK_PERIOD_MS  60000 // one single point check every minute while idle
+#define TIA_DRIFT_AVERAGES         16
+#define TIA_DRIFT_THRESHOLD_COUNTS 2     // 1 mV at the ADC, beyond this the whole sweep is repeated
+
+// state of the background calibration sweep
+#define TIA_CAL_IDLE        0
+#define TIA_CAL_RUNNING     1
+#define TIA_CAL_DONE        2
+
+// auto-range of the TIA during the procedures (ADC config 2: 12 bit, +- 1.024 V)
+#define TIA_AUTORANGE           1       // 1: the TIA resistor is changed between the samples of a procedure
+#define TIA_RANGE_HIGH_COUNTS   1945    // 95% of the ADC range, the sample is near to clip: lower the resistor
+#define TIA_RANGE_LOW_COUNTS    819     // 40% of the range: a higher resistor is used if the signal stays below this with it
+#define TIA_RANGE_UP_SAMPLES    8       // samples in a row under TIA_RANGE_LOW_COUNTS before raising the resistor
+#define TIA_RANGE_ABORT_SAMPLES 3       // samples in a row near to clip with the lowest resistor before aborting
+#define TIA_RANGE_MAX_CHANGES   32      // changes saved (and done) in one procedure
+#define TIA_RANGE_FRAME_SIZE    (3 + 3*TIA_RANGE_MAX_CHANGES) // header + status + changes + [sample (2), resistor index] 
+
+// status of the auto-range, sent in the RANGE_DATA frame
+#define TIA_RANGE_OK            0
+#define TIA_RANGE_SATURATED     1       // clipping also with the lowest resistor, the procedure has been stopped
+
+int16_t calibrate_array[2* TIA_CAL_MAX_POINTS ]; // signed IDAC codes (SOURCE > 0), then averaged ADC counts
+
+/***************************************
+*        Structures
+***************************************/
+
+/* result of the least squares fit counts = gain*I + offset, stored already inverted
+   so that the ISR converts a sample with one multiplication */
+typedef struct {
+    int32_t nA_per_count_q16;   // 1/gain, nA for each ADC count
+    int32_t offset_q16;         // ADC counts read with no current in the TIA
+} tia_fit_t;
 
 
 /***************************************
@@ -37,11 +86,32 @@ uint8_t TIA_resistor_value_index;
 //uint8_t ADC_buffer_index; già presente in user_inputs.h
 extern float32 uA_per_adc_count;
 extern float32 R_analog_route;
+extern tia_fit_t tia_fit;
+
+extern uint8_t tia_calibration_length;
 
 /***************************************
 *        Function Prototypes
 ***************************************/  
 void calibrate_TIA(uint8_t resistor_value_index /* uint8 ADC_buffer_index >> this maybe remove*/);
+void TIA_StartCalibration(uint8_t resistor_value_index, uint8_t n_points, uint8_t n_averages);
+uint8_t TIA_CalibrationTask(void);
+uint8_t TIA_CalibrationRunning(void);
+uint8_t TIA_CalibrationRequested(void);
+void TIA_RestoreCalibration(uint8_t resistor_index);
+void TIA_AbortCalibration(void);
+void TIA_DriftScheduler(uint32_t now_ms);
+void TIA_YieldToCommand(void);
+int32_t TIA_CountsToCurrent(int16_t adc_counts);
+int16_t TIA_CountsToNanoAmps(int16_t adc_counts);
+int16_t TIA_CurrentToNanoAmps(int32_t current);
+uint16_t TIA_SampleEncode(int32_t current);
+int32_t TIA_SampleDecode(uint16_t sample);
+void TIA_RangeStart(void);
+uint8_t TIA_RangeCheck(int16_t adc_counts, uint16_t sample);
+void TIA_RangeStop(void);
+uint8_t TIA_RangeStatus(void);
+void TIA_RangeSendStatus(void);
 
 #endif
 /* [] END OF FILE */
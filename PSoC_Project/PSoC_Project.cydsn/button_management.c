@@ -0,0 +1,254 @@
+/*******************************************************************************
+* File Name: button_management.c
+*
+* Description:
+*  The press is latched by the PICU of port 2 and taken by button_Poll() at
+*  every iteration of the main loop; the measure is started by the main loop
+*  while the device is idle, with the same path of MEASURE_GLUCOSE,
+*  and procedure_end() gives back the glucose at the end of it. The blink of the
+*  result is timed by button_Task() with the ms counter, so the device
+*  answers to the GUI while blinking
+*********************************************************************************/
+
+#include "button_management.h"
+#include "glucose_management.h"
+#include "hardware_management.h"
+#include "journal_management.h"
+
+static uint8_t button_pressed;              // set by button_Poll(), cleared by button_Task()
+static uint32_t button_press_ms;
+static uint8_t button_state = BUTTON_NO_RESULT;
+static uint8_t button_show;                 // result (or failure) to blink
+static int16_t button_glucose;
+static int16_t button_current;
+static uint32_t button_result_ms;
+
+// durations of the blink, on at even indexes and off at odd ones
+static uint16_t button_blink[BUTTON_BLINK_MAX];
+static uint8_t button_blinks;
+static uint8_t button_blink_index;
+static uint32_t button_blink_ms;
+
+/***************************************
+* Forward function references
+***************************************/
+static void button_make_blink(void);
+static void button_led(uint8_t on);
+
+/******************************************************************************
+* Function Name: button_Start
+*******************************************************************************
+*
+* Summary:
+*  Set up the pin of the button, called once at power on. The pin is not in
+*  the schematic, so it is driven through its registers: resistive pull up
+*  (the button closes it to ground) and the PICU latches the falling edge of
+*  the press until button_Poll() reads it
+*
+*******************************************************************************/
+
+void button_Start(void) {
+    CyPins_SetPinDriveMode(BUTTON_PIN_PC, CY_PINS_DM_RES_UP);
+    CyPins_SetPin(BUTTON_PIN_PC);  // the pull up
+    CY_SET_REG8(BUTTON_PICU_INTTYPE, BUTTON_INTTYPE_FALLING);
+    (void)CY_GET_REG8(BUTTON_PICU_INTSTAT);  // clear on read
+}
+
+/******************************************************************************
+* Function Name: button_Poll
+*******************************************************************************
+*
+* Summary:
+*  Called at every iteration of the main loop: takes the press latched by the
+*  PICU, ignored while a procedure is running
+*
+*******************************************************************************/
+
+void button_Poll(void) {
+    if ((CY_GET_REG8(BUTTON_PICU_INTSTAT) & BUTTON_PIN_MASK) && !isr_dac_GetState()) {
+        button_pressed = true;
+    }
+}
+
+/******************************************************************************
+* Function Name: button_Task
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop while the device is idle. Accepts a press (one
+*  every BUTTON_DEBOUNCE_MS, none while a measure of the button is in
+*  progress), notices a measure that has been dropped before starting (no
+*  sample before the timeout, refused, new command) and blinks the result
+*
+* Parameters:
+*  uint32_t now_ms: current time from helper_Millis()
+*
+* Return:
+*  true when the standard glucose measure has to be started
+*
+*******************************************************************************/
+
+uint8_t button_Task(uint32_t now_ms) {
+    if (button_state == BUTTON_MEASURING && !glucose_request && !button_show) {
+        button_state = BUTTON_FAILED;
+        button_glucose = JOURNAL_NO_GLUCOSE;
+        button_current = 0;
+        button_result_ms = now_ms;
+        button_show = true;
+    }
+    if (button_show) {
+        button_show = false;
+        button_make_blink();
+        button_blink_index = 0;
+        button_blink_ms = now_ms;
+        button_led(true);
+    }
+    else if (button_blink_index < button_blinks &&
+             (uint32_t)(now_ms - button_blink_ms) >= button_blink[button_blink_index]) {
+        button_blink_index++;
+        button_blink_ms = now_ms;
+        button_led(button_blink_index < button_blinks && !(button_blink_index & 1));
+    }
+
+    if (!button_pressed) {
+        return false;
+    }
+    button_pressed = false;
+    uint8_t accepted = (uint32_t)(now_ms - button_press_ms) >= BUTTON_DEBOUNCE_MS &&
+                       button_state != BUTTON_MEASURING;
+    button_press_ms = now_ms;  // the bounces keep the button closed
+    if (!accepted) {
+        return false;
+    }
+    if (button_blink_index < button_blinks) {  // the blink of the previous result is stopped
+        button_blink_index = button_blinks;
+        button_led(false);
+    }
+    button_state = BUTTON_MEASURING;
+    return true;
+}
+
+/******************************************************************************
+* Function Name: button_SaveResult
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop at the end of a glucose measure: if it has been
+*  started by the button the result is kept for the GUI and blinked
+*
+* Parameters:
+*  int16_t glucose: mg/dL, JOURNAL_NO_GLUCOSE if not computed
+*  int16_t current_nA: current at the sampling time
+*
+*******************************************************************************/
+
+void button_SaveResult(int16_t glucose, int16_t current_nA) {
+    if (button_state != BUTTON_MEASURING) {
+        return;
+    }
+    button_glucose = glucose;
+    button_current = current_nA;
+    button_result_ms = helper_Millis();
+    button_state = (glucose == JOURNAL_NO_GLUCOSE || procedure_stopped) ? BUTTON_FAILED : BUTTON_RESULT;
+    button_show = true;
+}
+
+/******************************************************************************
+* Function Name: button_Blinking
+*******************************************************************************
+*
+* Summary:
+*  true while the result is blinked (or about to be), the usual blink at the
+*  end of a procedure is not done
+*
+*******************************************************************************/
+
+uint8_t button_Blinking(void) {
+    return button_show || button_blink_index < button_blinks;
+}
+
+/******************************************************************************
+* Function Name: button_SendResult
+*******************************************************************************
+*
+* Summary:
+*  Answer to LAST_RESULT:
+*  D|state|glucose (mg/dL, 2)|current (nA, 2)|age of the result (s, 2)|Z
+*
+*******************************************************************************/
+
+void button_SendResult(void) {
+    uint8_t frame[BUTTON_FRAME_SIZE + 1];
+    uint32_t age_s = 0;
+
+    if (button_state == BUTTON_RESULT || button_state == BUTTON_FAILED) {
+        age_s = (helper_Millis() - button_result_ms) / 1000;
+        if (age_s > UINT16_MAX) {
+            age_s = UINT16_MAX;
+        }
+    }
+    frame[0] = BUTTON_DATA;
+    frame[1] = button_state;
+    frame[2] = (uint16_t)button_glucose >> 8;
+    frame[3] = button_glucose & 0xFF;
+    frame[4] = (uint16_t)button_current >> 8;
+    frame[5] = button_current & 0xFF;
+    frame[6] = age_s >> 8;
+    frame[7] = age_s & 0xFF;
+    frame[8] = TAIL;
+    UART_BT_PutArray(frame, BUTTON_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: button_make_blink
+*******************************************************************************
+*
+* Summary:
+*  Durations of the blink of the result: for each digit of the glucose
+*  (mg/dL, up to 999) as many blinks as the digit, one long blink for a zero,
+*  and a pause between the digits. Fast blinks if there is no glucose
+*
+*******************************************************************************/
+
+static void button_make_blink(void) {
+    button_blinks = 0;
+    if (button_state != BUTTON_RESULT || button_glucose < 0) {
+        for (uint8_t i = 0; i < BUTTON_ERROR_BLINKS; i++) {
+            button_blink[button_blinks++] = BUTTON_ERROR_MS;
+            button_blink[button_blinks++] = BUTTON_ERROR_MS;
+        }
+        return;
+    }
+
+    uint16_t glucose = button_glucose > 999 ? 999 : button_glucose;
+    uint16_t divider = glucose >= 100 ? 100 : (glucose >= 10 ? 10 : 1);
+    for (; divider > 0; divider /= 10) {
+        uint8_t digit = (glucose / divider) % 10;
+        if (digit == 0) {
+            button_blink[button_blinks++] = BUTTON_ZERO_MS;
+            button_blink[button_blinks++] = BUTTON_BLINK_OFF_MS;
+        }
+        for (uint8_t i = 0; i < digit; i++) {
+            button_blink[button_blinks++] = BUTTON_BLINK_ON_MS;
+            button_blink[button_blinks++] = BUTTON_BLINK_OFF_MS;
+        }
+        button_blink[button_blinks - 1] = BUTTON_DIGIT_PAUSE_MS;
+    }
+}
+
+/******************************************************************************
+* Function Name: button_led
+*******************************************************************************
+*
+* Summary:
+*  The LED of the device, driven by the two pins as in the blink at the end
+*  of the procedures
+*
+*******************************************************************************/
+
+static void button_led(uint8_t on) {
+    LED_ADC_Write(on);
+    LED_DAC_Write(on);
+}
+
+/* [] END OF FILE */
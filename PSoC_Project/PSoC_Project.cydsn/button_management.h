@@ -0,0 +1,64 @@
+/*******************************************************************************
+* File Name: button_management.h
+*
+* Description:
+*  Glucose measure without the GUI. A press of the user button of the kit starts
+*  the standard CA of the flash library with the defaults kept in RAM, as the
+*  MEASURE_GLUCOSE command does, waiting for the sample if the strip is still
+*  dry. The glucose computed on the device is kept in RAM until the GUI asks
+*  for it (and saved in the journal as every measure) and the LED blinks its
+*  digits
+*********************************************************************************/
+
+#if !defined(BUTTON_MANAGEMENT_H)
+#define BUTTON_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "cypins.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+// user button of the kit on P2[2], set up by button_Start() through the registers of the port
+#define BUTTON_PIN_PC           CYREG_PRT2_PC2
+#define BUTTON_PIN_MASK         0x04u
+#define BUTTON_PICU_INTTYPE     CYREG_PICU2_INTTYPE2
+#define BUTTON_PICU_INTSTAT     CYREG_PICU2_INTSTAT  // sticky, cleared on read
+#define BUTTON_INTTYPE_FALLING  0x02u
+
+#define BUTTON_DEBOUNCE_MS      300 // presses closer than this are the same one
+
+// blink of the result, the main loop runs every 100 ms
+#define BUTTON_BLINK_ON_MS      300 // one blink for each unit of the digit
+#define BUTTON_BLINK_OFF_MS     300
+#define BUTTON_ZERO_MS          1000 // a zero is one long blink
+#define BUTTON_DIGIT_PAUSE_MS   1500 // between two digits
+#define BUTTON_ERROR_BLINKS     10   // fast blinks when there is no glucose
+#define BUTTON_ERROR_MS         100
+#define BUTTON_BLINK_MAX        (2*3*9) // three digits of nine blinks, on and off
+
+// state of the measure started by the button, sent in the BUTTON_DATA frame
+#define BUTTON_NO_RESULT        0   // no measure since power on
+#define BUTTON_MEASURING        1   // waiting for the sample or measuring
+#define BUTTON_RESULT           2   // glucose and current of the last measure
+#define BUTTON_FAILED           3   // no sample before the timeout, stopped, or no glucose
+
+#define BUTTON_FRAME_SIZE       8   // header + state + glucose (2) + current (2) + age (s, 2)
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+void button_Start(void);
+void button_Poll(void);
+uint8_t button_Task(uint32_t now_ms);
+void button_SaveResult(int16_t glucose, int16_t current_nA);
+uint8_t button_Blinking(void);
+void button_SendResult(void);
+
+#endif
+
+/* [] END OF FILE */
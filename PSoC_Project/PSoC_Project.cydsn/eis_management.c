@@ -0,0 +1,338 @@
+/*******************************************************************************
+* File Name: eis_management.c
+*
+* Description:
+*  Impedance sweep. The isr_adc is taken from the procedures (as the TIA
+*  calibration does) and at every tick of the PWM_isr it reads the current,
+*  adds it to the DFT and moves the DAC to the next point of the sine kept in
+*  eis_wave. eis_Task() computes the impedance of each frequency and
+*  starts the next one
+*********************************************************************************/
+
+#include "eis_management.h"
+#include "hardware_management.h"
+#include "BT_protocols.h"
+#include "math.h"
+
+// Q15 sine of one period, the cosine is the same table a quarter later
+static const int16_t eis_sine[EIS_SAMPLES] = {
+    0, 6393, 12539, 18204, 23170, 27245, 30273, 32137, 32767, 32137, 30273, 27245, 23170, 18204, 12539, 6393,
+    0, -6393, -12539, -18204, -23170, -27245, -30273, -32137, -32767, -32137, -30273, -27245, -23170, -18204, -12539, -6393
+};
+
+typedef struct {
+    uint32_t frequency_mHz;
+    uint32_t modulus_ohm;
+    int16_t phase_cdeg;
+} eis_point_t;
+
+// state of the frequency in progress, shared with the isr
+static volatile uint8_t eis_state = EIS_IDLE;
+static volatile uint8_t eis_done;       // the DFT of the frequency in progress is complete
+static volatile uint8_t eis_sample;     // point of the sine held by the DAC
+static volatile uint8_t eis_periods;    // periods of the sine played
+static volatile int64_t eis_re;         // DFT of the current, 1/8 nA (TIA_CURRENT_SHIFT) * Q15
+static volatile int64_t eis_im;
+
+static uint16_t eis_wave[EIS_SAMPLES];  // DAC values of the sine played, waveform_lut can be in flash
+static uint16_t eis_bias;               // DAC value of the bias
+static uint16_t eis_amplitude;          // DAC levels of the sine
+static uint32_t eis_start_mHz;
+static uint32_t eis_stop_mHz;
+static uint8_t eis_points;
+static uint8_t eis_point;               // frequency in progress
+static eis_point_t eis_results[EIS_MAX_POINTS];
+
+// PWM and isr settings of the procedures, restored at the end of the sweep
+static cyisraddress saved_adc_vector;
+static uint16_t saved_pwm_period;
+static uint16_t saved_pwm_compare;
+
+/***************************************
+* Forward function references
+***************************************/
+static CY_ISR_PROTO(eisInterrupt);
+static void eis_start_point(void);
+static void eis_compute_point(void);
+static void eis_stop(void);
+static void eis_send_results(void);
+
+/******************************************************************************
+* Function Name: eis_Start
+*******************************************************************************
+*
+* Summary:
+*  EIS_MEASURE command:
+*  W|bias (mV, int16)|amplitude (mV)|first frequency (0.1 Hz, 2)|last frequency (0.1 Hz, 2)|points|Z
+*  big endian, the data escaped with BT_ESCAPE. The points are spaced
+*  logarithmically, the frequencies are
+*  rounded to a whole PWM period for each point of the sine. Returns at once,
+*  the result is sent by eis_Task() as
+*  W|points|[frequency (mHz, 4)|modulus (ohm, 4)|phase (0.01 deg, int16)] for each point|Z
+*
+* Return:
+*  false if the parameters are not valid, a procedure or a TIA calibration
+*  requested by the GUI is running, nothing is started
+*
+*******************************************************************************/
+
+uint8_t eis_Start(volatile uint8_t data_buffer[]) {
+    uint8_t frame[DATA_MAX_READING_SIZE];
+    
+    if (BT_Unescape(data_buffer, frame) < 8) {
+        return false;
+    }
+    int16_t bias_mV = (frame[0] << 8) | frame[1];
+    
+    eis_start_mHz = (uint32_t)((frame[3] << 8) | frame[4]) * 100;
+    eis_stop_mHz = (uint32_t)((frame[5] << 8) | frame[6]) * 100;
+    eis_points = frame[7];
+    if (eis_points == 0 || eis_points > EIS_MAX_POINTS || eis_start_mHz == 0 || eis_stop_mHz == 0 ||
+        isr_dac_GetState() || TIA_CalibrationRequested()) {
+        return false;
+    }
+    eis_Abort();
+    TIA_AbortCalibration();  // the sweep needs the PWM_isr tick and the TIA input
+    
+    eis_bias = dac_ground_value + bias_mV/dac_resolution;
+    eis_amplitude = frame[2] / dac_resolution;
+    if (eis_amplitude == 0) {
+        eis_amplitude = 1;
+    }
+    
+    saved_adc_vector = isr_adc_GetVector();
+    saved_pwm_period = PWM_isr_ReadPeriod();
+    saved_pwm_compare = PWM_isr_ReadCompare();
+    
+    helper_HardwareWakeup();
+    Opamp_Aux_Start();
+    ADC_SigDel_Start();
+    ADC_SigDel_StartConvert();
+    DAC_SetValue(eis_bias);
+    CyDelay(EIS_BIAS_SETTLE_MS);
+    
+    eis_point = 0;
+    eis_state = EIS_RUNNING;
+    isr_adc_SetVector(eisInterrupt);
+    eis_start_point();
+    return true;
+}
+
+/******************************************************************************
+* Function Name: eis_Task
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop. When the DFT of a frequency is complete the
+*  impedance is computed and the next frequency is started; after the last
+*  one the hardware is put back to sleep and the results are sent
+*
+*******************************************************************************/
+
+void eis_Task(void) {
+    if (eis_state != EIS_RUNNING || !eis_done) {
+        return;
+    }
+    eis_compute_point();
+    eis_point++;
+    if (eis_point < eis_points) {
+        eis_start_point();
+        return;
+    }
+    eis_stop();
+    eis_send_results();
+}
+
+/******************************************************************************
+* Function Name: eis_Abort
+*******************************************************************************
+*
+* Summary:
+*  Stop the sweep, called when a new command arrives. Nothing is sent
+*
+*******************************************************************************/
+
+void eis_Abort(void) {
+    if (eis_state == EIS_IDLE) {
+        return;
+    }
+    eis_stop();
+}
+
+/******************************************************************************
+* Function Name: eis_Running
+*******************************************************************************
+*
+* Summary:
+*  Check if the PWM_isr tick, the DAC and the TIA are used by the sweep
+*
+*******************************************************************************/
+
+uint8_t eis_Running(void) {
+    return eis_state != EIS_IDLE;
+}
+
+/******************************************************************************
+* Function Name: eisInterrupt
+*******************************************************************************
+*
+* Summary:
+*  One point of the sine: the current read is the answer to the point held
+*  by the DAC since the previous tick. After EIS_SETTLE_PERIODS it is added to
+*  the DFT, then the DAC moves to the next point. The current is summed in
+*  1/8 nA, neither rounded to nA nor saturated to int16
+*
+*******************************************************************************/
+
+static CY_ISR(eisInterrupt) {
+    int64_t current = TIA_CountsToCurrent(ADC_SigDel_GetResult16());
+    uint8_t n = eis_sample;
+    
+    if (eis_periods >= EIS_SETTLE_PERIODS) {
+        eis_re += current * eis_sine[(n + EIS_SAMPLES/4) & (EIS_SAMPLES - 1)];
+        eis_im -= current * eis_sine[n];
+    }
+    n = (n + 1) & (EIS_SAMPLES - 1);
+    DAC_SetValue(eis_wave[n]);
+    eis_sample = n;
+    
+    if (n == 0 && ++eis_periods >= EIS_SETTLE_PERIODS + EIS_MEASURE_PERIODS) {
+        isr_adc_Disable();
+        eis_done = true;
+    }
+}
+
+/******************************************************************************
+* Function Name: eis_start_point
+*******************************************************************************
+*
+* Summary:
+*  Make the sine in eis_wave and set the PWM_isr to EIS_SAMPLES ticks for
+*  each period of the frequency eis_point of the sweep. The frequency actually
+*  played is kept with the result
+*
+*******************************************************************************/
+
+static void eis_start_point(void) {
+    double ratio = (eis_points > 1) ? (double)eis_point / (eis_points - 1) : 0;
+    double frequency = eis_start_mHz * pow((double)eis_stop_mHz / eis_start_mHz, ratio) / 1000;
+    double period = (double)FREQ_CLOCK_PWM / (frequency * EIS_SAMPLES) + 0.5;
+    
+    if (period < EIS_MIN_PWM_PERIOD) {
+        period = EIS_MIN_PWM_PERIOD;
+    } else if (period > UINT16_MAX) {
+        period = UINT16_MAX;
+    }
+    uint16_t pwm_period = (uint16_t)period;
+    eis_results[eis_point].frequency_mHz = (uint32_t)(1000.0 * FREQ_CLOCK_PWM / ((double)pwm_period * EIS_SAMPLES) + 0.5);
+    
+    for (uint8_t n = 0; n < EIS_SAMPLES; n++) {
+        int32_t offset = (int32_t)eis_amplitude * eis_sine[n];
+        eis_wave[n] = eis_bias + (offset >= 0 ? (offset + (1 << 14)) >> 15 : -((-offset + (1 << 14)) >> 15));
+    }
+    
+    eis_re = 0;
+    eis_im = 0;
+    eis_periods = 0;
+    eis_sample = 0;
+    eis_done = false;
+    DAC_SetValue(eis_wave[0]);
+    
+    PWM_isr_Wakeup();
+    PWM_isr_WritePeriod(pwm_period - 1);
+    PWM_isr_WriteCompare(pwm_period / 2);
+    isr_adc_Enable();
+}
+
+/******************************************************************************
+* Function Name: eis_compute_point
+*******************************************************************************
+*
+* Summary:
+*  Impedance of the frequency just measured, Z = V/I with the DFT of the sine
+*  actually played (DAC levels, so the rounding of small amplitudes is taken
+*  into account) and the DFT of the current. The DAC holds each point for one
+*  tick and the current is read at the end of the same tick, so both DFTs use
+*  the same weights: for a resistive cell the ratio is exact, the last
+*  conversion of the ADC (20 us) is well inside the tick
+*
+*******************************************************************************/
+
+static void eis_compute_point(void) {
+    double v_re = 0;
+    double v_im = 0;
+    
+    for (uint8_t n = 0; n < EIS_SAMPLES; n++) {
+        double level = ((int16_t)eis_wave[n] - (int16_t)eis_bias) * (double)dac_resolution; // mV
+        v_re += level * eis_sine[(n + EIS_SAMPLES/4) & (EIS_SAMPLES - 1)];
+        v_im -= level * eis_sine[n];
+    }
+    v_re *= EIS_MEASURE_PERIODS;
+    v_im *= EIS_MEASURE_PERIODS;
+    
+    double i_modulus = sqrt((double)eis_re * eis_re + (double)eis_im * eis_im) / (1 << TIA_CURRENT_SHIFT); // nA
+    double modulus = 0;
+    if (i_modulus > 0) {
+        modulus = sqrt(v_re * v_re + v_im * v_im) / i_modulus * 1e6; // mV/nA to ohm
+    }
+    double phase = atan2(v_im, v_re) - atan2((double)eis_im, (double)eis_re);
+    while (phase > M_PI) {
+        phase -= 2 * M_PI;
+    }
+    while (phase <= -M_PI) {
+        phase += 2 * M_PI;
+    }
+    
+    eis_results[eis_point].modulus_ohm = (modulus > UINT32_MAX || i_modulus == 0) ? UINT32_MAX : (uint32_t)(modulus + 0.5);
+    eis_results[eis_point].phase_cdeg = (int16_t)lround(phase * 18000 / M_PI);
+}
+
+/******************************************************************************
+* Function Name: eis_stop
+*******************************************************************************
+*
+* Summary:
+*  Give the PWM_isr and the isr_adc back to the procedures and put the
+*  hardware to sleep at the virtual ground
+*
+*******************************************************************************/
+
+static void eis_stop(void) {
+    isr_adc_Disable();
+    isr_adc_SetVector(saved_adc_vector);
+    PWM_isr_WritePeriod(saved_pwm_period);
+    PWM_isr_WriteCompare(saved_pwm_compare);
+    PWM_isr_Sleep();
+    DAC_SetValue(dac_ground_value);
+    helper_HardwareSleep();
+    eis_state = EIS_IDLE;
+}
+
+/******************************************************************************
+* Function Name: eis_send_results
+*******************************************************************************
+*
+* Summary:
+*  Send the EIS_DATA frame, one point at a time
+*
+*******************************************************************************/
+
+static void eis_send_results(void) {
+    uint8_t frame[EIS_POINT_SIZE];
+    
+    frame[0] = EIS_DATA;
+    frame[1] = eis_points;
+    UART_BT_PutArray(frame, 2);
+    for (uint8_t i = 0; i < eis_points; i++) {
+        for (uint8_t j = 0; j < 4; j++) {
+            frame[j] = eis_results[i].frequency_mHz >> (24 - 8*j);
+            frame[4+j] = eis_results[i].modulus_ohm >> (24 - 8*j);
+        }
+        frame[8] = (uint16_t)eis_results[i].phase_cdeg >> 8;
+        frame[9] = eis_results[i].phase_cdeg & 0xFF;
+        UART_BT_PutArray(frame, EIS_POINT_SIZE);
+    }
+    UART_BT_PutChar(TAIL);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,49 @@
+/*******************************************************************************
+* File Name: eis_management.h
+*
+* Description:
+*  Electrochemical impedance: a sine of EIS_SAMPLES points is played by the DAC
+*  over a DC bias at each frequency of a logarithmic sweep, and the current is
+*  demodulated on the device with a single bin DFT synchronous with the sine.
+*  Only the modulus and the phase of each point are sent, a few hundred bytes
+*  for the whole spectrum. The sweep runs in background like the TIA
+*  calibration, the main loop polls eis_Task()
+*********************************************************************************/
+
+#if !defined(EIS_MANAGEMENT_H)
+#define EIS_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+#include "DAC_management.h"
+#include "TIA_calibrate.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define EIS_SAMPLES             32  // points of the sine, a power of 2
+#define EIS_MAX_POINTS          40  // frequencies of one sweep
+#define EIS_SETTLE_PERIODS      2   // periods of the sine before the DFT, at every frequency
+#define EIS_MEASURE_PERIODS     4   // periods summed by the DFT
+#define EIS_BIAS_SETTLE_MS      200 // at the bias before the first frequency
+#define EIS_MIN_PWM_PERIOD      24  // 10 kHz isr, ~300 Hz sine: fastest rate of the adc isr
+#define EIS_POINT_SIZE          10  // frequency (mHz, 4) + modulus (ohm, 4) + phase (0.01 deg, 2)
+
+// state of the sweep
+#define EIS_IDLE                0
+#define EIS_RUNNING             1
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint8_t eis_Start(volatile uint8_t data_buffer[]);
+void eis_Task(void);
+void eis_Abort(void);
+uint8_t eis_Running(void);
+
+#endif
+
+/* [] END OF FILE */
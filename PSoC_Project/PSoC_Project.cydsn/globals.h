@@ -11,19 +11,25 @@
 #include "cytypes.h"
 #include "stdio.h"  // gets rid of the type errors
     
-#define FREQ_CLOCK_PWM 2400000
-#define T_PWM_STD_CA 10*FREQ_CLOCK_PWM //10ms, here it is expressed in clock repetitions
+#define FREQ_CLOCK_PWM 240000 // Hz, Clock_PWM is BUS_CLK (24 MHz) divided by 100
+#define CA_STEP_MS 10 // one sample of the CA every 10ms
+#define CA_BASELINE_SAMPLES 20 // baseline before and after the CA pulse, 200ms
     
 #define TIA_RESISTOR_DEFAULT_VALUE_INDEX 0
-#define Number_calibration_points 5
+#define TIA_CAL_POINTS_DEFAULT 9 // IDAC steps of the calibration sweep
+#define TIA_CAL_MAX_POINTS 17
+#define TIA_CAL_AVERAGES_DEFAULT 8 // ADC conversions averaged for each step
+#define TIA_CAL_MAX_AVERAGES 64
+// header + nA per count (4) + offset (4) + linearity error (2) + points (1) + 6 bytes for each point
+#define TIA_CAL_FRAME_SIZE (12 + 6*TIA_CAL_MAX_POINTS)
     
 /**************************************
 *        BT OUTPUT OPTIONS 
 **************************************/ 
     
 #define DATA_MAX_SENDING_SIZE       120 // max number of bytes to send with BT 
-#define DATA_MAX_READING_SIZE       20
-#define DATA_LONG_SIZE              5000 // max number of bytes to send with BT
+#define DATA_MAX_READING_SIZE       25 // longest command: R|4 with its 11 bytes of data escaped
+#define RX_FRAMES                   4  // frames received and not handled yet (power of 2), UPLOAD_WINDOW of the GUI
 #define PARAMS_SENDING_SIZE         2 // bytes sent when parameters are read 
 #define BT_SET                      'F'
 #define CV_PARAMS_SET               'B'
@@ -37,6 +43,21 @@
 #define CA_DATA                     'M'
 #define EEPROM_DATA_CV              'E'
 #define EEPROM_DATA_CA              'E'
+#define JOURNAL_DATA                'L'
+#define GLUCOSE_DATA                'G'
+#define PROFILE_DATA                'P' // only with DAC_PROFILE
+#define CV_CYCLE_DATA               'N' // last cycle of a multi-cycle CV, before the averaged 'M'
+#define COTTRELL_DATA               'K' // Cottrell fit of the CA pulse, before 'G' and 'M'
+#define STRIP_DATA                  'T' // state of the strip, when a run is refused or while waiting for the sample
+#define RANGE_DATA                  'H' // changes of the TIA resistor made by the auto-range, before 'G' and 'M'
+#define STOPPED_DATA                'Q' // answer to STOP_PROCEDURE, before the truncated measure
+#define BENCHMARK_DATA              'X' // cost of one step of the procedures and maximum step rate
+#define EIS_DATA                    'W' // modulus and phase of each frequency of the impedance sweep
+#define JOB_DATA                    'J' // answers and events of the queue of jobs, before the frames of each job
+#define WAVEFORM_DATA               'O' // procedure of the flash library selected
+#define UPLOAD_DATA                 'U' // answer to each command of the upload of a waveform
+#define BUTTON_DATA                 'D' // last glucose measure started with the button of the device
+#define WATCHDOG_DATA               'I' // report of a watchdog reset: at power on, or asked with RESET_REPORT
 // TO DO aggiungere header per LUT quando viene inviata 
 
 
@@ -55,33 +76,27 @@
 #define DAC_MANAGEMENT          'S'
 #define CONNECT_BT              'F' 
 #define TIA_INITIALIZATION      'I'    
+#define JOURNAL_MANAGEMENT      'L'
+#define MEASURE_GLUCOSE         'G'
+#define STOP_PROCEDURE          'Q'  // handled at once by the RX isr while a procedure is running
+#define JOB_MANAGEMENT          'J'
+#define BENCHMARK               'X'
+#define EIS_MEASURE             'W'
+#define WAVEFORM_SELECT         'O'  // O|id|Z, procedure of the flash library (waveform_management.h)
+#define UPLOAD_WAVEFORM         'U'  // U|command|data|Z, waveform uploaded in chunks (upload_management.h)
+#define LAST_RESULT             'K'  // K|Z, glucose measured with the button (button_management.h)
+#define RESET_REPORT            'H'  // H|Z, last watchdog reset saved in the EEPROM (watchdog_management.h)
+
+// the binary data of the commands (U, L, W, R|4) can hold a TAIL: TAIL and BT_ESCAPE
+// are sent as BT_ESCAPE, byte ^ BT_ESCAPE_XOR and the receiver takes them back with BT_Unescape()
+#define BT_ESCAPE               0x7D
+#define BT_ESCAPE_XOR           0x20
 
 
 /**************************************
-*        EEPROM ADDRESSES
+*        EEPROM DEFAULT VALUES
 **************************************/ 
-
-#define V_DEFAULT_ADD            0x00
-#define T_DEFAULT_ADD            0x01
-#define SCAN_RATE_DEFAULT_ADD    0x02
-#define START_DEFAULT_ADD        0x03
-#define END_DEFAULT_ADD          0x04
-#define INCREMENT_DEFAULT_ADD    0x05
-#define HEIGH_DEFAULT_ADD        0x06
-#define CA_PERIOD_DEFAULT_ADD    0x07
-#define EEPROM_FLAG_ADD          0xFF
-    
-#define V_DEFAULT_ADD_USER            0x08
-#define T_DEFAULT_ADD_USER            0x0A
-#define SCAN_RATE_DEFAULT_ADD_USER    0x0B
-#define START_DEFAULT_ADD_USER        0x0C
-#define END_DEFAULT_ADD_USER          0x0D
-#define INCREMENT_DEFAULT_ADD_USER    0x0E
-#define HEIGH_DEFAULT_ADD_USER        0x0F
-#define CA_PERIOD_DEFAULT_ADD_USER    0x10
-
-#define R_TIA_CALIBRATION             0x11
-#define Q_TIA_CALIBRATION             0x12
+// the EEPROM layout is the params_t structure in params_management.h
 
 #define V_DEFAULT                0x38 // 56mv 
 #define CA_PERIOD_DEFAULT        0x0A // 10 tenths of a second
@@ -90,18 +105,31 @@
 #define END_DEFAULT              0x1E // 30 (*10)mV
 #define INCREMENT_DEFAULT        0x01 // 1mV 
 #define HEIGH_DEFAULT            0x02 // 2mV
-    
-#define EEPROM_FLAG              0
-#define EEPROM_FLAG_DONE         1   
+// glucose (mg/dL) = -122.0998 + 368393.2303 * current (mA), found during the calibration
+#define GLUCOSE_SLOPE_DEFAULT       24143    // 0.3683932 mg/dL for each nA, Q16.16
+#define GLUCOSE_INTERCEPT_DEFAULT   (-8001932) // -122.0998 mg/dL, Q16.16
+#define GLUCOSE_SAMPLE_DEFAULT      50       // 500 ms after the start of the CA
+#define GLUCOSE_WINDOW_DEFAULT      4        // 9 samples averaged
 
 /**************************************
 *           ADC Constants
 **************************************/  
     
-// define how big to make the arrays for the lut for dac and how big
-// to make the adc data array     
-#define MAX_LUT_SIZE 5000
+// the look up table of the dac and the samples of the adc share the memory arena,
+// their size depends on the procedure (see memory_management.h)
 #define ADC_CHANNELS 4
+
+// what is sent after a square wave voltammetry, byte 7 of the CHANGE_CV_PARAMETERS command
+#define SWV_SEND_RAW                0 // every sample, forward and reverse (also any other value)
+#define SWV_SEND_NET                1 // one difference current (forward - reverse) for each step
+#define SWV_SEND_ALL                2 // forward, reverse and difference current for each step
+// byte 1 of the CHANGE_CV_PARAMETERS command is the scan rate in mV/s; with SCAN_RATE_FAST set
+// the other 7 bits are tens of mV/s (fast scan, up to 1.27 V/s)
+#define SCAN_RATE_FAST              0x80
+#define CV_FAST_MAX_STEP_HZ         (TIMING_TICK_HZ/2) // faster linear CVs make steps of more than one DAC level (timing_management.h)
+// cycles of the CV averaged on the device, byte 8 of the CHANGE_CV_PARAMETERS command
+// (any other value is one cycle), byte 9 set to 1 sends also the last cycle as it was measured
+#define CV_MAX_CYCLES               50
  
     
 /**************************************
@@ -125,8 +153,6 @@
 #define VDAC_IS_VDAC 1
 #define VDAC_IS_DVDAC 2
     
-#define VDAC_ADDRESS 0 // saving which DAC is selected in the EEPROM address 0x00 
-    
 #define EEPROM_READ_TEMPERATURE_CORRECT        0
     
     
@@ -150,17 +176,30 @@ cystatus    return_value; // return value used every time we want to read from t
     
 // LUT VARIABLES
 uint16_t    lut_value;  // value need to load DAC, also defined as extern 
-// add 5 to the lut to add a buffer cause a few functions go over the MAX_LUT_SIZE
-// by 1, and will use MAX_LUT_SIZE to check for over runs
+// the layout of the memory arena leaves MEMORY_LUT_GUARD entries after lut_capacity, cause
+// a few functions go over by 1, and will use lut_capacity to check for over runs
     
-volatile uint16_t waveform_lut[MAX_LUT_SIZE+5];  // **also defineed as extern in parametric_lut.h**
+volatile uint16_t *waveform_lut;  // in the memory arena, **also defineed as extern in parametric_lut.h**
+uint16_t    lut_capacity; // entries of waveform_lut that can be filled, 0 when the procedure has no LUT
 uint16_t    lut_index;  
 uint16_t    lut_length;
+uint16_t    lut_end;     // the running procedure ends at this index, lut_length or before (CA stopped early)
+uint16_t    ca_pulse_samples; // samples of the CA pulse, after CA_BASELINE_SAMPLES
+
+// MEASURES VARIABLES
+uint16_t    measures_length; // samples (16 bit, see TIA_SampleEncode()) saved in data_long by the last procedure
+uint8_t     swv_mode;        // SWV_SEND_RAW, SWV_SEND_NET or SWV_SEND_ALL, set with the LUT
+uint16_t    swv_steps;       // staircase steps completed by the square wave voltammetry
+uint8_t     cv_cycles;       // cycles of the CV, the same LUT is applied cv_cycles times
+uint8_t     cv_cycle;        // cycle running, from 0
+uint8_t     cv_send_last_cycle;
+int32_t     *cv_accumulator; // sum of each sample of data_long over the cycles, data_long_size/2 entries
 
-uint8_t tia_calibration_values[(Number_calibration_points*4)+1];
+uint8_t tia_calibration_values[TIA_CAL_FRAME_SIZE];
 
 // DAC VARIABLES 
 uint8_t selected_voltage_source;
+uint8_t dac_resolution; // mV for each DAC level, cached from params.voltage_source
 
 // BT VARIABLES
 
@@ -173,10 +212,14 @@ volatile uint8_t data_buffer[DATA_MAX_READING_SIZE]; //static because it is used
 volatile uint8_t temp[DATA_MAX_READING_SIZE]; //static because it is used inside the ISR
 
 volatile uint8_t data_to_send[DATA_MAX_SENDING_SIZE];
-volatile uint8_t data_long[DATA_LONG_SIZE];
+volatile uint8_t *data_long;   // in the memory arena, after the LUT
+uint16_t data_long_size;       // bytes of data_long in the layout of the procedure
 
 
 uint8_t finished_procedure_flag; // DEBUG CHANGE -- remove later
+volatile uint8_t procedure_stopped; // the running procedure has been stopped by STOP_PROCEDURE
+volatile uint8_t procedure_ended; // set by the dac isr at the end of the procedure, the main loop sends the measures
+uint8_t procedure_type; // CHANGE_CV_PARAMETERS or CHANGE_CA_PARAMETERS, which LUT has been made
 
 
 #endif    
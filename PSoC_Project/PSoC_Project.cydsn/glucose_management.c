@@ -0,0 +1,380 @@
+/*******************************************************************************
+* File Name: glucose_management.c
+*
+* Description:
+*  Glucose estimation from the current measured during the chronoamperometry.
+*  Called by the main loop when the procedure is finished, before data_long
+*  is used to send the voltages. The sums of the Cottrell fit are updated by
+*  the adc isr at every sample of the pulse, the fit is solved by the main loop
+*********************************************************************************/
+
+#include "glucose_management.h"
+#include "journal_management.h"
+#include "TIA_calibrate.h"
+#include "string.h"
+
+volatile uint8_t glucose_request;
+volatile uint8_t glucose_send_trace;
+
+static glucose_fit_t glucose_fit;
+
+/***************************************
+* Forward function references
+***************************************/
+static int16_t glucose_apply_curve(int16_t current_nA);
+static void glucose_fit_solve(const glucose_sums_t *sums);
+static uint32_t glucose_fit_x(uint16_t k);
+static uint32_t glucose_isqrt(uint64_t value);
+static uint32_t glucose_isqrt32(uint32_t value);
+static void glucose_put32(uint8_t *destination, int32_t value);
+
+/******************************************************************************
+* Function Name: glucose_Estimate
+*******************************************************************************
+*
+* Summary:
+*  Average the samples of data_long in the window around the sampling time of
+*  the calibration curve, without the highest and the lowest sample (a spike
+*  or a lost sample does not move the result), then apply the curve.
+*  If the Cottrell fit has converged the current at the sampling time is
+*  taken from the fit, also when the measure has been stopped before it
+*
+* Parameters:
+*  int16 *current_nA: the averaged current is written here
+*
+* Global variables:
+*  params.glucose: calibration curve and sampling window
+*  data_long: samples of the last procedure (TIA_SampleEncode()), MSB first
+*  measures_length: samples in data_long
+*
+* Return:
+*  glucose in mg/dL saturated to the int16 range, JOURNAL_NO_GLUCOSE if the
+*  measure is shorter than the sampling time and the fit has not converged
+*
+*******************************************************************************/
+
+int16_t glucose_Estimate(int16_t *current_nA) {
+    uint16_t half = params.glucose.window_half;
+    int32_t sum = 0;
+    int32_t min = INT32_MAX, max = INT32_MIN;
+
+    if (glucose_fit.converged && params.glucose.sample_index > CA_BASELINE_SAMPLES) {
+        int64_t current = (int64_t)glucose_fit.b_q16 * glucose_fit_x(params.glucose.sample_index - CA_BASELINE_SAMPLES);
+        current = glucose_fit.a_q16 + (current >> 16);
+        current = (current + (1 << 15)) >> 16;
+        if (current > INT16_MAX) {
+            current = INT16_MAX;
+        }
+        else if (current < INT16_MIN) {
+            current = INT16_MIN;
+        }
+        *current_nA = current;
+        return glucose_apply_curve(*current_nA);
+    }
+
+    if (half > GLUCOSE_MAX_WINDOW) {
+        half = GLUCOSE_MAX_WINDOW;
+    }
+    uint16_t samples = measures_length;
+    if (params.glucose.sample_index >= samples) {
+        *current_nA = 0;
+        return JOURNAL_NO_GLUCOSE;
+    }
+    uint16_t first = params.glucose.sample_index > half ? params.glucose.sample_index - half : 0;
+    uint16_t last = params.glucose.sample_index + half;
+    if (last >= samples) {
+        last = samples - 1;
+    }
+
+    for (uint16_t i = first; i <= last; i++) {
+        int32_t sample = TIA_SampleDecode((data_long[2*i] << 8) | data_long[2*i+1]); // 1/8 nA
+        sum += sample;
+        if (sample < min) {
+            min = sample;
+        }
+        if (sample > max) {
+            max = sample;
+        }
+    }
+    uint16_t n = last - first + 1;
+    if (n > 2) {  // trimmed mean, the extremes are not used
+        sum -= min + max;
+        n -= 2;
+    }
+    *current_nA = TIA_CurrentToNanoAmps(sum / (int32_t)n);
+    return glucose_apply_curve(*current_nA);
+}
+
+/******************************************************************************
+* Function Name: glucose_apply_curve
+*******************************************************************************
+*
+* Summary:
+*  glucose = intercept + slope * current, saturated to the int16 range
+*
+*******************************************************************************/
+
+static int16_t glucose_apply_curve(int16_t current_nA) {
+    int64_t glucose = (int64_t)params.glucose.slope_q16 * current_nA + params.glucose.intercept_q16;
+    glucose = (glucose + (1 << (GLUCOSE_CURVE_SHIFT-1))) >> GLUCOSE_CURVE_SHIFT;  // rounded
+    if (glucose > INT16_MAX) {
+        glucose = INT16_MAX;
+    }
+    else if (glucose <= INT16_MIN) {
+        glucose = INT16_MIN + 1;  // INT16_MIN is JOURNAL_NO_GLUCOSE
+    }
+    return glucose;
+}
+
+/******************************************************************************
+* Function Name: glucose_SendResult
+*******************************************************************************
+*
+* Summary:
+*  Send the glucose to the GUI: G|glucose (mg/dL, 2)|current (nA, 2)|Z
+*
+*******************************************************************************/
+
+void glucose_SendResult(int16_t glucose, int16_t current_nA) {
+    uint8_t frame[GLUCOSE_FRAME_SIZE + 1];
+
+    frame[0] = GLUCOSE_DATA;
+    frame[1] = (uint16_t)glucose >> 8;
+    frame[2] = glucose & 0xFF;
+    frame[3] = (uint16_t)current_nA >> 8;
+    frame[4] = current_nA & 0xFF;
+    frame[5] = TAIL;
+    UART_BT_PutArray(frame, GLUCOSE_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: glucose_FitStart
+*******************************************************************************
+*
+* Summary:
+*  Clear the Cottrell fit, called when a procedure is started
+*
+*******************************************************************************/
+
+void glucose_FitStart(void) {
+    memset(&glucose_fit, 0, sizeof(glucose_fit_t));
+}
+
+/******************************************************************************
+* Function Name: glucose_FitAdd
+*******************************************************************************
+*
+* Summary:
+*  Add one sample of the CA to the sums of the least squares fit of
+*  i = a + b * x, with x = 1/sqrt(t) and t the time from the start of the
+*  pulse. Called by the adc isr: only integer sums, glucose_FitTask() solves
+*  the fit. Sample s is the answer to waveform_lut[s-1]
+*
+* Parameters:
+*  uint16_t sample: index of the sample in data_long
+*  int16 current_nA: the sample
+*
+*******************************************************************************/
+
+void glucose_FitAdd(uint16_t sample, int16_t current_nA) {
+    if (sample <= CA_BASELINE_SAMPLES + GLUCOSE_FIT_SKIP || sample > CA_BASELINE_SAMPLES + ca_pulse_samples) {
+        return;  // baseline or first samples of the pulse
+    }
+    int64_t x = glucose_fit_x(sample - CA_BASELINE_SAMPLES);
+
+    glucose_fit.sums.n++;
+    glucose_fit.sums.sx  += x;
+    glucose_fit.sums.sxx += x*x;
+    glucose_fit.sums.sy  += current_nA;
+    glucose_fit.sums.syy += (int32_t)current_nA*current_nA;
+    glucose_fit.sums.sxy += x*current_nA;
+    glucose_fit.pending = true;
+}
+
+/******************************************************************************
+* Function Name: glucose_FitTask
+*******************************************************************************
+*
+* Summary:
+*  Solve the fit with the sums of the samples added so far, called by the
+*  main loop while a CA runs (every ~100 ms, i.e. 10 samples) and once at the
+*  end. The sums are copied with the interrupts masked, the solve runs with
+*  the isrs enabled
+*
+* Return:
+*  true when the standard error of b is below GLUCOSE_FIT_TOLERANCE % of b
+*
+*******************************************************************************/
+
+uint8_t glucose_FitTask(void) {
+    glucose_sums_t sums;
+
+    uint8_t interrupt_state = CyEnterCriticalSection();
+    uint8_t pending = glucose_fit.pending;
+    sums = glucose_fit.sums;
+    glucose_fit.pending = false;
+    CyExitCriticalSection(interrupt_state);
+
+    if (pending) {
+        glucose_fit_solve(&sums);
+    }
+    return glucose_fit.converged;
+}
+
+/******************************************************************************
+* Function Name: glucose_SendFit
+*******************************************************************************
+*
+* Summary:
+*  Send the Cottrell fit of the last CA to the GUI:
+*  K|b (4)|a (4)|error of b (4)|samples (2)|converged (1)|Z, Q16.16 and big endian
+*
+*******************************************************************************/
+
+void glucose_SendFit(void) {
+    uint8_t frame[GLUCOSE_FIT_FRAME_SIZE + 1];
+
+    frame[0] = COTTRELL_DATA;
+    glucose_put32(&frame[1], glucose_fit.b_q16);
+    glucose_put32(&frame[5], glucose_fit.a_q16);
+    glucose_put32(&frame[9], glucose_fit.b_error_q16);
+    frame[13] = glucose_fit.n >> 8;
+    frame[14] = glucose_fit.n & 0xFF;
+    frame[15] = glucose_fit.converged;
+    frame[16] = TAIL;
+    UART_BT_PutArray(frame, GLUCOSE_FIT_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: glucose_fit_solve
+*******************************************************************************
+*
+* Summary:
+*  Solve the fit from the sums, in the main loop. The differences of the sums
+*  are exact in 64 bit, only the last divisions are done in double. The
+*  variance of b is s^2 / Sxx with s^2 the variance of the residuals:
+*  n*SSE = (n*Syy - Sy^2) - b*(n*Sxy - Sx*Sy)
+*
+*******************************************************************************/
+
+static void glucose_fit_solve(const glucose_sums_t *sums) {
+    int64_t n = sums->n;
+
+    glucose_fit.n = n;
+    if (n < 3) {
+        return;
+    }
+    int64_t d = n*sums->sxx - sums->sx*sums->sx;                    // Q32
+    int64_t numerator = n*sums->sxy - sums->sx*sums->sy;            // Q16
+    if (d <= 0) {
+        return;
+    }
+    double b = (double)numerator * 65536.0 / d;
+    double a = ((double)sums->sy - b*sums->sx/65536.0) / n;
+    double sse_n = (double)(n*sums->syy - sums->sy*sums->sy) - b*numerator/65536.0;
+    if (sse_n < 0) {
+        sse_n = 0;
+    }
+    double b_variance = sse_n * 4294967296.0 / ((n-2)*(double)d);
+
+    if (b > INT16_MAX || b < INT16_MIN || a > INT16_MAX || a < INT16_MIN) {
+        glucose_fit.converged = false;
+        return;
+    }
+    glucose_fit.b_q16 = b * 65536.0;
+    glucose_fit.a_q16 = a * 65536.0;
+    glucose_fit.b_error_q16 = b_variance < 65536.0 ? glucose_isqrt(b_variance * 4294967296.0) : INT32_MAX;
+    glucose_fit.converged = n >= GLUCOSE_FIT_MIN_SAMPLES && b != 0 &&
+        b_variance*10000 <= (double)GLUCOSE_FIT_TOLERANCE*GLUCOSE_FIT_TOLERANCE*b*b;
+}
+
+/******************************************************************************
+* Function Name: glucose_fit_x
+*******************************************************************************
+*
+* Summary:
+*  x = 1/sqrt(t) in Q16.16 for the k-th sample of the pulse, t = k*10 ms:
+*  10/sqrt(k) = 10*2^8 / sqrt(k*2^16). k*2^16 fits in 32 bit, the root is
+*  taken in 32 bit in the adc isr
+*
+*******************************************************************************/
+
+static uint32_t glucose_fit_x(uint16_t k) {
+    return (10UL << 24) / glucose_isqrt32((uint32_t)k << 16);
+}
+
+/******************************************************************************
+* Function Name: glucose_isqrt
+*******************************************************************************
+*
+* Summary:
+*  Integer square root, rounded down
+*
+*******************************************************************************/
+
+static uint32_t glucose_isqrt(uint64_t value) {
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/******************************************************************************
+* Function Name: glucose_isqrt32
+*******************************************************************************
+*
+* Summary:
+*  Integer square root of a 32 bit value, rounded down
+*
+*******************************************************************************/
+
+static uint32_t glucose_isqrt32(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/******************************************************************************
+* Function Name: glucose_put32
+*******************************************************************************
+*
+* Summary:
+*  Write a 32 bit value big endian
+*
+*******************************************************************************/
+
+static void glucose_put32(uint8_t *destination, int32_t value) {
+    destination[0] = (uint32_t)value >> 24;
+    destination[1] = (uint32_t)value >> 16;
+    destination[2] = (uint32_t)value >> 8;
+    destination[3] = value & 0xFF;
+}
+
+/* [] END OF FILE */
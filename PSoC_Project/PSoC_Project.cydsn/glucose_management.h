@@ -0,0 +1,78 @@
+/*******************************************************************************
+* File Name: glucose_management.h
+*
+* Description:
+*  Glucose concentration computed on the device from the chronoamperometry,
+*  with the calibration curve saved in the EEPROM parameters:
+*  glucose (mg/dL) = intercept + slope * current (nA)
+*  The current is a robust average of a window of samples around the
+*  sampling time, so a glucose measure can be sent with a few bytes.
+*  During the pulse the current is also fitted to the Cottrell equation
+*  i(t) = a + b / sqrt(t): the adc isr only adds each sample to integer sums,
+*  the main loop solves the fit. When the fit is good enough the current at
+*  the sampling time is taken from it and a glucose measure can stop early
+*********************************************************************************/
+
+#if !defined(GLUCOSE_MANAGEMENT_H)
+#define GLUCOSE_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+#include "params_management.h"
+    
+/**************************************
+*        Constants
+**************************************/
+
+#define GLUCOSE_CURVE_SHIFT     16  // slope and intercept of the curve are kept in Q16.16
+#define GLUCOSE_MAX_WINDOW      16  // max samples on each side of the sampling time
+#define GLUCOSE_FRAME_SIZE      5   // header + glucose (2) + current (2)
+#define GLUCOSE_SEND_TRACE      1   // G|1|Z sends also the whole measure
+
+#define GLUCOSE_FIT_SKIP        2   // first samples of the pulse not fitted (charging of the double layer)
+#define GLUCOSE_FIT_MIN_SAMPLES 20  // samples fitted before the convergence is checked (200 ms)
+#define GLUCOSE_FIT_TOLERANCE   2   // % standard error of b at which the fit has converged
+#define GLUCOSE_FIT_FRAME_SIZE  16  // header + b (4) + a (4) + error of b (4) + samples (2) + converged (1)
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef struct {
+    uint16_t n;             // samples fitted
+    int64_t sx, sxx;        // x = 1/sqrt(t) in Q16, t in s
+    int64_t sy, syy, sxy;   // y = current in nA
+} glucose_sums_t;
+
+typedef struct {
+    glucose_sums_t sums;    // written by the adc isr
+    uint8_t pending;        // samples added since the last solve
+    uint16_t n;             // samples of the last solve
+    int32_t b_q16;          // nA*s^1/2, proportional to the concentration
+    int32_t a_q16;          // nA, current at infinite time
+    int32_t b_error_q16;    // standard error of b
+    uint8_t converged;
+} glucose_fit_t;
+
+/***************************************
+* Global variables external identifier
+***************************************/
+
+extern volatile uint8_t glucose_request;    // the running CA has been started by MEASURE_GLUCOSE
+extern volatile uint8_t glucose_send_trace; // send also the whole measure after the glucose
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+int16_t glucose_Estimate(int16_t *current_nA);
+void glucose_SendResult(int16_t glucose, int16_t current_nA);
+void glucose_FitStart(void);
+void glucose_FitAdd(uint16_t sample, int16_t current_nA);
+uint8_t glucose_FitTask(void);
+void glucose_SendFit(void);
+
+#endif
+
+/* [] END OF FILE */
@@ -8,12 +8,17 @@
 
 #include "hardware_management.h"
 
+static volatile uint32_t ms_ticks; // incremented by the SysTick every 1 ms
+
+static void helper_SysTickCallback(void);
+static void helper_params_changed(void);
+
 /******************************************************************************
 * Function Name: helper_check_voltage_source
 *******************************************************************************
 *
 * Summary:
-*  Look in the EEPROM to for what Voltage source is selected
+*  Look in the RAM copy of the EEPROM for what Voltage source is selected
 *
 * Parameters:
 *
@@ -25,13 +30,12 @@
 *                      so the dithering VDAC (DVDAC) should be set
 *
 * Global variables:
-*  OUT_ENDPOINT:  number that is the endpoint coming out of the computer
+*  params: RAM shadow of the EEPROM, loaded at power on
 *
 *******************************************************************************/
 
 uint8_t helper_check_voltage_source(void) {
-    // start eeprom and read the value at voltage source address
-    return helper_Readbyte_EEPROM(VDAC_ADDRESS);
+    return params.voltage_source;
 }
 
 /******************************************************************************
@@ -47,12 +51,17 @@ uint8_t helper_check_voltage_source(void) {
 *
 * Global variables:
 *  selected_voltage_source:  which DAC is to be used
+*  params: the selection is saved in the EEPROM shadow and committed
 *
 *******************************************************************************/
 
 void helper_set_voltage_source(uint8_t voltage_source) {
     selected_voltage_source = voltage_source;
-    helper_Writebyte_EEPROM(voltage_source, VDAC_ADDRESS);
+    if (params.voltage_source != voltage_source) {
+        params.voltage_source = voltage_source;
+        params_MarkDirty();
+        params_Commit();
+    }
     
     if (selected_voltage_source == VDAC_IS_DVDAC) {
         VDAC_source_Stop();  // in case the other DAC is on, turn it off
@@ -68,52 +77,25 @@ void helper_set_voltage_source(uint8_t voltage_source) {
 
 
 /******************************************************************************
-* Function Name: helper_Writebyte_EEPROM
-*******************************************************************************
-*
-* Summary:
-*    Start the eepromm, update the temperature and write a byte to it
-*
-* Parameters:
-*     data: the byte to write in
-*     address: the address to write the data at
-*
-* Return:
-*
-*******************************************************************************/
-
-uint8_t helper_Writebyte_EEPROM(uint8_t data, uint16_t address) {
-    EEPROM_Start();
-    CyDelayUs(10);
-    EEPROM_UpdateTemperature();
-    uint8_t write_results = EEPROM_WriteByte(data, address);
-    EEPROM_Stop();
-    return write_results;
-}
-
-/******************************************************************************
-* Function Name: helper_Readbyte_EEPROM
+* Function Name: helper_params_changed
 *******************************************************************************
 *
 * Summary:
-*    Start the eepromm, update the temperature and read a byte to it
-*
-* Parameters:
-*     address: the address to read the data from
+*    Listener of the parameters: update the values derived from params that
+*    are used while setting up a measurement
 *
-* Return:
-*     data that was read
+* Global variables:
+*  dac_resolution: mV for each level of the selected DAC
 *
 *******************************************************************************/
 
-uint8_t helper_Readbyte_EEPROM(uint16_t address) {
-    EEPROM_Start();
-    CyDelayUs(10);
-    EEPROM_UpdateTemperature();
-    CyDelayUs(10);
-    uint8_t data = EEPROM_ReadByte(address);
-    EEPROM_Stop();
-    return data;
+static void helper_params_changed(void) {
+    if (params.voltage_source == VDAC_IS_DVDAC) {
+        dac_resolution = 1;
+    }
+    else {
+        dac_resolution = 16;
+    }
 }
 
 /******************************************************************************
@@ -130,6 +112,9 @@ uint8_t helper_Readbyte_EEPROM(uint16_t address) {
 
 void helper_HardwareSetup(void) {
     
+    params_AddListener(helper_params_changed);
+    helper_params_changed();
+    
     helper_HardwareStart();
     helper_HardwareSleep();
 
@@ -207,6 +192,39 @@ void helper_HardwareSleep(void){  // put to sleep all the components that have t
 }
 
 
+/******************************************************************************
+* Function Name: helper_TimebaseStart
+*******************************************************************************
+*
+* Summary:
+*    Start the SysTick with its default 1 ms period and count the milliseconds
+*    from power on. Used to schedule the tasks done while the device is idle
+*
+*******************************************************************************/
+
+void helper_TimebaseStart(void) {
+    CySysTickStart();
+    CySysTickSetCallback(0, helper_SysTickCallback);
+}
+
+static void helper_SysTickCallback(void) {
+    ms_ticks++;
+}
+
+/******************************************************************************
+* Function Name: helper_Millis
+*******************************************************************************
+*
+* Summary:
+*    Milliseconds since helper_TimebaseStart(), wraps after ~49 days
+*
+*******************************************************************************/
+
+uint32_t helper_Millis(void) {
+    return ms_ticks;
+}
+
+
 /* ** NOT USED ***
 void make_run_params(const uint8_t data_buffer[], const uint8_t use_swv,
                      struct RunParams *run_params) {
@@ -236,58 +254,5 @@ uint16_t helper_Convert2Dec(const uint8_t array[], const uint8_t len){
     return num;
 }
 
-void initialize_default_values(void){
-    EEPROM_Start();
-    return_value = EEPROM_WriteByte(M_DEFAULT,M_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(Q_DEFAULT,Q_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(V_DEFAULT,V_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(T_DEFAULT,T_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(SCAN_RATE_DEFAULT,SCAN_RATE_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }   
-    return_value = EEPROM_WriteByte(START_DEFAULT,START_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(END_DEFAULT,END_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        } 
-    return_value = EEPROM_WriteByte(INCREMENT_DEFAULT,INCREMENT_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        } 
-    return_value = EEPROM_WriteByte(STEP_DEFAULT,STEP_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-    return_value = EEPROM_WriteByte(CA_PERIOD_DEFAULT,CA_PERIOD_DEFAULT_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        } 
-    return_value = EEPROM_WriteByte(EEPROM_FLAG_DONE,EEPROM_FLAG_ADD);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-        
-    return_value = EEPROM_WriteByte(VDAC_IS_VDAC,VDAC_ADDRESS);
-        if(return_value != CYRET_SUCCESS){
-            errorBT();
-        }
-}
-
 /* [] END OF FILE */
 
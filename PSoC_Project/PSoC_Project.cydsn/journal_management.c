@@ -0,0 +1,416 @@
+/*******************************************************************************
+* File Name: journal_management.c
+*
+* Description:
+*  Append only journal of the measurements in flash. The entry is prepared in
+*  RAM by journal_Capture() when the procedure ends (before the measures are
+*  sent and data_long is reused) and written by journal_Task() from the main
+*  loop, the flash write blocks the CPU so it is never done in the ISRs
+*********************************************************************************/
+
+#include "journal_management.h"
+#include "hardware_management.h"
+#include "TIA_calibrate.h"
+#include "string.h"
+#include "stddef.h"
+#include "stdlib.h"
+
+// the entry must fill exactly one row of the emulated EEPROM
+typedef char journal_entry_size_check[(sizeof(journal_entry_t) == JOURNAL_ENTRY_SIZE) ? 1 : -1];
+
+/* Flash used by the emulated EEPROM, aligned to the flash rows */
+CY_ALIGN(CY_EM_EEPROM_FLASH_SIZEOF_ROW)
+static const uint8 journal_storage[CY_EM_EEPROM_GET_PHYSICAL_SIZE(JOURNAL_SIZE, JOURNAL_WEAR_LEVELING, 0u)] = {0u};
+
+static cy_stc_eeprom_context_t journal_context;
+static journal_index_t journal_index[JOURNAL_SLOTS]; // RAM copy of the headers, same order as the slots
+static uint8_t journal_newest;       // slot of the last entry written
+static uint8_t journal_count;
+static uint16_t journal_next_id;
+
+static journal_entry_t journal_pending;      // entry waiting to be written by journal_Task()
+static volatile uint8_t journal_pending_flag;
+static uint8_t journal_parameters[JOURNAL_PARAMS_SIZE];
+static uint32_t journal_time_offset;  // epoch of the GUI at power on, seconds
+static uint8_t journal_time_synced;
+
+/***************************************
+* Forward function references
+***************************************/
+static void journal_index_update(uint8_t slot, const journal_entry_t *entry);
+static void journal_compress_trace(journal_entry_t *entry);
+static int16_t journal_sample(uint16_t index);
+static uint8_t journal_put_header(const journal_index_t *entry, volatile uint8_t frame[]);
+
+/******************************************************************************
+* Function Name: journal_Start
+*******************************************************************************
+*
+* Summary:
+*  Start the emulated EEPROM and build the RAM index reading the header of all
+*  the slots. The newest entry is the one with the highest run id
+*
+* Return:
+*  CYRET_SUCCESS or CYRET_BAD_DATA if the emulated EEPROM can not be started
+*
+*******************************************************************************/
+
+cystatus journal_Start(void) {
+    cy_stc_eeprom_config_t config;
+    journal_entry_t header;
+
+    config.eepromSize = JOURNAL_SIZE;
+    config.wearLevelingFactor = JOURNAL_WEAR_LEVELING;
+    config.redundantCopy = 0u;
+    config.blockingWrite = 1u;
+    config.userFlashStartAddr = (uint32)journal_storage;
+
+    journal_count = 0;
+    journal_newest = JOURNAL_SLOTS - 1;
+    journal_next_id = 1;
+    if (Cy_Em_EEPROM_Init(&config, &journal_context) != CY_EM_EEPROM_SUCCESS) {
+        memset(journal_index, 0, sizeof(journal_index));
+        return CYRET_BAD_DATA;
+    }
+
+    for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++) {
+        Cy_Em_EEPROM_Read(slot*JOURNAL_ENTRY_SIZE, &header, offsetof(journal_entry_t, trace_first), &journal_context);
+        journal_index_update(slot, &header);
+        if (header.run_id != 0) {
+            journal_count++;
+            if (header.run_id >= journal_next_id) { // run ids only grow, the highest is the newest
+                journal_next_id = header.run_id + 1;
+                journal_newest = slot;
+            }
+        }
+    }
+    if (journal_next_id == 0) {
+        journal_next_id = 1;
+    }
+    return CYRET_SUCCESS;
+}
+
+/******************************************************************************
+* Function Name: journal_SetTime
+*******************************************************************************
+*
+* Summary:
+*  Sync the clock of the journal with the time sent by the GUI. The entries
+*  written before the sync keep the time from power on and the
+*  JOURNAL_FLAG_UPTIME flag, so the GUI can still place them
+*
+* Parameters:
+*  uint32 epoch: seconds from 1/1/1970
+*
+*******************************************************************************/
+
+void journal_SetTime(uint32_t epoch) {
+    journal_time_offset = epoch - helper_Millis()/1000;
+    journal_time_synced = true;
+}
+
+/******************************************************************************
+* Function Name: journal_SetParameters
+*******************************************************************************
+*
+* Summary:
+*  Keep the command that set the procedure (CHANGE_CV_PARAMETERS or
+*  CHANGE_CA_PARAMETERS), it is saved with the next entries
+*
+*******************************************************************************/
+
+void journal_SetParameters(volatile uint8_t data_buffer[]) {
+    for (uint8_t i = 0; i < JOURNAL_PARAMS_SIZE; i++) {
+        journal_parameters[i] = data_buffer[i];
+    }
+}
+
+/******************************************************************************
+* Function Name: journal_Capture
+*******************************************************************************
+*
+* Summary:
+*  Prepare the entry of the procedure just finished, called by the main loop
+*  before data_long is used to send the voltages. Only RAM is used here, the
+*  entry is written by journal_Task()
+*
+* Parameters:
+*  int16 glucose: glucose of the run in mg/dL, JOURNAL_NO_GLUCOSE if not computed
+*
+*******************************************************************************/
+
+void journal_Capture(int16_t glucose) {
+    if (journal_pending_flag) {  // previous entry not written yet, keep it
+        return;
+    }
+    memset(&journal_pending, 0, sizeof(journal_entry_t));
+    journal_pending.glucose = glucose;
+    journal_pending.samples = measures_length;
+    if (procedure_stopped) {
+        journal_pending.flags |= JOURNAL_FLAG_STOPPED;
+    }
+    memcpy(journal_pending.parameters, journal_parameters, JOURNAL_PARAMS_SIZE);
+
+    uint32_t seconds = helper_Millis()/1000;
+    if (journal_time_synced) {
+        journal_pending.timestamp = journal_time_offset + seconds;
+    }
+    else {
+        journal_pending.timestamp = seconds;
+        journal_pending.flags |= JOURNAL_FLAG_UPTIME;
+    }
+    journal_compress_trace(&journal_pending);
+    journal_pending_flag = true;
+}
+
+/******************************************************************************
+* Function Name: journal_Task
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop, write the captured entry in the slot after the
+*  newest one. Nothing is done while a procedure is running
+*
+*******************************************************************************/
+
+void journal_Task(void) {
+    if (!journal_pending_flag || isr_dac_GetState()) {
+        return;
+    }
+    uint8_t slot = (journal_newest + 1) % JOURNAL_SLOTS;
+
+    journal_pending.run_id = journal_next_id;
+    if (Cy_Em_EEPROM_Write(slot*JOURNAL_ENTRY_SIZE, &journal_pending, sizeof(journal_entry_t),
+                           &journal_context) == CY_EM_EEPROM_SUCCESS) {
+        if (journal_index[slot].run_id == 0) {
+            journal_count++;
+        }
+        journal_index_update(slot, &journal_pending);
+        journal_newest = slot;
+        journal_next_id++;
+        if (journal_next_id == 0) {
+            journal_next_id = 1;
+        }
+    }
+    journal_pending_flag = false;
+}
+
+/******************************************************************************
+* Function Name: journal_Count
+*******************************************************************************
+*
+* Return:
+*  number of entries saved
+*
+*******************************************************************************/
+
+uint8_t journal_Count(void) {
+    return journal_count;
+}
+
+/******************************************************************************
+* Function Name: journal_List
+*******************************************************************************
+*
+* Summary:
+*  Fill a frame with up to JOURNAL_LIST_PAGE entries of the RAM index, from the
+*  newest to the oldest. Each entry is run id (2) | timestamp (4) | glucose (2)
+*  | procedure (1) | flags (1), big endian
+*
+* Parameters:
+*  uint8 first: entries to skip, 0 starts from the newest
+*  uint8 frame[]: where to write the entries
+*
+* Return:
+*  number of entries written in frame
+*
+*******************************************************************************/
+
+uint8_t journal_List(uint8_t first, volatile uint8_t frame[]) {
+    uint8_t n = 0;
+    uint16_t i = 0;
+
+    for (uint8_t k = first; k < journal_count && n < JOURNAL_LIST_PAGE; k++, n++) {
+        i += journal_put_header(&journal_index[(journal_newest + JOURNAL_SLOTS - k) % JOURNAL_SLOTS], &frame[i]);
+    }
+    return n;
+}
+
+/******************************************************************************
+* Function Name: journal_Fetch
+*******************************************************************************
+*
+* Summary:
+*  Look for the run id in the RAM index, read the whole entry from flash and
+*  write it in frame, big endian: the same 10 bytes of journal_List() |
+*  samples (2) | parameters (JOURNAL_PARAMS_SIZE) | trace points (1) |
+*  first point (2) | step (2) | trace points - 1 differences (1 each)
+*
+* Return:
+*  number of bytes written in frame, 0 if the entry has not been found
+*
+*******************************************************************************/
+
+uint8_t journal_Fetch(uint16_t run_id, volatile uint8_t frame[]) {
+    journal_entry_t entry;
+    uint8_t i;
+
+    if (run_id == 0) {
+        return 0;
+    }
+    for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++) {
+        if (journal_index[slot].run_id != run_id) {
+            continue;
+        }
+        if (Cy_Em_EEPROM_Read(slot*JOURNAL_ENTRY_SIZE, &entry, sizeof(journal_entry_t),
+                              &journal_context) != CY_EM_EEPROM_SUCCESS) {
+            return 0;
+        }
+        i = journal_put_header(&journal_index[slot], frame);
+        frame[i++] = entry.samples >> 8;
+        frame[i++] = entry.samples & 0xFF;
+        for (uint8_t k = 0; k < JOURNAL_PARAMS_SIZE; k++) {
+            frame[i++] = entry.parameters[k];
+        }
+        frame[i++] = entry.trace_points;
+        frame[i++] = (uint16_t)entry.trace_first >> 8;
+        frame[i++] = entry.trace_first & 0xFF;
+        frame[i++] = entry.trace_step >> 8;
+        frame[i++] = entry.trace_step & 0xFF;
+        for (uint8_t k = 0; k + 1 < entry.trace_points; k++) {
+            frame[i++] = entry.trace[k];
+        }
+        return i;
+    }
+    return 0;
+}
+
+/******************************************************************************
+* Function Name: journal_Clear
+*******************************************************************************
+*
+* Summary:
+*  Erase all the entries, the run ids start again from 1
+*
+*******************************************************************************/
+
+cystatus journal_Clear(void) {
+    if (Cy_Em_EEPROM_Erase(&journal_context) != CY_EM_EEPROM_SUCCESS) {
+        return CYRET_BAD_DATA;
+    }
+    memset(journal_index, 0, sizeof(journal_index));
+    journal_count = 0;
+    journal_newest = JOURNAL_SLOTS - 1;
+    journal_next_id = 1;
+    return CYRET_SUCCESS;
+}
+
+/******************************************************************************
+* Function Name: journal_index_update
+*******************************************************************************
+*
+* Summary:
+*  Copy the fields needed for the list from an entry to the RAM index
+*
+*******************************************************************************/
+
+static void journal_index_update(uint8_t slot, const journal_entry_t *entry) {
+    journal_index[slot].run_id = entry->run_id;
+    journal_index[slot].flags = entry->flags;
+    journal_index[slot].procedure = entry->parameters[0];
+    journal_index[slot].timestamp = entry->timestamp;
+    journal_index[slot].glucose = entry->glucose;
+}
+
+/******************************************************************************
+* Function Name: journal_compress_trace
+*******************************************************************************
+*
+* Summary:
+*  Save the measured current decimated to JOURNAL_TRACE_POINTS points: the
+*  first point in nA and the others as 8 bit differences in units of
+*  trace_step nA. The step is chosen from the biggest difference, the
+*  differences are computed from the rebuilt curve so the error does not add up
+*
+*******************************************************************************/
+
+static void journal_compress_trace(journal_entry_t *entry) {
+    if (measures_length == 0) {
+        return;
+    }
+    uint16_t samples = measures_length;
+    uint16_t stride = (samples + JOURNAL_TRACE_POINTS - 1) / JOURNAL_TRACE_POINTS;
+    uint8_t points = (samples + stride - 1) / stride;
+    uint16_t max_difference = 0;
+
+    for (uint8_t i = 1; i < points; i++) {
+        int32_t difference = (int32_t)journal_sample(i*stride) - journal_sample((i-1)*stride);
+        if ((uint16_t)abs(difference) > max_difference) {
+            max_difference = abs(difference);
+        }
+    }
+    entry->trace_step = (max_difference + 126) / 127;
+    if (entry->trace_step == 0) {
+        entry->trace_step = 1;
+    }
+
+    int32_t rebuilt = journal_sample(0);
+    entry->trace_first = rebuilt;
+    for (uint8_t i = 1; i < points; i++) {
+        int32_t delta = ((int32_t)journal_sample(i*stride) - rebuilt) / entry->trace_step;
+        if (delta > 127) {
+            delta = 127;
+        }
+        else if (delta < -127) {
+            delta = -127;
+        }
+        entry->trace[i-1] = delta;
+        rebuilt += delta*entry->trace_step;
+    }
+    entry->trace_points = points;
+    entry->flags |= JOURNAL_FLAG_TRACE;
+}
+
+/******************************************************************************
+* Function Name: journal_sample
+*******************************************************************************
+*
+* Return:
+*  sample of data_long in nA
+*
+*******************************************************************************/
+
+static int16_t journal_sample(uint16_t index) {
+    return TIA_CurrentToNanoAmps(TIA_SampleDecode((data_long[2*index] << 8) | data_long[2*index+1]));
+}
+
+/******************************************************************************
+* Function Name: journal_put_header
+*******************************************************************************
+*
+* Summary:
+*  Write an entry of the index: run id (2) | timestamp (4) | glucose (2) |
+*  procedure (1) | flags (1), big endian
+*
+* Return:
+*  number of bytes written
+*
+*******************************************************************************/
+
+static uint8_t journal_put_header(const journal_index_t *entry, volatile uint8_t frame[]) {
+    uint8_t i = 0;
+
+    frame[i++] = entry->run_id >> 8;
+    frame[i++] = entry->run_id & 0xFF;
+    frame[i++] = entry->timestamp >> 24;
+    frame[i++] = (entry->timestamp >> 16) & 0xFF;
+    frame[i++] = (entry->timestamp >> 8) & 0xFF;
+    frame[i++] = entry->timestamp & 0xFF;
+    frame[i++] = (uint16_t)entry->glucose >> 8;
+    frame[i++] = entry->glucose & 0xFF;
+    frame[i++] = entry->procedure;
+    frame[i++] = entry->flags;
+    return i;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,88 @@
+/*******************************************************************************
+* File Name: journal_management.h
+*
+* Description:
+*  Journal of the measurements saved in flash with the emulated EEPROM
+*  (cy_em_eeprom). Every measurement is appended as one entry of a ring of
+*  JOURNAL_SLOTS entries, the oldest entry is overwritten when the ring is full.
+*  An index of the entries is kept in RAM, so that the list can be sent without
+*  reading the flash. Measurements done without the GUI can be synced later
+*********************************************************************************/
+
+#if !defined(JOURNAL_MANAGEMENT_H)
+#define JOURNAL_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define JOURNAL_SLOTS           32  // entries kept in flash
+#define JOURNAL_WEAR_LEVELING   4   // every logical row is spread over 4 flash rows
+#define JOURNAL_ENTRY_SIZE      CY_EM_EEPROM_EEPROM_DATA_LEN // one entry for each emulated EEPROM row (128 bytes)
+#define JOURNAL_SIZE            (JOURNAL_SLOTS*JOURNAL_ENTRY_SIZE)
+#define JOURNAL_PARAMS_SIZE     8   // bytes of the command that set the procedure, header included
+#define JOURNAL_TRACE_DELTAS    104 // differences saved after the first point of the trace
+#define JOURNAL_TRACE_POINTS    (JOURNAL_TRACE_DELTAS + 1)
+#define JOURNAL_LIST_PAGE       11  // entries sent in one list frame
+#define JOURNAL_HEADER_SIZE     10  // bytes of each entry in the list frame
+#define JOURNAL_FRAME_SIZE      (JOURNAL_HEADER_SIZE + 2 + JOURNAL_PARAMS_SIZE + 5 + JOURNAL_TRACE_DELTAS) // whole entry
+
+#define JOURNAL_NO_GLUCOSE      ((int16_t)0x8000) // glucose not computed for this run
+
+// flags of the entry
+#define JOURNAL_FLAG_TRACE      0x01 // the compressed trace is present
+#define JOURNAL_FLAG_UPTIME     0x02 // the clock was not synced, timestamp is seconds from power on
+#define JOURNAL_FLAG_STOPPED    0x04 // the run has been stopped by the user, the trace is truncated
+
+// sub commands of JOURNAL_MANAGEMENT: L|command|data|Z
+#define JOURNAL_SYNC            0   // L|0|epoch (4 bytes, big endian, escaped)|Z
+#define JOURNAL_LIST            1   // L|1|first entry, 0 is the newest, escaped|Z
+#define JOURNAL_FETCH           2   // L|2|run id (2 bytes, escaped)|Z
+#define JOURNAL_CLEAR           3   // L|3|Z
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef CY_PACKED struct {
+    uint16_t run_id;                        // 0 if the slot is empty
+    uint8_t flags;
+    uint8_t trace_points;
+    uint32_t timestamp;                     // seconds, epoch of the GUI if synced
+    int16_t glucose;                        // mg/dL
+    uint16_t samples;                       // samples of the whole measurement
+    uint8_t parameters[JOURNAL_PARAMS_SIZE];
+    int16_t trace_first;                    // nA
+    uint16_t trace_step;                    // nA for each unit of the differences
+    int8_t trace[JOURNAL_TRACE_DELTAS];
+} CY_PACKED_ATTR journal_entry_t;
+
+typedef struct {
+    uint16_t run_id;
+    uint8_t flags;
+    uint8_t procedure;
+    uint32_t timestamp;
+    int16_t glucose;
+} journal_index_t;
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+cystatus journal_Start(void);
+void journal_SetTime(uint32_t epoch);
+void journal_SetParameters(volatile uint8_t data_buffer[]);
+void journal_Capture(int16_t glucose);
+void journal_Task(void);
+uint8_t journal_Count(void);
+uint8_t journal_List(uint8_t first, volatile uint8_t frame[]);
+uint8_t journal_Fetch(uint16_t run_id, volatile uint8_t frame[]);
+cystatus journal_Clear(void);
+
+#endif
+
+/* [] END OF FILE */
@@ -30,6 +30,28 @@
 #include "parametric_lut.h"
 #include "BT_protocols.h"
 #include "Interrupt_Routines.h"
+#include "params_management.h"
+#include "journal_management.h"
+#include "glucose_management.h"
+#include "strip_management.h"
+#include "timing_management.h"
+#include "eis_management.h"
+#include "memory_management.h"
+#include "waveform_management.h"
+#include "upload_management.h"
+#include "button_management.h"
+#include "watchdog_management.h"
+
+static void swv_add_sample(int32_t measure);
+static void measure_save(uint16_t sample, int32_t value);
+static void cv_average_cycles(void);
+static void procedure_end(void);
+static void rx_next_frame(void);
+
+// frames completed by the RX isr, handled one at a time by the main loop in data_buffer
+static volatile uint8_t rx_frames[RX_FRAMES][DATA_MAX_READING_SIZE];
+static volatile uint8_t rx_head;    // next frame written by the isr
+static volatile uint8_t rx_tail;    // next frame handled by the main
 
 
 /************************************
@@ -38,42 +60,235 @@
 
 CY_ISR(dacInterrupt) // enabled by function that start CV and CA procedures 
 {
+    watchdog_CheckIn(WATCHDOG_TICK); // the tick is alive, also between two slow steps
+    if (!timing_Step()) { // fixed tick, the phase accumulator tells when the next step is due
+        return;
+    }
+    DAC_PROFILE_BEGIN();
     Opamp_Aux_Start();  
     DAC_SetValue(lut_value);
     LED_DAC_Write(1); 
     LED_ADC_Write(0);
 
     lut_index++;
+    DAC_PROFILE_END(dac_profile); // cycles of a normal step, the end of the procedure is not counted
     
-    if (lut_index >= lut_length) { // all the data points have been given and sent 
+    if (lut_index >= lut_end && cv_cycle+1 < cv_cycles && lut_end == lut_length && !procedure_stopped) { // multi-cycle CV: apply the same LUT again, a cut cycle ends the run
+        cv_cycle++;
+        lut_index = 0;
+    } else if (lut_index >= lut_end) { // all the data points have been given: the main loop sends them
         isr_adc_Disable();
         isr_dac_Disable();
-        finished_procedure_flag=1;
-        
-        UART_BT_PutChar(CV_DATA);
-        // we are sending first one Byte with the header, and after that the array with all the data
-        // otherwise we would have to shift everything to the right
-        
-        sendMeasures();
-        helper_HardwareSleep();
+        watchdog_RunEnded();
         lut_index = 0; 
+        procedure_ended = true;
     }
-    lut_value = waveform_lut[lut_index];
+    lut_value = LUT_Value(lut_index);
 }
 
 CY_ISR(adcInterrupt){ // enabled by function that starts CV and CA procedures 
+    if (!timing_LastTick()) { // one sample for each step, at the end of it
+        return;
+    }
+    DAC_PROFILE_BEGIN();
     LED_DAC_Write(0); 
     LED_ADC_Write(1);
     
     //ADC_SigDel_Start();
     //ADC_SigDel_StartConvert();
     
-    int16 measure = ADC_SigDel_GetResult16(); 
+    int16 counts = ADC_SigDel_GetResult16();
+    int32_t measure = TIA_CountsToCurrent(counts); // sample already calibrated, in 1/8 nA
+    
+    if (swv_mode == SWV_SEND_RAW) {
+        measure_save(lut_index, measure);
+    } else {
+        swv_add_sample(measure);
+    }
+    
+    if (procedure_type == CHANGE_CA_PARAMETERS) {
+        glucose_FitAdd(lut_index, TIA_CurrentToNanoAmps(measure)); // only the sums, the main loop solves the fit
+    }
+#if (TIA_AUTORANGE)
+    if (TIA_RangeCheck(counts, lut_index) == TIA_RANGE_SATURATED) {
+        lut_end = lut_index + 1; // clipping also with the lowest resistor, the rest of the measure is useless
+    }
+#endif
+    DAC_PROFILE_END(adc_profile);
+}
+
+/******************************************************************************
+* Function Name: measure_save
+*******************************************************************************
+*
+* Summary:
+*  Save one sample in data_long (TIA_SampleEncode(), MSB first). During a
+*  multi-cycle CV the sample is also added to its accumulator, data_long keeps
+*  the last cycle
+*
+* Parameters:
+*  uint16_t sample: index of the sample in data_long
+*  int32_t value: current in 1/8 nA
+*
+*******************************************************************************/
+
+static void measure_save(uint16_t sample, int32_t value) {
+    if (2*sample+1 >= data_long_size) { // no more room, the last samples are not sent
+        return;
+    }
+    uint16_t code = TIA_SampleEncode(value);
+    data_long[2*sample] = code >> 8;
+    data_long[2*sample+1] = code & 0xFF;
+    if (cv_cycles > 1) {
+        cv_accumulator[sample] += value;
+    }
+}
+
+/******************************************************************************
+* Function Name: cv_average_cycles
+*******************************************************************************
+*
+* Summary:
+*  Replace the samples of data_long with the average of the cycles, rounded
+*  to the nearest 1/8 nA. cv_cycle cycles have been completed over the whole
+*  LUT and the last one has reached lut_end, which is lut_length unless the
+*  run has been stopped (or cut by the auto-range): each sample is divided
+*  by the cycles actually summed at its index
+*
+*******************************************************************************/
+
+static void cv_average_cycles(void) {
+    for (uint16_t i = 0; i < measures_length && 2*i+1 < data_long_size; i++) {
+        int32_t cycles = cv_cycle + (i < lut_end); // at least 1, past lut_end only after a complete cycle
+        int32_t half = cycles / 2;
+        int32_t sum = cv_accumulator[i];
+        uint16_t average = TIA_SampleEncode((sum >= 0 ? sum + half : sum - half) / cycles);
+        data_long[2*i] = average >> 8;
+        data_long[2*i+1] = average & 0xFF;
+    }
+}
+
+/******************************************************************************
+* Function Name: procedure_end
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop when the dac isr has ended the procedure: computes
+*  the glucose, saves the journal entry and sends the measures, then puts the
+*  hardware to sleep. The isrs are already disabled, so the streaming does
+*  not delay any step. Between the frames of the voltages the next job of a
+*  running queue is made, it starts as soon as the sending ends
+*
+*******************************************************************************/
+
+static void procedure_end(void) {
+    finished_procedure_flag=1;
+    measures_length = lut_end;
+    if (cv_cycles > 1 && cv_cycle > 0) { // stopped after complete cycles: the average covers the whole LUT
+        measures_length = lut_length;
+    }
+    if (swv_mode == SWV_SEND_NET) {
+        measures_length = swv_steps;
+    } else if (swv_mode == SWV_SEND_ALL) {
+        measures_length = 3*swv_steps;
+    }
+    if (measures_length > data_long_size/2) {
+        measures_length = data_long_size/2;
+    }
+    if (procedure_stopped) {
+        sendStopped(measures_length);
+    }
+    if (cv_cycles > 1) {
+        if (cv_send_last_cycle) { // the last cycle as measured, before it is replaced by the average
+            UART_BT_PutChar(CV_CYCLE_DATA);
+            BT_sending_manager(data_long, measures_length*2);
+        }
+        cv_average_cycles();
+    }
+    
+    int16_t current_nA = 0;
+    int16_t glucose = JOURNAL_NO_GLUCOSE;
+    if (procedure_type == CHANGE_CA_PARAMETERS) {
+        glucose_FitTask(); // the samples added after the last solve
+    }
+    if (procedure_type == CHANGE_CA_PARAMETERS && TIA_RangeStatus() != TIA_RANGE_SATURATED) {
+        glucose = glucose_Estimate(&current_nA);
+    }
+    journal_Capture(glucose); // before data_long is used to send the voltages
+    if (procedure_type == CHANGE_CA_PARAMETERS) {
+        glucose_SendFit();
+    }
+#if (TIA_AUTORANGE)
+    TIA_RangeStop();
+    TIA_RangeSendStatus();
+#endif
+    if (glucose_request) {
+        button_SaveResult(glucose, current_nA); // kept and blinked if started by the button
+        glucose_SendResult(glucose, current_nA);
+    }
+    
+    if (!glucose_request || glucose_send_trace) {
+        UART_BT_PutChar(CV_DATA);
+        // we are sending first one Byte with the header, and after that the array with all the data
+        // otherwise we would have to shift everything to the right
+        
+        uint8_t outer_block = watchdog_BlockBegin(WATCHDOG_SEND); // the main is blocked until the end
+        sendMeasuresBegin();
+        uint8_t sending;
+        while ((sending = sendMeasuresFrame()) != MEASURES_SENT) {
+            watchdog_CheckIn(WATCHDOG_SEND);
+            if (sending == MEASURES_SENDING_VOLTAGES) { // the look up table of this job is no longer needed
+                user_queue_prepare(); // the next job of the queue is made in the other half of the arena
+            }
+        }
+        watchdog_BlockEnd(outer_block);
+    }
+    glucose_request = false;
+    helper_HardwareSleep();
+    watchdog_CheckIn(WATCHDOG_MAIN);
+}
+
+/******************************************************************************
+* Function Name: swv_add_sample
+*******************************************************************************
+*
+* Summary:
+*  Square wave voltammetry computed while measuring: the DAC holds
+*  waveform_lut[lut_index-1], even indexes are the forward pulses and odd
+*  indexes the reverse ones. The forward current is kept until the reverse one
+*  of the same step arrives, then the difference (forward - reverse) is saved
+*  in data_long, alone (SWV_SEND_NET) or after the other two (SWV_SEND_ALL)
+*
+* Global variables:
+*  data_long: one or three samples (TIA_SampleEncode(), MSB first) for each step
+*  swv_steps: steps completed, to know how many bytes to send
+*
+*******************************************************************************/
+
+static void swv_add_sample(int32_t measure) {
+    static int32_t forward;
+    uint16_t applied = lut_index - 1;
+    
+    if (lut_index == 0) { // first sample of a new cycle, the DAC still holds the end of the LUT
+        return;
+    }
+    if (!(applied & 1)) {
+        forward = measure;
+        return;
+    }
+    uint16_t step = applied / 2;
+    int32_t difference = forward - measure; // saturated by measure_save() if beyond the range of the samples
     
-    uint8_t LSB_data = measure & 0xFF;
-    uint8_t MSB_data = measure >> 8;
-    data_long[2*lut_index] = MSB_data;
-    data_long[2*lut_index+1] = LSB_data;
+    if (swv_mode == SWV_SEND_ALL) {
+        measure_save(3*step, forward);
+        measure_save(3*step+1, measure);
+        measure_save(3*step+2, difference);
+    } else {
+        measure_save(step, difference);
+    }
+    if (step >= swv_steps) {
+        swv_steps = step + 1;
+    }
 }
 
 CY_ISR(Custom_UART_BT_RX_Interrupt){ // called when incoming data is available on the RX of the UART 
@@ -82,23 +297,61 @@ CY_ISR(Custom_UART_BT_RX_Interrupt){ // called when incoming data is available o
     LED_DAC_Write(1);
     temp[buffer_index] = UART_BT_GetByte();   
     
-    if(temp[buffer_index] == 'Z'){
+    uint8_t stop_done = 0;
+    uint8_t frame_done = 0;
+    
+    if(temp[buffer_index] == 'Z' && temp[0] == STOP_PROCEDURE && isr_dac_GetState()){ 
+        // STOP while measuring: done here and not by the main, the next dac isr ends the procedure
+        procedure_stopped = true;
+        lut_end = lut_index + 1;
+        stop_done = 1;
+        for(uint16_t i=0; i<DATA_MAX_READING_SIZE ; i++){
+            temp[i] =0; //clearing data buffer
+        }
+    } else if(temp[buffer_index] == 'Z'){
         input_flag = 1; // raises input flag, so that te main calls the BT reading at the next while(1) iteration  
         
-        
+        // queued behind the frames not handled yet, dropped if the ring is full (an upload sends it again)
+        volatile uint8_t *frame = rx_frames[rx_head & (RX_FRAMES - 1)];
+        uint8_t queued = (uint8_t)(rx_head - rx_tail) < RX_FRAMES;
         for(uint16_t i=0; i<DATA_MAX_READING_SIZE ; i++){
-            data_buffer[i] = temp[i];
+            if (queued) {
+                frame[i] = temp[i];
+            }
             temp[i] =0; //clearing data buffer
         }   
+        rx_head += queued;
+        frame_done = 1;
     }
     
-    if(input_flag){
+    if(frame_done || stop_done){
         buffer_index = 0;
-    } else {
+    } else if(buffer_index < DATA_MAX_READING_SIZE - 1){ // longer frames are cut, not written past temp
         buffer_index++;
     }
 }
 
+/******************************************************************************
+* Function Name: rx_next_frame
+*******************************************************************************
+*
+* Summary:
+*  Copy the oldest frame of the RX isr in data_buffer, input_flag stays set
+*  while other frames are waiting
+*
+*******************************************************************************/
+
+static void rx_next_frame(void) {
+    uint8_t interrupt_state = CyEnterCriticalSection();
+    volatile uint8_t *frame = rx_frames[rx_tail & (RX_FRAMES - 1)];
+    for(uint16_t i=0; i<DATA_MAX_READING_SIZE ; i++){
+        data_buffer[i] = frame[i];
+    }
+    rx_tail++;
+    input_flag = rx_head != rx_tail;
+    CyExitCriticalSection(interrupt_state);
+}
+
 int main(void){
     
     CyGlobalIntEnable; // Enable global interrupts
@@ -106,8 +359,11 @@ int main(void){
     input_flag = 0; 
     connection_state = 0;
     buffer_index = 0;
+    rx_head = 0;
+    rx_tail = 0;
     lut_index=0; 
     finished_procedure_flag=0; // DEBUG CHANGE -- delete later 
+    procedure_ended = false;
 
     /* *********************************
        ******* INITIALIZATION CODE *****
@@ -117,6 +373,9 @@ int main(void){
        2. enable of interrupts
        3. calibration of the TIA with default value of R */
     
+    params_Load(); // one bulk read of the EEPROM parameters into RAM, needed by DAC_Start()
+    journal_Start(); // emulated EEPROM with the measurements saved, builds the RAM index
+    
     helper_HardwareSetup(); /* from hardware_management.c 
                                1. calls Init() API functions of all AMUX
                                2. calls Start() from DAC_management.c, which starts the DAC selected 
@@ -133,36 +392,33 @@ int main(void){
     isr_adc_StartEx(adcInterrupt);
     isr_adc_Disable();
     isr_UART_BT_RX_StartEx(Custom_UART_BT_RX_Interrupt); 
+    button_Start(); // glucose measure without the GUI
    
     
     UART_BT_Start(); // switch on the communication with the Bluetooth 
+    helper_TimebaseStart(); // ms counter used by the tasks done while idle
     CyDelay(100); // give a little time to the BT module to tune and set
     
     //Clear the data_buffer and the data_to_send arrays
-    for(uint16_t i=0; i<DATA_MAX_SENDING_SIZE ; i++){
+    for(uint16_t i=0; i<DATA_MAX_READING_SIZE ; i++){
         data_buffer[i] = 0;
+    }
+    for(uint16_t i=0; i<DATA_MAX_SENDING_SIZE ; i++){
         data_to_send[i] = 0;
     }
     
-    for(uint16_t i=0; i<DATA_LONG_SIZE ; i++){
+    memory_UseLayout(MEMORY_LAYOUT_LUT); // waveform_lut and data_long are in the arena, empty until a procedure is set
+    for(uint16_t i=0; i<data_long_size ; i++){
         data_long[i] = 0;
     }
     
     // TIA INITIALIZATION
     TIA_SetResFB(TIA_RESISTOR_DEFAULT_VALUE_INDEX); 
-    calibrate_TIA(TIA_RESISTOR_DEFAULT_VALUE_INDEX); // calibration of the TIA with default R = 20 kOhm
-    
-    // EEPROM INITIALIZATION
-    EEPROM_Start();
-    if(EEPROM_ReadByte(EEPROM_FLAG_ADD)!=1){
-        EEPROM_WriteByte(EEPROM_FLAG, EEPROM_FLAG_ADD);
-    }
-    
-    if(EEPROM_ReadByte(EEPROM_FLAG_ADD) == 0){
-       initialize_default_values(); // the default values in the EEPROM are initialized
+    if (!watchdog_Recover()) { // after a watchdog reset the calibration done before it is used again
+        calibrate_TIA(TIA_RESISTOR_DEFAULT_VALUE_INDEX); // calibration of the TIA with default R = 20 kOhm
     }
     
-    //CyWdtStart(CYWDT_1024_TICKS, CYWDT_LPMODE_NOCHANGE); -- si può toglierlo
+    watchdog_Start(); // report of the interrupted run (after a watchdog reset), then the watchdog is started
     
     
     
@@ -170,10 +426,26 @@ int main(void){
         
         //input_flag = 1; //DEBUG CHANGE -- delete later
         
-        CyDelay(100);
+        if(!input_flag){ // the frames waiting (the chunks of an upload) are handled back to back
+            CyDelay(100);
+        }
         
     
-        //CyWdtClear(); // clears the watchdog timer -> stops here
+        watchdog_CheckIn(WATCHDOG_MAIN); // the watchdog is cleared when all the expected tasks have checked in
+        button_Poll(); // press latched since the last iteration
+        
+        if(procedure_ended){ // the dac isr has ended the procedure, the measures are sent before any new command
+            procedure_ended = false;
+            procedure_end();
+        }
+        
+        if(isr_dac_GetState() && procedure_type == CHANGE_CA_PARAMETERS && glucose_FitTask() && glucose_request){
+            uint8_t interrupt_state = CyEnterCriticalSection();
+            if (lut_end > lut_index + 1) {
+                lut_end = lut_index + 1; // the fit has converged, the next dac isr ends the measure
+            }
+            CyExitCriticalSection(interrupt_state);
+        }
         
         /* ************************
            ******* CASES CODE *****
@@ -192,7 +464,11 @@ int main(void){
         */ 
         if(input_flag==1){ // we have a new  iput -> go to the related state (case) 
             
-            input_flag=0;
+            rx_next_frame(); // clears input_flag if it was the last one
+            TIA_YieldToCommand(); // a drift check running in background must not delay the command
+            strip_Disarm(); // a glucose measure waiting for the sample is dropped
+            user_queue_discard(); // and the next job of the queue is made again when it starts
+            eis_Abort(); // and so is an impedance sweep in progress
             
             
             
@@ -214,22 +490,19 @@ int main(void){
                     
             case TIA_INITIALIZATION:;
                     connection_state=1;
-                    for(int i=0; i<(Number_calibration_points*4)+1; i++){
+                    for(int i=0; i<tia_calibration_length; i++){
                         data_to_send[i] = tia_calibration_values[i];
                     }
-                    writeBT((Number_calibration_points*4)+1);               
+                    writeBT(tia_calibration_length);               
             break;    
                     
             case TIA_CALIBRATE: ; // user has changed some parameters regarding the TIA (impedance, ADC configuration) 
-                                  // the TIA is calibrated again
+                                  // the TIA is calibrated again: A|0x00|R index|N points|K averages
+                                  // the sweep runs in background, the fit is sent when TIA_CalibrationTask() is done
                 if(data_buffer[1] == 0x00){
+                    TIA_AbortCalibration();
                     user_setup_TIA_ADC(data_buffer);
-                    calibrate_TIA(data_buffer[2]); 
-                    break;
-                }else if(data_buffer[1] == 0x01){
-                    EEPROM_WriteByte(data_buffer[2], R_TIA_CALIBRATION);
-                    EEPROM_WriteByte(data_buffer[3], Q_TIA_CALIBRATION);
-                    break;
+                    TIA_StartCalibration(data_buffer[2], data_buffer[3], data_buffer[4]); 
                 }
             break;
 
@@ -238,8 +511,7 @@ int main(void){
             case CHANGE_CV_PARAMETERS: ; /* user has changed parameters of the CV from the GUI need to
                                             (1) update the T_PWM according to the scan rate,
                                             (2) create the LUT according to start and end values */ 
-                user_set_isr_timer(data_buffer); /*give the scan rate in ms (from UART)*/
-                lut_length = LUT_MakeTriangle_Wave(data_buffer);
+                user_set_procedure(data_buffer); /*give the scan rate in ms (from UART)*/
                     /*start and end values in bits (mv->bit processing in Py) from UART
                                         and which type of cv to perform*/
                                       // for now, pulse height and increment of SWV are hard coded 
@@ -258,7 +530,7 @@ int main(void){
             case CHANGE_CA_PARAMETERS: ; /* can set 
                                             - which CA to make (1) with parameters (2) measure with dft
                                             - if parameters: Voltage and duration of stimulation*/
-                lut_length = user_chrono_lut_maker(data_buffer);
+                user_set_procedure(data_buffer);
                                        /*type of CV, voltage and duration
                                         if measure -> duration = 0 (not used by user_chrono_lut_maker), V = 0 
                                                        >> this in Py! 
@@ -295,17 +567,92 @@ int main(void){
             case DAC_MANAGEMENT:;
                 user_voltage_source_funcs(data_buffer); 
             break; 
+                
+            case MEASURE_GLUCOSE:; // standard CA, only the glucose computed on the device is sent back
+                user_measure_glucose(data_buffer);
+            break;
+                
+            case STOP_PROCEDURE:; // no procedure was running (otherwise the RX isr has already stopped it)
+                sendStopped(0);
+                procedure_stopped = true; // a queue waiting between two jobs is stopped too
+            break;
+                
+            case JOURNAL_MANAGEMENT:; // list, fetch and clear the measurements saved in flash
+                user_journal_management(data_buffer);
+            break;
+                
+            case JOB_MANAGEMENT:; // queue of procedures run one after the other
+                user_queue_management(data_buffer);
+            break;
+                
+            case BENCHMARK:; // cost of one step of the last procedure and maximum step rate
+                user_benchmark();
+            break;
+                
+            case WAVEFORM_SELECT:; // standard procedure already in flash, started with RUN_CV or RUN_CA
+                waveform_SendSelected(data_buffer[1], waveform_Select(data_buffer[1]));
+            break;
+                
+            case UPLOAD_WAVEFORM:; // chunks of an arbitrary waveform, started with RUN_CV when complete
+                upload_Command(data_buffer);
+            break;
+                
+            case LAST_RESULT:; // glucose measured with the button, also without the GUI connected
+                button_SendResult();
+            break;
+                
+            case RESET_REPORT:; // last watchdog reset, also after a power off
+                watchdog_SendReport();
+            break;
+                
+            case EIS_MEASURE:; // impedance sweep, runs in background and is sent by eis_Task()
+                if (!eis_Start(data_buffer)) {
+                    errorBT();
+                }
+            break;
         } 
     }
+        if(!input_flag && !isr_dac_GetState() && !procedure_ended && !eis_Running()){ // idle: no procedure running and no command waiting
+            journal_Task(); // write the entry of the last measurement in flash
+            if (strip_Task(helper_Millis())) { // the strip has been filled, start the measure waiting for it
+                user_run_procedure();
+            }
+            TIA_DriftScheduler(helper_Millis());
+            user_queue_task(); // next job of the queue, after the journal entry of the previous one
+            if (button_Task(helper_Millis())) { // the button has been pressed: standard glucose measure
+                user_button_measure();
+            }
+        }
+        
+        if(TIA_CalibrationTask()){ // calibration sweep requested by the GUI completed, send the new fit
+            for(int i=0; i<tia_calibration_length; i++){
+                data_to_send[i] = tia_calibration_values[i];
+            }
+            writeBT(tia_calibration_length);
+        }
+        
+        eis_Task(); // next frequency of the impedance sweep, the results after the last one
+        
         if(finished_procedure_flag){ // DEBUG CHANGE -- delete later the if case
+#if (DAC_PROFILE)
+            // P|average cycles of the dac isr (4)|max cycles (4)|Z
+            uint32_t average_cycles = dac_profile.steps ? dac_profile.total_cycles / dac_profile.steps : 0;
+            data_to_send[0] = PROFILE_DATA;
+            for (int i = 0; i < 4; i++) {
+                data_to_send[1+i] = average_cycles >> (24 - 8*i);
+                data_to_send[5+i] = dac_profile.max_cycles >> (24 - 8*i);
+            }
+            writeBT(9);
+#endif
             
-            for (int i = 0; i<5 ; i++){
+            for (int i = 0; i<5 && !button_Blinking() ; i++){ // a measure of the button blinks its result instead
                 LED_ADC_Write(1); 
                 LED_DAC_Write(1); 
                 CyDelay(500);
                 LED_ADC_Write(0); 
                 LED_DAC_Write(0); 
                 CyDelay(500); 
+                watchdog_CheckIn(WATCHDOG_MAIN);
             }  
             finished_procedure_flag=0; 
         }
@@ -0,0 +1,155 @@
+/*******************************************************************************
+* File Name: memory_management.c
+*
+* Description:
+*  Layouts of the memory arena. memory_UseLayout() is called by the LUT makers
+*  while the device is idle, the isr only use the pointers it sets. The layout
+*  is made in the bank chosen with memory_UseBank(), the whole arena unless a
+*  job of the queue is being made
+*********************************************************************************/
+
+#include "memory_management.h"
+
+static uint32_t memory_arena[MEMORY_ARENA_SIZE/MEMORY_ALIGN];
+static uint8_t memory_bank = MEMORY_BANK_ALL;   // bank of the next layouts
+static uint8_t memory_layout_bank = MEMORY_BANK_ALL; // bank of the layout in use
+
+// LUT entries of a layout of size bytes that gives bytes_per_step to each step, room for the guard and the alignment
+#define MEMORY_LUT_STEPS(size, bytes_per_step) \
+    (((size) - 2*MEMORY_LUT_GUARD - 2*MEMORY_ALIGN) / (bytes_per_step))
+
+/***************************************
+* Forward function references
+***************************************/
+static uint16_t memory_align(uint16_t bytes);
+
+/***************************************
+*        Build time budget
+***************************************/
+
+_Static_assert(MEMORY_LUT_STEPS(MEMORY_ARENA_SIZE, 2 + 2) == MEMORY_CV_MAX_STEPS,
+               "MEMORY_CV_MAX_STEPS does not match the arena");
+_Static_assert(MEMORY_LUT_STEPS(MEMORY_ARENA_SIZE, 2 + 2 + 4) == MEMORY_CV_CYCLES_MAX_STEPS,
+               "MEMORY_CV_CYCLES_MAX_STEPS does not match the arena");
+_Static_assert(MEMORY_ARENA_SIZE/2 == MEMORY_CA_MAX_SAMPLES,
+               "MEMORY_CA_MAX_SAMPLES does not match the arena");
+_Static_assert(MEMORY_LUT_STEPS(MEMORY_BANK_SIZE, 2 + 2) == MEMORY_QUEUE_CV_MAX_STEPS,
+               "MEMORY_QUEUE_CV_MAX_STEPS does not match the bank");
+_Static_assert(MEMORY_BANK_SIZE/2 == MEMORY_QUEUE_CA_MAX_SAMPLES,
+               "MEMORY_QUEUE_CA_MAX_SAMPLES does not match the bank");
+_Static_assert(MEMORY_BANK_SIZE % MEMORY_ALIGN == 0, "the second bank is not aligned");
+_Static_assert(MEMORY_ARENA_SIZE/2 <= UINT16_MAX, "data_long_size is 16 bit");
+_Static_assert(sizeof(memory_arena) + sizeof(data_to_send) + sizeof(data_buffer) + sizeof(temp)
+               <= MEMORY_STATIC_BUDGET, "the static buffers are over MEMORY_STATIC_BUDGET");
+
+#if (MEMORY_REPORT)
+#define MEMORY_STR(x) #x
+#define MEMORY_REPORT_LINE(text, value) _Pragma(MEMORY_STR(message(text MEMORY_STR(value))))
+MEMORY_REPORT_LINE("memory arena (bytes): ", MEMORY_ARENA_SIZE)
+MEMORY_REPORT_LINE("static buffers budget (bytes): ", MEMORY_STATIC_BUDGET)
+MEMORY_REPORT_LINE("CV, max steps: ", MEMORY_CV_MAX_STEPS)
+MEMORY_REPORT_LINE("CV with more cycles, max steps: ", MEMORY_CV_CYCLES_MAX_STEPS)
+MEMORY_REPORT_LINE("CA, max samples: ", MEMORY_CA_MAX_SAMPLES)
+MEMORY_REPORT_LINE("job of the queue, CV max steps: ", MEMORY_QUEUE_CV_MAX_STEPS)
+MEMORY_REPORT_LINE("job of the queue, CA max samples: ", MEMORY_QUEUE_CA_MAX_SAMPLES)
+#endif
+
+/******************************************************************************
+* Function Name: memory_UseLayout
+*******************************************************************************
+*
+* Summary:
+*  Split the bank of the arena for the next procedure (the whole arena unless
+*  memory_UseBank() has chosen a half). With MEMORY_LAYOUT_LUT each step
+*  takes one entry of waveform_lut, one sample in data_long and, if the CV has
+*  more cycles, one int32 for the sample in cv_accumulator, so the longest LUT
+*  depends on cv_cycles. With MEMORY_LAYOUT_SAMPLES lut_capacity is 0 and
+*  data_long is the whole bank. Must be called while no procedure is running
+*
+* Parameters:
+*  uint8_t layout: MEMORY_LAYOUT_LUT or MEMORY_LAYOUT_SAMPLES
+*
+* Global variables:
+*  waveform_lut, lut_capacity, data_long, data_long_size, cv_accumulator
+*
+*******************************************************************************/
+
+void memory_UseLayout(uint8_t layout) {
+    uint8_t *arena = (uint8_t *)memory_arena;
+    uint16_t size = MEMORY_ARENA_SIZE;
+
+    if (memory_bank != MEMORY_BANK_ALL) {
+        size = MEMORY_BANK_SIZE;
+        arena += (memory_bank == MEMORY_BANK_HIGH) ? MEMORY_BANK_SIZE : 0;
+    }
+    memory_layout_bank = memory_bank;
+
+    if (layout == MEMORY_LAYOUT_SAMPLES) {
+        waveform_lut = (uint16_t *)arena;  // not used by the procedure (CA pulse or table in flash)
+        lut_capacity = 0;
+        data_long = arena;
+        data_long_size = size;
+        cv_accumulator = NULL;
+        return;
+    }
+
+    uint16_t bytes_per_step = 4;  // LUT entry and sample
+    if (cv_cycles > 1) {
+        bytes_per_step += 4;  // int32 of the accumulator
+    }
+    uint16_t steps = MEMORY_LUT_STEPS(size, bytes_per_step);
+    uint16_t lut_bytes = memory_align(2*(steps + MEMORY_LUT_GUARD));
+
+    waveform_lut = (uint16_t *)arena;
+    lut_capacity = steps;
+    data_long = arena + lut_bytes;
+    data_long_size = 2*steps;
+    cv_accumulator = (cv_cycles > 1) ? (int32_t *)(arena + lut_bytes + memory_align(data_long_size)) : NULL;
+}
+
+/******************************************************************************
+* Function Name: memory_UseBank
+*******************************************************************************
+*
+* Summary:
+*  Choose the part of the arena split by the next memory_UseLayout(). The
+*  queue makes a job in the half not used by the job being sent, then gives
+*  the whole arena back to the procedures set by the GUI
+*
+* Parameters:
+*  uint8_t bank: MEMORY_BANK_ALL, MEMORY_BANK_LOW or MEMORY_BANK_HIGH
+*
+*******************************************************************************/
+
+void memory_UseBank(uint8_t bank) {
+    memory_bank = bank;
+}
+
+/******************************************************************************
+* Function Name: memory_LayoutBank
+*******************************************************************************
+*
+* Summary:
+*  Bank of the layout in use, MEMORY_BANK_ALL unless the procedure is a job
+*  of the queue
+*
+*******************************************************************************/
+
+uint8_t memory_LayoutBank(void) {
+    return memory_layout_bank;
+}
+
+/******************************************************************************
+* Function Name: memory_align
+*******************************************************************************
+*
+* Summary:
+*  Round up to a multiple of MEMORY_ALIGN bytes
+*
+*******************************************************************************/
+
+static uint16_t memory_align(uint16_t bytes) {
+    return (bytes + MEMORY_ALIGN - 1) & ~(MEMORY_ALIGN - 1);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,62 @@
+/*******************************************************************************
+* File Name: memory_management.h
+*
+* Description:
+*  One static arena shared by the look up table of the dac (waveform_lut), the
+*  samples of the adc (data_long) and the accumulator of the multi-cycle CV
+*  (cv_accumulator). The procedures never need the three at full size at the
+*  same time, so the arena is split again every time a procedure is set: a CV
+*  gives to each step one LUT entry and its samples, a CA is made from a
+*  descriptor (baseline, pulse, length) and gives the whole arena to the
+*  samples. The jobs of a queue take half of the arena each, so the next job
+*  can be made while the previous one is sent. The budget of the static
+*  buffers is checked at build time
+*********************************************************************************/
+
+#if !defined(MEMORY_MANAGEMENT_H)
+#define MEMORY_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define MEMORY_ARENA_SIZE       25000 // bytes, the LUT (10 KB), data_long (5 KB) and cv_accumulator (10 KB) were separate
+#define MEMORY_LUT_GUARD        5     // entries after lut_capacity, a few LUT makers go over by 1
+#define MEMORY_ALIGN            4     // cv_accumulator is int32
+
+// layouts of the arena, chosen by the LUT makers
+#define MEMORY_LAYOUT_LUT       0     // waveform_lut, data_long and, for more cycles, cv_accumulator
+#define MEMORY_LAYOUT_SAMPLES   1     // no look up table in RAM (CA from its descriptor, table in flash), only data_long
+
+// part of the arena split by memory_UseLayout()
+#define MEMORY_BANK_ALL         0     // the whole arena, procedures set by the GUI
+#define MEMORY_BANK_LOW         1     // first half, the jobs of the queue alternate the two halves
+#define MEMORY_BANK_HIGH        2     // second half
+#define MEMORY_BANK_SIZE        (MEMORY_ARENA_SIZE/2)
+
+// budget report: longest run of each procedure, checked at build time
+#define MEMORY_CV_MAX_STEPS         6245  // linear or square wave CV, one cycle (2500 before)
+#define MEMORY_CV_CYCLES_MAX_STEPS  3122  // CV averaged over more cycles (2500 before)
+#define MEMORY_CA_MAX_SAMPLES       12500 // CA, baselines included (2500 before)
+#define MEMORY_QUEUE_CV_MAX_STEPS   3120  // the same for a job of the queue, in half of the arena
+#define MEMORY_QUEUE_CA_MAX_SAMPLES 6250
+// the arena and the BT buffers must not take more RAM than the buffers they replaced
+#define MEMORY_STATIC_BUDGET    25170 // bytes
+
+#define MEMORY_REPORT           0     // 1: print the budget of the arena when the project is built
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+void memory_UseLayout(uint8_t layout);
+void memory_UseBank(uint8_t bank);
+uint8_t memory_LayoutBank(void);
+
+#endif
+
+/* [] END OF FILE */
@@ -7,6 +7,13 @@
 *********************************************************************************/
 
 #include "parametric_lut.h"
+#include "memory_management.h"
+#include "timing_management.h"
+
+static uint8_t lut_is_pulse;        // the procedure is the CA pulse, no look up table in memory
+static uint16_t lut_pulse_base;
+static uint16_t lut_pulse_value;
+static uint8_t lut_levels = 1;      // DAC levels of each step, more than 1 for the fast linear CV
 
 /******************************************************************************
 * Function Name: LUT_MakeTriangleWave
@@ -14,7 +21,8 @@
 *
 * Summary:
 *  Fill in the look up table (waveform_lut) for the DACs to perform a cyclic voltammetry experiment.
-*  Start the CV protocol at the user defined start value
+*  Start the CV protocol at the user defined start value. For the square wave voltammetry
+*  every step is a pair forward, reverse: waveform_lut[2*step] and waveform_lut[2*step+1]
 *
 * Parameters:
 *  uint16_t start_value: first value to put in the dac
@@ -25,6 +33,10 @@
 *
 * Global variables:
 *  waveform_lut: Array the look up table is stored in
+*  swv_mode: what the adc isr saves, byte 7 of the command (only for the square wave)
+*  cv_cycles: how many times the LUT is applied, byte 8 of the command
+*  The linear CV makes steps of LUT_LevelsPerStep() DAC levels (fast scan).
+*  The arena is split for the cycles before the LUT is made
 *
 *******************************************************************************/
 
@@ -35,15 +47,30 @@ uint16_t LUT_MakeTriangle_Wave(volatile uint8_t * data_buffer) {
     
     uint16_t _lut_index = 0;  // start at the beginning of the lut
     
+    swv_mode = SWV_SEND_RAW;
+    cv_cycles = 1;
+    cv_send_last_cycle = false;
+    if (data_buffer[8] > 1 && data_buffer[8] <= CV_MAX_CYCLES) {
+        cv_cycles = data_buffer[8];
+        cv_send_last_cycle = (data_buffer[9] == 1);
+    }
+    LUT_StartTable();
+    
     if(!cv_type) { //cv_type == 0 perform linear CV
-         _lut_index = LUT_make_line(start_value, end_value, 0); //retta da start a end salvata nella prima metà di waveform_lut
-         _lut_index = LUT_make_line(end_value, start_value, _lut_index-1); //retta da end a start salvata nella seconda metà di waveform_lut
+         uint8_t levels = LUT_LevelsPerStep(LUT_ScanRate(data_buffer[1]));
+         lut_levels = levels;
+         _lut_index = LUT_make_line(start_value, end_value, 0, levels); //retta da start a end salvata nella prima metà di waveform_lut
+         // the return starts from the last value, that is end_value only if the levels divide the ramp
+         _lut_index = LUT_make_line(waveform_lut[_lut_index-1], start_value, _lut_index-1, levels); //retta da end a start salvata nella seconda metà di waveform_lut
     
     } else{ // cv_type == 1 perform sqw  
         uint8_t pulse_inc    = data_buffer[5];
         uint8_t pulse_height = data_buffer[6];
         _lut_index = LUT_make_swv_line(start_value, end_value, pulse_inc, pulse_height, 0); 
-        _lut_index = LUT_make_swv_line(end_value, start_value, pulse_inc, pulse_height, _lut_index-1); 
+        _lut_index = LUT_make_swv_line(end_value, start_value, pulse_inc, pulse_height, _lut_index); // no overlap, the steps stay in pairs
+        if (data_buffer[7] == SWV_SEND_NET || data_buffer[7] == SWV_SEND_ALL) {
+            swv_mode = data_buffer[7];
+        }
     }
     waveform_lut[_lut_index] = start_value;  // the DAC is changed before the value is checked in the isr so it will go 
                                             // 1 over so make it stay at last voltage
@@ -52,18 +79,60 @@ uint16_t LUT_MakeTriangle_Wave(volatile uint8_t * data_buffer) {
     return _lut_index;  
 }
 
+/******************************************************************************
+* Function Name: LUT_ScanRate
+*******************************************************************************
+*
+* Summary:
+*  Scan rate in mV/s from byte 1 of the CHANGE_CV_PARAMETERS command: with
+*  SCAN_RATE_FAST set the other bits are tens of mV/s. 0 is taken as 1 mV/s
+*
+*******************************************************************************/
+
+uint16_t LUT_ScanRate(uint8_t scan_rate_byte) {
+    uint16_t scan_rate = scan_rate_byte;
+    
+    if (scan_rate_byte & SCAN_RATE_FAST) {
+        scan_rate = (scan_rate_byte & ~SCAN_RATE_FAST) * 10;
+    }
+    return scan_rate ? scan_rate : 1;
+}
+
+/******************************************************************************
+* Function Name: LUT_LevelsPerStep
+*******************************************************************************
+*
+* Summary:
+*  DAC levels of each step of the linear CV: one level up to
+*  CV_FAST_MAX_STEP_HZ steps per second, above that the steps are made larger
+*  so that each one lasts at least two ticks of the timing and the sample
+*  taken at its end is not right after the edge
+*
+* Parameters:
+*  uint16_t scan_rate: mV/s
+*
+*******************************************************************************/
+
+uint8_t LUT_LevelsPerStep(uint16_t scan_rate) {
+    uint32_t max_rate = (uint32_t)dac_resolution * CV_FAST_MAX_STEP_HZ; // mV/s with one level per step
+    
+    return (scan_rate + max_rate - 1) / max_rate;
+}
+
 /******************************************************************************
 * Function Name: LUT_make_line
 *******************************************************************************
 *
 * Summary:
 *  Make a ramp from start to end in waveform_lut starting at index
-*  Does not matter if start or end is higher
+*  Does not matter if start or end is higher. With more than one level for
+*  each step the last value is the last one that does not pass end
 *
 * Parameters:
 *  uint16_t start: first value to put in the look up table
 *  uint16_t end: end value to put in the look up table
 *  uint16_t index: the place to start putting in numbers in the look up table
+*  uint8_t levels: DAC levels between two values
 *
 * Return:
 *  uint16_t: first place after the filled in area of the look up table
@@ -73,24 +142,24 @@ uint16_t LUT_MakeTriangle_Wave(volatile uint8_t * data_buffer) {
 *
 *******************************************************************************/
 
-uint16_t LUT_make_line(uint16_t start, uint16_t end, uint16_t index) {
+uint16_t LUT_make_line(uint16_t start, uint16_t end, uint16_t index, uint8_t levels) {
     //printf("start: %i, end: %i\n", start, end);
     if (start < end) {
-        for (int16_t value = start; value <= end; value++) {
+        for (int16_t value = start; value <= end; value += levels) {
             waveform_lut[index] = value;
             index ++;
             //printf("l: %i, %i\n", index, value);
-            if (index >= MAX_LUT_SIZE) { //questo sarebbe un errore da gestire, per ora non viene comunicato
+            if (index >= lut_capacity) { //questo sarebbe un errore da gestire, per ora non viene comunicato
                 return index;
             }
         }
     }
     else {
-        for (int16_t value = start; value >= end; value--) {
+        for (int16_t value = start; value >= end; value -= levels) {
             waveform_lut[index] = value;
             index ++;
             //printf("b: %i, %i\n", index, value);
-            if (index >= MAX_LUT_SIZE) {
+            if (index >= lut_capacity) {
                 return index;
             }
         }
@@ -125,7 +194,7 @@ uint16_t LUT_make_line(uint16_t start, uint16_t end, uint16_t index) {
 
 uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc, uint16_t pulse_height, uint16_t index) {
     
-    if (index > MAX_LUT_SIZE) {
+    if (index > lut_capacity) {
         return index;
     }
     uint16_t half_pulse = pulse_height / 2;
@@ -135,7 +204,7 @@ uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc, uin
             index ++;
             waveform_lut[index] = value - half_pulse;
             index ++;
-            if (index > MAX_LUT_SIZE) {
+            if (index > lut_capacity) {
                 break;
             }
         }
@@ -147,7 +216,7 @@ uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc, uin
             waveform_lut[index] = value - half_pulse;
             index ++;
             printf("b: %i, %i\n", index, value);
-            if (index > MAX_LUT_SIZE) {
+            if (index > lut_capacity) {
                 break;
             }
         }
@@ -160,35 +229,120 @@ uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc, uin
 *******************************************************************************
 *
 * Summary:
-*  Make a look up table that stores a square pulse sequence
-*  Quick hack for chronoamperomerty
-*  TODO: THIS SHOULD BE REPLACED
+*  Set the square pulse of the chronoamperometry: CA_BASELINE_SAMPLES at base,
+*  the pulse, CA_BASELINE_SAMPLES at base. Nothing is written in waveform_lut,
+*  LUT_Value() makes each value from these three numbers, so the whole arena
+*  is left to the samples. The pulse is cut to the samples that can be saved
 *
 * Parameters:
 *  uint16_t base: value to be placed in the DAC to maintain the baseline potential
 *  uint16_t pulse: value to put in the DAC for the voltage pulse
 *
+* Return:
+*  uint16_t: steps of the procedure
+*
 * Global variables:
-*  waveform_lut: Array the look up table is stored in
+*  ca_pulse_samples: length of the pulse, used by the Cottrell fit
 *
 *******************************************************************************/
 
 uint16_t LUT_MakePulse(uint16_t base, uint16_t pulse, uint16_t ca_period_ms) {
-    int _lut_index = 0;
-    int counter_ca = ca_period_ms/(T_PWM_STD_CA/FREQ_CLOCK_PWM);
-    while (_lut_index < 20) { 
-        waveform_lut[_lut_index] = base;
-        _lut_index++;
+    swv_mode = SWV_SEND_RAW;
+    cv_cycles = 1;
+    memory_UseLayout(MEMORY_LAYOUT_SAMPLES);
+    
+    uint16_t samples = data_long_size/2;
+    uint16_t counter_ca = ca_period_ms/CA_STEP_MS;
+    if (counter_ca > samples - 2*CA_BASELINE_SAMPLES) {
+        counter_ca = samples - 2*CA_BASELINE_SAMPLES;
     }
-    while (_lut_index < 20+counter_ca) {
-        waveform_lut[_lut_index] = pulse;
-        _lut_index++;
+    ca_pulse_samples = counter_ca;
+    lut_pulse_base = base;
+    lut_pulse_value = pulse;
+    lut_is_pulse = true;
+    lut_levels = 1;
+    return 2*CA_BASELINE_SAMPLES + counter_ca;
+}
+
+/******************************************************************************
+* Function Name: LUT_StartTable
+*******************************************************************************
+*
+* Summary:
+*  Give the arena to a look up table that is going to be written in
+*  waveform_lut, with the layout for cv_cycles
+*
+* Return:
+*  uint16_t: entries that can be written (lut_capacity)
+*
+*******************************************************************************/
+
+uint16_t LUT_StartTable(void) {
+    lut_is_pulse = false;
+    lut_levels = 1;
+    memory_UseLayout(MEMORY_LAYOUT_LUT);
+    return lut_capacity;
+}
+
+/******************************************************************************
+* Function Name: LUT_PlayTable
+*******************************************************************************
+*
+* Summary:
+*  Use a look up table already made in flash (waveform_management.c): nothing
+*  is copied, waveform_lut points to the table and the whole arena is left to
+*  the samples. The table must not be written, lut_capacity is 0
+*
+* Parameters:
+*  const uint16_t table[]: DAC values of the procedure
+*  uint16_t length: entries of the table
+*
+* Return:
+*  uint16_t: steps of the procedure
+*
+*******************************************************************************/
+
+uint16_t LUT_PlayTable(const uint16_t table[], uint16_t length) {
+    memory_UseLayout(MEMORY_LAYOUT_SAMPLES);
+    waveform_lut = (volatile uint16_t *)table;
+    lut_is_pulse = false;
+    lut_levels = 1;  // the library has no fast scan
+    return length;
+}
+
+/******************************************************************************
+* Function Name: LUT_Levels
+*******************************************************************************
+*
+* Summary:
+*  DAC levels of each step of the procedure set: LUT_LevelsPerStep() for the
+*  linear CV, 1 for the other procedures
+*
+*******************************************************************************/
+
+uint8_t LUT_Levels(void) {
+    return lut_levels;
+}
+
+/******************************************************************************
+* Function Name: LUT_Value
+*******************************************************************************
+*
+* Summary:
+*  Value of the DAC at step index of the procedure: waveform_lut[index], or
+*  for the CA the value given by the pulse set with LUT_MakePulse(). Called by
+*  the dac isr at every step
+*
+*******************************************************************************/
+
+uint16_t LUT_Value(uint16_t index) {
+    if (!lut_is_pulse) {
+        return waveform_lut[index];
     }
-    while (_lut_index < 40+counter_ca) { 
-        waveform_lut[_lut_index] = base;
-        _lut_index++;
+    if (index >= CA_BASELINE_SAMPLES && index < CA_BASELINE_SAMPLES + ca_pulse_samples) {
+        return lut_pulse_value;
     }
-    return _lut_index;
+    return lut_pulse_base;
 }
 
 /* [] END OF FILE */
@@ -21,7 +21,13 @@
 ***************************************/    
 uint16_t LUT_MakeTriangle_Wave(volatile uint8_t * data_buffer);
 uint16_t LUT_MakePulse(uint16_t base, uint16_t pulse, uint16_t ca_period_ms);
-uint16_t LUT_make_line(uint16_t start, uint16_t end, uint16_t index);
+uint16_t LUT_StartTable(void);
+uint16_t LUT_PlayTable(const uint16_t table[], uint16_t length);
+uint16_t LUT_Value(uint16_t index);
+uint16_t LUT_ScanRate(uint8_t scan_rate_byte);
+uint8_t LUT_LevelsPerStep(uint16_t scan_rate);
+uint8_t LUT_Levels(void);
+uint16_t LUT_make_line(uint16_t start, uint16_t end, uint16_t index, uint8_t levels);
 uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc,
                          uint16_t pulse_height, uint16_t index);
 
@@ -32,7 +38,7 @@ uint16_t LUT_make_swv_line(uint16_t start, uint16_t end, uint16_t pulse_inc,
 // these should be deleted from here and left just as global variables, let's see if it works this way 
 
 extern uint16_t lut_value;  // value we need to load DAC
-volatile extern uint16_t waveform_lut[MAX_LUT_SIZE+5]; // look up table
+volatile extern uint16_t *waveform_lut; // look up table, in the memory arena
 extern uint16_t dac_ground_value;  // value to load in the DAC -> why is is defined both in globals and in the 
 extern uint16_t lut_length;
 
@@ -0,0 +1,230 @@
+/*******************************************************************************
+* File Name: params_management.c
+*
+* Description:
+*  Load, check and save the parameters structure kept in the EEPROM.
+*  One bulk read at power on, whole row writes only for the rows that changed
+*********************************************************************************/
+
+#include "params_management.h"
+#include "string.h"
+
+params_t params;
+
+static uint8_t params_dirty;
+static params_listener_t params_listeners[PARAMS_MAX_LISTENERS];
+static uint8_t params_listeners_number;
+
+/***************************************
+* Forward function references
+***************************************/
+static uint16_t params_crc(const uint8_t *data, uint16_t length);
+static void params_read_eeprom(uint8_t *destination, uint16_t address, uint16_t length);
+
+/******************************************************************************
+* Function Name: params_Load
+*******************************************************************************
+*
+* Summary:
+*  Copy the parameters structure from the EEPROM to the RAM shadow with a single
+*  bulk read. If the version or the CRC are wrong (first power on, old EEPROM
+*  layout, corrupted data) the default values are loaded and saved
+*
+* Global variables:
+*  params: RAM shadow of the EEPROM
+*
+*******************************************************************************/
+
+void params_Load(void) {
+    params_read_eeprom((uint8_t *)&params, PARAMS_FIRST_ROW*CYDEV_EEPROM_ROW_SIZE, sizeof(params_t));
+
+    if (params.version != PARAMS_VERSION ||
+        params.crc != params_crc((uint8_t *)&params, offsetof(params_t, crc))) {
+        params_SetDefaults();
+        params_Commit();
+    }
+    params_dirty = false;
+    params_Notify();
+}
+
+/******************************************************************************
+* Function Name: params_SetDefaults
+*******************************************************************************
+*
+* Summary:
+*  Fill the RAM shadow with the default values found during the calibration,
+*  the user values start equal to the default ones
+*
+*******************************************************************************/
+
+void params_SetDefaults(void) {
+    memset(&params, 0, sizeof(params_t));
+    params.version = PARAMS_VERSION;
+    params.voltage_source = VDAC_IS_VDAC;
+
+    params.cv_default.scan_rate = SCAN_RATE_DEFAULT;
+    params.cv_default.start     = START_DEFAULT;
+    params.cv_default.end       = END_DEFAULT;
+    params.cv_default.increment = INCREMENT_DEFAULT;
+    params.cv_default.height    = HEIGH_DEFAULT;
+    params.ca_default.pulse_voltage = V_DEFAULT;
+    params.ca_default.period        = CA_PERIOD_DEFAULT;
+
+    params.glucose.slope_q16     = GLUCOSE_SLOPE_DEFAULT;
+    params.glucose.intercept_q16 = GLUCOSE_INTERCEPT_DEFAULT;
+    params.glucose.sample_index  = GLUCOSE_SAMPLE_DEFAULT;
+    params.glucose.window_half   = GLUCOSE_WINDOW_DEFAULT;
+
+    params.cv_user = params.cv_default;
+    params.ca_user = params.ca_default;
+    params_dirty = true;
+}
+
+/******************************************************************************
+* Function Name: params_MarkDirty
+*******************************************************************************
+*
+* Summary:
+*  To be called after changing a field of params, so that params_Commit()
+*  saves it. The listeners are notified of the change
+*
+*******************************************************************************/
+
+void params_MarkDirty(void) {
+    params_dirty = true;
+    params_Notify();
+}
+
+/******************************************************************************
+* Function Name: params_AddListener
+*******************************************************************************
+*
+* Summary:
+*  Register a function that keeps in RAM a value derived from params (e.g. the
+*  DAC resolution). It is called by params_Notify() after every change, so the
+*  measurement paths never have to look at the EEPROM
+*
+* Parameters:
+*  params_listener_t listener: function to call, added only once
+*
+*******************************************************************************/
+
+void params_AddListener(params_listener_t listener) {
+    for (uint8_t i = 0; i < params_listeners_number; i++) {
+        if (params_listeners[i] == listener) {
+            return;
+        }
+    }
+    if (params_listeners_number < PARAMS_MAX_LISTENERS) {
+        params_listeners[params_listeners_number++] = listener;
+    }
+}
+
+/******************************************************************************
+* Function Name: params_Notify
+*******************************************************************************
+*
+* Summary:
+*  Call all the registered listeners, done after the load and every time
+*  params_MarkDirty() is called
+*
+*******************************************************************************/
+
+void params_Notify(void) {
+    for (uint8_t i = 0; i < params_listeners_number; i++) {
+        params_listeners[i]();
+    }
+}
+
+/******************************************************************************
+* Function Name: params_Commit
+*******************************************************************************
+*
+* Summary:
+*  Update the CRC and write back to the EEPROM the rows of the shadow that are
+*  different from the EEPROM content. Nothing is done if the shadow is clean
+*
+* Return:
+*  CYRET_SUCCESS or the error of EEPROM_Write()
+*
+*******************************************************************************/
+
+cystatus params_Commit(void) {
+    uint8_t row_data[CYDEV_EEPROM_ROW_SIZE];
+    uint8_t eeprom_data[CYDEV_EEPROM_ROW_SIZE];
+    cystatus status = CYRET_SUCCESS;
+
+    if (!params_dirty) {
+        return CYRET_SUCCESS;
+    }
+    params.crc = params_crc((uint8_t *)&params, offsetof(params_t, crc));
+
+    EEPROM_Start();
+    CyDelayUs(10);
+    EEPROM_UpdateTemperature();
+
+    for (uint8_t row = 0; row < PARAMS_ROWS; row++) {
+        uint16_t offset = row*CYDEV_EEPROM_ROW_SIZE;
+        uint16_t length = sizeof(params_t) - offset;
+        if (length > CYDEV_EEPROM_ROW_SIZE) {
+            length = CYDEV_EEPROM_ROW_SIZE;
+        }
+        memset(row_data, 0, CYDEV_EEPROM_ROW_SIZE);
+        memcpy(row_data, ((uint8_t *)&params) + offset, length);
+
+        params_read_eeprom(eeprom_data, (PARAMS_FIRST_ROW+row)*CYDEV_EEPROM_ROW_SIZE, CYDEV_EEPROM_ROW_SIZE);
+        if (memcmp(row_data, eeprom_data, CYDEV_EEPROM_ROW_SIZE) != 0) {
+            status = EEPROM_Write(row_data, PARAMS_FIRST_ROW+row);
+            if (status != CYRET_SUCCESS) {
+                break;
+            }
+        }
+    }
+    EEPROM_Stop();
+
+    if (status == CYRET_SUCCESS) {
+        params_dirty = false;
+    }
+    return status;
+}
+
+/******************************************************************************
+* Function Name: params_read_eeprom
+*******************************************************************************
+*
+* Summary:
+*  Bulk copy from the EEPROM, which is mapped in memory. Same access as
+*  EEPROM_ReadByte() but the PHUB is reserved only once
+*
+*******************************************************************************/
+
+static void params_read_eeprom(uint8_t *destination, uint16_t address, uint16_t length) {
+    uint8_t interrupt_state = CyEnterCriticalSection();
+    CyEEPROM_ReadReserve();
+    memcpy(destination, (const void *)(CYDEV_EE_BASE + address), length);
+    CyEEPROM_ReadRelease();
+    CyExitCriticalSection(interrupt_state);
+}
+
+/******************************************************************************
+* Function Name: params_crc
+*******************************************************************************
+*
+* Summary:
+*  CRC-16 CCITT (polynomial 0x1021, initial value 0xFFFF)
+*
+*******************************************************************************/
+
+static uint16_t params_crc(const uint8_t *data, uint16_t length) {
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* [] END OF FILE */
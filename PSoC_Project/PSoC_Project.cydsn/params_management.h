@@ -0,0 +1,85 @@
+/*******************************************************************************
+* File Name: params_management.h
+*
+* Description:
+*  Parameters saved in the EEPROM as one versioned structure protected by a CRC.
+*  The structure is read once at power on into a RAM shadow (params), the code
+*  reads the parameters from RAM and the EEPROM is written back row by row
+*  only when the shadow has been changed
+*********************************************************************************/
+
+#if !defined(PARAMS_MANAGEMENT_H)
+#define PARAMS_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "stddef.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define PARAMS_VERSION      2   // change it every time params_t is changed, the defaults are reloaded
+#define PARAMS_FIRST_ROW    0   // EEPROM row where the structure starts
+#define PARAMS_MAX_LISTENERS 4  // functions that keep a RAM copy of values derived from params
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef CY_PACKED struct {
+    uint8_t scan_rate;      // mV/s
+    uint8_t start;          // (*10)mV, 2's complement
+    uint8_t end;            // (*10)mV
+    uint8_t increment;      // mV, square wave voltammetry
+    uint8_t height;         // mV, square wave voltammetry
+} CY_PACKED_ATTR cv_defaults_t;
+
+typedef CY_PACKED struct {
+    uint8_t pulse_voltage;  // mV
+    uint8_t period;         // tenths of a second
+} CY_PACKED_ATTR ca_defaults_t;
+
+typedef CY_PACKED struct {
+    int32_t slope_q16;      // mg/dL for each nA, Q16.16
+    int32_t intercept_q16;  // mg/dL, Q16.16
+    uint16_t sample_index;  // sample of the CA where the curve has been calibrated
+    uint8_t window_half;    // samples averaged on each side of sample_index
+} CY_PACKED_ATTR glucose_curve_t;
+
+typedef CY_PACKED struct {
+    uint8_t version;
+    uint8_t voltage_source;         // VDAC_IS_VDAC or VDAC_IS_DVDAC
+    cv_defaults_t cv_default;       // values found during the calibration of the device
+    ca_defaults_t ca_default;
+    cv_defaults_t cv_user;          // values saved by the user from the GUI
+    ca_defaults_t ca_user;
+    glucose_curve_t glucose;        // calibration curve of the glucose
+    uint16_t crc;                   // CRC-16 CCITT of all the previous bytes, must be the last field
+} CY_PACKED_ATTR params_t;
+
+#define PARAMS_ROWS ((sizeof(params_t) + CYDEV_EEPROM_ROW_SIZE - 1) / CYDEV_EEPROM_ROW_SIZE)
+
+typedef void (*params_listener_t)(void); // called every time params is changed
+
+/***************************************
+* Global variables external identifier
+***************************************/
+
+extern params_t params; // RAM shadow of the EEPROM
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+void params_Load(void);
+void params_MarkDirty(void);
+cystatus params_Commit(void);
+void params_SetDefaults(void);
+void params_AddListener(params_listener_t listener);
+void params_Notify(void);
+
+#endif
+
+/* [] END OF FILE */
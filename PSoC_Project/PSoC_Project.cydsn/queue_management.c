@@ -0,0 +1,193 @@
+/*******************************************************************************
+* File Name: queue_management.c
+*
+* Description:
+*  Jobs uploaded by the GUI, kept in RAM in the order they have been added.
+*  The jobs are only stored here, user_queue_prepare() and user_queue_task()
+*  make the look up table of each job and start it
+*********************************************************************************/
+
+#include "queue_management.h"
+
+static queue_job_t queue_jobs[QUEUE_MAX_JOBS];
+static uint8_t queue_length;
+static uint8_t queue_next;      // first job not started yet
+static uint8_t queue_running;
+static uint8_t queue_current;   // id of the last job started
+
+/******************************************************************************
+* Function Name: queue_Add
+*******************************************************************************
+*
+* Summary:
+*  Append a job at the end of the queue, only CHANGE_CV_PARAMETERS and
+*  CHANGE_CA_PARAMETERS commands are accepted. Jobs can't be added while the
+*  queue is running
+*
+* Parameters:
+*  uint8_t id: chosen by the GUI, sent back with the results of the job
+*  uint8 command[]: command of the procedure, QUEUE_COMMAND_SIZE bytes
+*
+* Return:
+*  true if the job has been added
+*
+*******************************************************************************/
+
+uint8_t queue_Add(uint8_t id, volatile uint8_t command[]) {
+    if (queue_running || queue_length >= QUEUE_MAX_JOBS ||
+        (command[0] != CHANGE_CV_PARAMETERS && command[0] != CHANGE_CA_PARAMETERS)) {
+        return false;
+    }
+    queue_jobs[queue_length].id = id;
+    for (uint8_t i = 0; i < QUEUE_COMMAND_SIZE; i++) {
+        queue_jobs[queue_length].command[i] = command[i];
+    }
+    queue_length++;
+    return true;
+}
+
+/******************************************************************************
+* Function Name: queue_Clear
+*******************************************************************************
+*
+* Summary:
+*  Remove all the jobs, a running queue is stopped after the job in progress
+*
+*******************************************************************************/
+
+void queue_Clear(void) {
+    queue_length = 0;
+    queue_next = 0;
+    queue_running = false;
+    queue_current = 0;
+}
+
+/******************************************************************************
+* Function Name: queue_Count
+*******************************************************************************
+*
+* Summary:
+*  Jobs not started yet
+*
+*******************************************************************************/
+
+uint8_t queue_Count(void) {
+    return queue_length - queue_next;
+}
+
+/******************************************************************************
+* Function Name: queue_Start
+*******************************************************************************
+*
+* Summary:
+*  Run the jobs left, from the first one not started. After an abort the queue
+*  goes on from the job after the aborted one
+*
+*******************************************************************************/
+
+void queue_Start(void) {
+    queue_running = (queue_Count() > 0);
+}
+
+/******************************************************************************
+* Function Name: queue_Stop
+*******************************************************************************
+*
+* Summary:
+*  No more jobs are started, the jobs left are kept
+*
+*******************************************************************************/
+
+void queue_Stop(void) {
+    queue_running = false;
+}
+
+/******************************************************************************
+* Function Name: queue_Running
+*******************************************************************************
+*
+* Summary:
+*  true while the jobs are started one after the other
+*
+*******************************************************************************/
+
+uint8_t queue_Running(void) {
+    return queue_running;
+}
+
+/******************************************************************************
+* Function Name: queue_Current
+*******************************************************************************
+*
+* Summary:
+*  Id of the last job started, 0 if the queue is not running
+*
+*******************************************************************************/
+
+uint8_t queue_Current(void) {
+    return queue_running ? queue_current : 0;
+}
+
+/******************************************************************************
+* Function Name: queue_Peek
+*******************************************************************************
+*
+* Summary:
+*  The job that queue_Next() will take, without taking it
+*
+* Return:
+*  the next job of a running queue, NULL if there are no more jobs
+*
+*******************************************************************************/
+
+queue_job_t *queue_Peek(void) {
+    if (!queue_running || queue_next >= queue_length) {
+        return NULL;
+    }
+    return &queue_jobs[queue_next];
+}
+
+/******************************************************************************
+* Function Name: queue_Next
+*******************************************************************************
+*
+* Summary:
+*  Take the next job of a running queue. When all the jobs have been taken the
+*  queue is emptied and stopped
+*
+* Return:
+*  the job to run, NULL if there are no more jobs
+*
+*******************************************************************************/
+
+queue_job_t *queue_Next(void) {
+    if (queue_next >= queue_length) {
+        queue_Clear();
+        return NULL;
+    }
+    queue_current = queue_jobs[queue_next].id;
+    return &queue_jobs[queue_next++];
+}
+
+/******************************************************************************
+* Function Name: queue_SendEvent
+*******************************************************************************
+*
+* Summary:
+*  Send J|event|id|jobs left|Z, used for the answers to the commands and for
+*  the events of the running queue
+*
+*******************************************************************************/
+
+void queue_SendEvent(uint8_t event, uint8_t id) {
+    uint8_t frame[QUEUE_FRAME_SIZE + 1];
+
+    frame[0] = JOB_DATA;
+    frame[1] = event;
+    frame[2] = id;
+    frame[3] = queue_Count();
+    frame[4] = TAIL;
+    UART_BT_PutArray(frame, QUEUE_FRAME_SIZE + 1);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,64 @@
+/*******************************************************************************
+* File Name: queue_management.h
+*
+* Description:
+*  Queue of procedures uploaded by the GUI and run one after the other without
+*  the GUI: every job is the CHANGE_CV_PARAMETERS or CHANGE_CA_PARAMETERS
+*  command of the procedure with an id chosen by the GUI. The look up table of
+*  the next job is made while the previous one is sent, and the job starts as
+*  soon as the sending ends; the results are tagged with the id of the job
+*********************************************************************************/
+
+#if !defined(QUEUE_MANAGEMENT_H)
+#define QUEUE_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define QUEUE_MAX_JOBS          20
+#define QUEUE_COMMAND_SIZE      10  // command of the job without the tail, header included
+#define QUEUE_FRAME_SIZE        4   // header + command or event + id + jobs left
+
+// sub commands of JOB_MANAGEMENT: J|command|data|Z, answer J|command|id|jobs left|Z
+#define QUEUE_ADD               0   // J|0|id|B or C command (10 bytes, no tail)|Z
+#define QUEUE_START             1   // J|1|Z
+#define QUEUE_CLEAR             2   // J|2|Z
+#define QUEUE_STATUS            3   // J|3|Z, id is the job running (0 if none)
+
+// events sent while the queue runs, same frame
+#define QUEUE_JOB_START         4   // before the frames of the job
+#define QUEUE_DONE              5   // all the jobs have been run
+#define QUEUE_ABORTED           6   // job refused (strip) or stopped by the user, the queue is kept
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef struct {
+    uint8_t id;
+    uint8_t command[QUEUE_COMMAND_SIZE];
+} queue_job_t;
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint8_t queue_Add(uint8_t id, volatile uint8_t command[]);
+void queue_Clear(void);
+uint8_t queue_Count(void);
+void queue_Start(void);
+void queue_Stop(void);
+uint8_t queue_Running(void);
+uint8_t queue_Current(void);
+queue_job_t *queue_Peek(void);
+queue_job_t *queue_Next(void);
+void queue_SendEvent(uint8_t event, uint8_t id);
+
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,186 @@
+/*******************************************************************************
+* File Name: strip_management.c
+*
+* Description:
+*  Probe of the strip (open, dry, wet) before a procedure and wait for the
+*  strip to be filled, polled by the main loop while the device is idle
+*********************************************************************************/
+
+#include "strip_management.h"
+#include "hardware_management.h"
+#include "glucose_management.h"
+#include "stdlib.h"
+
+static uint8_t strip_armed;         // a glucose measure is waiting for the sample
+static uint8_t strip_last_state;
+static uint32_t strip_armed_ms;
+static uint32_t strip_last_poll_ms;
+
+/***************************************
+* Forward function references
+***************************************/
+static int16_t strip_read_current(void);
+
+/******************************************************************************
+* Function Name: strip_Probe
+*******************************************************************************
+*
+* Summary:
+*  Classify the strip with a STRIP_PROBE_MV step from the virtual ground,
+*  about 2*STRIP_SETTLE_MS long. With no strip nothing flows; a dry strip
+*  only charges the capacitance of the electrodes, so there is a current just
+*  after the step that goes back to zero; with the sample the current stays.
+*  The hardware must be awake, the DAC is left at the virtual ground
+*
+* Parameters:
+*  int16 *current_nA: steady current of the step, from the current at ground
+*
+* Return:
+*  STRIP_OPEN, STRIP_DRY or STRIP_WET
+*
+*******************************************************************************/
+
+uint8_t strip_Probe(int16_t *current_nA) {
+    TIA_AbortCalibration();  // the probe needs the TIA input
+    ADC_SigDel_StartConvert();
+
+    DAC_SetValue(dac_ground_value);
+    CyDelay(STRIP_SETTLE_MS);
+    int16_t rest = strip_read_current();
+
+    DAC_SetValue(dac_ground_value + STRIP_PROBE_MV/dac_resolution);
+    CyDelay(STRIP_TRANSIENT_MS);
+    int16_t transient = strip_read_current() - rest;
+    CyDelay(STRIP_SETTLE_MS - STRIP_TRANSIENT_MS);
+    int16_t steady = strip_read_current() - rest;
+
+    DAC_SetValue(dac_ground_value);
+    *current_nA = steady;
+
+    if (abs(steady) >= STRIP_WET_NA) {
+        return STRIP_WET;
+    }
+    if (abs(transient) < STRIP_OPEN_NA && abs(steady) < STRIP_OPEN_NA) {
+        return STRIP_OPEN;
+    }
+    return STRIP_DRY;
+}
+
+/******************************************************************************
+* Function Name: strip_SendStatus
+*******************************************************************************
+*
+* Summary:
+*  Send the state of the strip to the GUI:
+*  T|state|current (nA, 2)|waiting|Z, waiting is 1 while the device is still
+*  waiting for the sample
+*
+*******************************************************************************/
+
+void strip_SendStatus(uint8_t state, int16_t current_nA, uint8_t waiting) {
+    uint8_t frame[STRIP_FRAME_SIZE + 1];
+
+    frame[0] = STRIP_DATA;
+    frame[1] = state;
+    frame[2] = (uint16_t)current_nA >> 8;
+    frame[3] = current_nA & 0xFF;
+    frame[4] = waiting;
+    frame[5] = TAIL;
+    UART_BT_PutArray(frame, STRIP_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: strip_Arm
+*******************************************************************************
+*
+* Summary:
+*  Start waiting for the strip to be filled, the look up table of the
+*  procedure must be ready. strip_Task() tells when to start it
+*
+*******************************************************************************/
+
+void strip_Arm(void) {
+    strip_armed = true;
+    strip_last_state = STRIP_WET + 1;  // the first state is always sent
+    strip_armed_ms = helper_Millis();
+    strip_last_poll_ms = strip_armed_ms - STRIP_POLL_MS;
+}
+
+/******************************************************************************
+* Function Name: strip_Disarm
+*******************************************************************************
+*
+* Summary:
+*  Stop waiting for the sample, called when a new command arrives. The
+*  glucose measure that was waiting is dropped
+*
+*******************************************************************************/
+
+void strip_Disarm(void) {
+    if (strip_armed) {
+        strip_armed = false;
+        glucose_request = false;
+    }
+}
+
+/******************************************************************************
+* Function Name: strip_Task
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop while the device is idle. If armed, every
+*  STRIP_POLL_MS the strip is probed and every change of state is sent, so the
+*  GUI can ask to insert the strip or to apply the sample. After
+*  STRIP_WAIT_TIMEOUT_MS without a sample the wait is dropped. No probe while
+*  a TIA calibration requested by the GUI is running
+*
+* Parameters:
+*  uint32_t now_ms: current time from helper_Millis()
+*
+* Return:
+*  true when the strip is wet and the procedure has to be started
+*
+*******************************************************************************/
+
+uint8_t strip_Task(uint32_t now_ms) {
+    int16_t current_nA;
+
+    if (!strip_armed || (uint32_t)(now_ms - strip_last_poll_ms) < STRIP_POLL_MS || TIA_CalibrationRequested()) {
+        return false;
+    }
+    strip_last_poll_ms = now_ms;
+
+    helper_HardwareWakeup();
+    uint8_t state = strip_Probe(&current_nA);
+    helper_HardwareSleep();
+
+    if (state == STRIP_WET) {
+        strip_armed = false;
+        return true;
+    }
+    if ((uint32_t)(now_ms - strip_armed_ms) >= STRIP_WAIT_TIMEOUT_MS) {
+        strip_Disarm();
+        strip_SendStatus(state, current_nA, false);
+    }
+    else if (state != strip_last_state) {
+        strip_SendStatus(state, current_nA, true);
+    }
+    strip_last_state = state;
+    return false;
+}
+
+/******************************************************************************
+* Function Name: strip_read_current
+*******************************************************************************
+*
+* Summary:
+*  Wait for a new conversion and return it in nA
+*
+*******************************************************************************/
+
+static int16_t strip_read_current(void) {
+    ADC_SigDel_IsEndConversion(ADC_SigDel_WAIT_FOR_RESULT);
+    return TIA_CountsToNanoAmps(ADC_SigDel_GetResult16());
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,57 @@
+/*******************************************************************************
+* File Name: strip_management.h
+*
+* Description:
+*  Check of the strip before a procedure: a small step of potential is applied
+*  through the usual DAC - electrode - TIA path and the current tells if the
+*  strip is missing (open circuit), inserted but dry, or filled with the sample.
+*  A run is started only on a wet strip; a glucose measure can also wait for
+*  the strip to be filled and start by itself
+*********************************************************************************/
+
+#if !defined(STRIP_MANAGEMENT_H)
+#define STRIP_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+#include "DAC_management.h"
+#include "TIA_calibrate.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+// 1: user_run_procedure() refuses to start a glucose measure (G command or button) if the strip is not wet
+#define STRIP_CHECK             1
+
+#define STRIP_PROBE_MV          50  // step of potential applied to the cell
+#define STRIP_SETTLE_MS         15  // time at each potential before the current is read
+#define STRIP_TRANSIENT_MS      2   // read of the charging current just after the step
+#define STRIP_OPEN_NA           20  // below this (transient and steady) nothing is connected
+#define STRIP_WET_NA            100 // steady current above this: the sample closes the cell
+
+#define STRIP_POLL_MS           250 // check of the strip while waiting to be filled
+#define STRIP_WAIT_TIMEOUT_MS   120000
+#define STRIP_FRAME_SIZE        5   // header + state + current (2) + waiting
+
+// state of the strip, sent in the STRIP_DATA frame
+#define STRIP_OPEN              0   // no strip inserted
+#define STRIP_DRY               1   // strip inserted, no sample
+#define STRIP_WET               2   // sample applied, the run can start
+
+#define STRIP_WAIT_FILL         1   // G|trace|1|Z waits for the strip to be filled
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint8_t strip_Probe(int16_t *current_nA);
+void strip_SendStatus(uint8_t state, int16_t current_nA, uint8_t waiting);
+void strip_Arm(void);
+void strip_Disarm(void);
+uint8_t strip_Task(uint32_t now_ms);
+
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,137 @@
+/*******************************************************************************
+* File Name: timing_management.c
+*
+* Description:
+*  Phase accumulator that spreads the steps of the look up table over the
+*  fixed ticks of the PWM_isr. timing_Step() is called by the dac isr and
+*  timing_LastTick() by the adc isr, the other functions by the main loop
+*********************************************************************************/
+
+#include "timing_management.h"
+
+static volatile uint32_t timing_phase;
+static uint32_t timing_increment = (uint32_t)(TIMING_PHASE_ONE / 10); // CA default, one step every 10 ms
+
+/******************************************************************************
+* Function Name: timing_ScanIncrement
+*******************************************************************************
+*
+* Summary:
+*  Increment of the phase for a voltammetry: the DAC moves by resolution mV at
+*  each step, so scan_rate/resolution steps are done every second. Rounded to
+*  the nearest unit, scan rates above resolution*TIMING_TICK_HZ are limited to
+*  one step for each tick
+*
+* Parameters:
+*  uint16_t scan_rate: mV/s, 0 is taken as 1
+*  uint8_t resolution: mV for each DAC level
+*
+* Return:
+*  phase added at each tick
+*
+*******************************************************************************/
+
+uint32_t timing_ScanIncrement(uint16_t scan_rate, uint8_t resolution) {
+    uint64_t ticks_per_step = (uint64_t)resolution * TIMING_TICK_HZ; // times scan_rate
+    
+    if (scan_rate == 0) {
+        scan_rate = 1;
+    }
+    uint64_t increment = ((uint64_t)scan_rate * TIMING_PHASE_ONE + ticks_per_step/2) / ticks_per_step;
+    return increment > TIMING_INCREMENT_MAX ? TIMING_INCREMENT_MAX : (uint32_t)increment;
+}
+
+/******************************************************************************
+* Function Name: timing_PeriodIncrement
+*******************************************************************************
+*
+* Summary:
+*  Increment of the phase for a step every period_ms (chronoamperometry),
+*  periods shorter than one tick are limited to one step for each tick
+*
+*******************************************************************************/
+
+uint32_t timing_PeriodIncrement(uint16_t period_ms) {
+    uint64_t ticks = (uint64_t)period_ms * TIMING_TICK_HZ; // times 1000
+    
+    if (ticks == 0) {
+        return TIMING_INCREMENT_MAX;
+    }
+    uint64_t increment = (TIMING_PHASE_ONE * 1000 + ticks/2) / ticks;
+    return increment > TIMING_INCREMENT_MAX ? TIMING_INCREMENT_MAX : (uint32_t)increment;
+}
+
+/******************************************************************************
+* Function Name: timing_Set
+*******************************************************************************
+*
+* Summary:
+*  Set the step rate of the next procedure and the fixed tick of the PWM_isr
+*
+* Parameters:
+*  uint32_t increment: from timing_ScanIncrement() or timing_PeriodIncrement()
+*
+*******************************************************************************/
+
+void timing_Set(uint32_t increment) {
+    timing_increment = increment;
+    
+    PWM_isr_Wakeup();
+    PWM_isr_WriteCompare(TIMING_TICK_PERIOD / 2); // the adc isr is in the middle of the tick
+    PWM_isr_WritePeriod(TIMING_TICK_PERIOD - 1);
+    PWM_isr_Sleep();
+}
+
+/******************************************************************************
+* Function Name: timing_Restart
+*******************************************************************************
+*
+* Summary:
+*  Called before a procedure is started: the first step is done one whole
+*  step after the start, as the following ones
+*
+*******************************************************************************/
+
+void timing_Restart(void) {
+    timing_phase = 0;
+}
+
+/******************************************************************************
+* Function Name: timing_Step
+*******************************************************************************
+*
+* Summary:
+*  Advance the phase by one tick, called at every tick by the dac isr
+*
+* Return:
+*  true if the phase has wrapped: the next value of the LUT has to be applied
+*
+*******************************************************************************/
+
+uint8_t timing_Step(void) {
+    uint32_t previous = timing_phase;
+    
+    timing_phase = previous + timing_increment;
+    return timing_phase < previous;
+}
+
+/******************************************************************************
+* Function Name: timing_LastTick
+*******************************************************************************
+*
+* Summary:
+*  Called by the adc isr, half a tick after the dac isr: the sample is saved
+*  only in the last tick of the step, when the current has settled the most
+*
+* Return:
+*  true if the next tick applies a new step
+*
+*******************************************************************************/
+
+uint8_t timing_LastTick(void) {
+    uint32_t phase = timing_phase;
+    
+    return (uint32_t)(phase + timing_increment) < phase;
+}
+
+/* [] END OF FILE */
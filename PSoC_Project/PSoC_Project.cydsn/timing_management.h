@@ -0,0 +1,53 @@
+/*******************************************************************************
+* File Name: timing_management.h
+*
+* Description:
+*  Timing of the procedures: the PWM_isr always runs at TIMING_TICK_HZ and a
+*  32 bit phase accumulator (as in a DDS) decides at which ticks the next
+*  value of the look up table is applied. The increment of the phase is the
+*  fraction of step done in one tick, so the average step rate is exact
+*  (error below half a unit of the increment, 2 parts in 10^6 at 1 mV/s with
+*  the 1 kHz tick) for any scan rate, instead of being rounded to a whole
+*  number of PWM periods. A step lasts at least one tick, so the step rate is
+*  capped at TIMING_TICK_HZ: faster linear CVs make steps of more DAC levels
+*  (LUT_LevelsPerStep()). The tick can be raised at build time (e.g.
+*  -DTIMING_TICK_HZ=4000), the cost is an idle tick of the two isrs more often.
+*  The rates are checked on the host by tests/test_timing.c
+*********************************************************************************/
+
+#if !defined(TIMING_MANAGEMENT_H)
+#define TIMING_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#if !defined(TIMING_TICK_HZ)
+#define TIMING_TICK_HZ          1000    // the dac isr runs every 1 ms, at most one step for each tick
+#endif
+#define TIMING_TICK_MAX_HZ      20000   // 1200 bus clocks for each tick, the isrs take a few hundred
+#define TIMING_TICK_PERIOD      (FREQ_CLOCK_PWM/TIMING_TICK_HZ) // PWM_isr counts of one tick
+#define TIMING_PHASE_ONE        (1ULL << 32) // one step of the look up table
+#define TIMING_INCREMENT_MAX    0xFFFFFFFFu  // one step for each tick, the hardware limit
+
+_Static_assert(FREQ_CLOCK_PWM % TIMING_TICK_HZ == 0, "the tick must be a whole number of PWM_isr counts");
+_Static_assert(TIMING_TICK_HZ <= TIMING_TICK_MAX_HZ, "the isrs would not fit in one tick");
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint32_t timing_ScanIncrement(uint16_t scan_rate, uint8_t resolution);
+uint32_t timing_PeriodIncrement(uint16_t period_ms);
+void timing_Set(uint32_t increment);
+void timing_Restart(void);
+uint8_t timing_Step(void);
+uint8_t timing_LastTick(void);
+
+#endif
+
+/* [] END OF FILE */
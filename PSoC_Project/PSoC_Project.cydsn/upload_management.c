@@ -0,0 +1,432 @@
+/*******************************************************************************
+* File Name: upload_management.c
+*
+* Description:
+*  Chunks of the waveform uploaded by the GUI, decoded straight in
+*  waveform_lut, and copy of the waveform in the EEPROM
+*********************************************************************************/
+
+#include "upload_management.h"
+#include "parametric_lut.h"
+#include "params_management.h"
+#include "journal_management.h"
+#include "timing_management.h"
+#include "watchdog_management.h"
+#include "DAC_management.h"
+#include "BT_protocols.h"
+#include "string.h"
+
+_Static_assert(PARAMS_FIRST_ROW + PARAMS_ROWS <= UPLOAD_FIRST_ROW, "the uploaded waveform overlaps the parameters");
+
+static uint8_t upload_state = UPLOAD_IDLE;
+static uint8_t upload_parameters[JOURNAL_PARAMS_SIZE]; // begin command, saved in the journal
+static uint8_t upload_store;
+static uint8_t upload_sequence;         // next chunk expected
+static uint16_t upload_entries;         // values announced by the begin
+static uint16_t upload_received;        // values decoded
+static uint16_t upload_previous;        // last value decoded, the deltas are relative to it
+static uint16_t upload_rate;            // steps per second
+static uint16_t upload_max;             // DAC_MaxValue() when the upload started
+
+/***************************************
+* Forward function references
+***************************************/
+static uint8_t upload_begin(const uint8_t frame[], uint8_t length);
+static uint8_t upload_chunk(const uint8_t frame[], uint8_t length);
+static uint8_t upload_end(void);
+static uint8_t upload_load(void);
+static void upload_select(void);
+static uint8_t upload_save(void);
+static uint8_t upload_decode(const uint8_t values[], uint16_t length);
+static uint8_t upload_encode_token(uint16_t *index, uint16_t *previous, uint8_t token[]);
+static uint8_t upload_crc8(const uint8_t *data, uint16_t length, uint8_t crc);
+static void upload_send_status(uint8_t command, uint8_t status);
+
+/******************************************************************************
+* Function Name: upload_Command
+*******************************************************************************
+*
+* Summary:
+*  UPLOAD_WAVEFORM command: U|command|data|Z. The frame is copied at once, so
+*  that the RX isr can collect the next chunk, then it is checked and the
+*  answer U|command|status|sequence|entries received (2)|Z is sent. sequence
+*  is the next chunk expected: with an error the GUI sends again from it
+*
+* Parameters:
+*  uint8 data_buffer[]: command received from the BT
+*
+*******************************************************************************/
+
+void upload_Command(volatile uint8_t data_buffer[]) {
+    uint8_t frame[DATA_MAX_READING_SIZE];
+    uint8_t length = BT_Unescape(data_buffer, frame);
+    uint8_t status = UPLOAD_ERR_FORMAT;
+
+    if (length == 0) {
+        frame[0] = UPLOAD_CHUNK;
+    } else if (frame[0] == UPLOAD_BEGIN) {
+        status = upload_begin(frame, length);
+    } else if (frame[0] == UPLOAD_CHUNK) {
+        status = upload_chunk(frame, length);
+    } else if (frame[0] == UPLOAD_END) {
+        status = upload_end();
+    } else if (frame[0] == UPLOAD_LOAD) {
+        status = upload_load();
+    }
+    upload_send_status(frame[0], status);
+}
+
+/******************************************************************************
+* Function Name: upload_begin
+*******************************************************************************
+*
+* Summary:
+*  U|0|entries (2)|step rate (Hz, 2)|store|Z: give the arena to the new
+*  waveform. The LUT of the previous procedure is lost
+*
+*******************************************************************************/
+
+static uint8_t upload_begin(const uint8_t frame[], uint8_t length) {
+    if (length < 6) {
+        return UPLOAD_ERR_FORMAT;
+    }
+    swv_mode = SWV_SEND_RAW;
+    cv_cycles = 1;
+    cv_send_last_cycle = false;
+    lut_length = 0;
+    upload_state = UPLOAD_IDLE;
+
+    upload_entries = (frame[1] << 8) | frame[2];
+    if (upload_entries == 0 || upload_entries > LUT_StartTable()) {
+        return UPLOAD_ERR_SIZE;
+    }
+    upload_rate = (frame[3] << 8) | frame[4];
+    upload_store = frame[5];
+
+    memset(upload_parameters, 0, JOURNAL_PARAMS_SIZE);
+    upload_parameters[0] = UPLOAD_WAVEFORM;
+    memcpy(&upload_parameters[1], frame, 6);
+    upload_received = 0;
+    upload_previous = 0;
+    upload_max = DAC_MaxValue();
+    upload_sequence = 0;
+    upload_state = UPLOAD_RECEIVING;
+    return UPLOAD_OK;
+}
+
+/******************************************************************************
+* Function Name: upload_chunk
+*******************************************************************************
+*
+* Summary:
+*  U|1|sequence|encoded values|CRC-8|Z: only the chunk expected is decoded,
+*  a chunk refused leaves the values received before it unchanged
+*
+*******************************************************************************/
+
+static uint8_t upload_chunk(const uint8_t frame[], uint8_t length) {
+    if (upload_state != UPLOAD_RECEIVING) {
+        return UPLOAD_ERR_STATE;
+    }
+    if (length < 3 || upload_crc8(&frame[1], length - 2, 0) != frame[length - 1]) {
+        return UPLOAD_ERR_CRC;
+    }
+    if (frame[1] != upload_sequence) {
+        return UPLOAD_ERR_SEQUENCE;
+    }
+    uint8_t status = upload_decode(&frame[2], length - 3);
+    if (status == UPLOAD_OK) {
+        upload_sequence++;
+    }
+    return status;
+}
+
+/******************************************************************************
+* Function Name: upload_end
+*******************************************************************************
+*
+* Summary:
+*  U|2|Z: with all the values received the waveform is set, and saved in the
+*  EEPROM if asked by the begin. The run is started with RUN_CV
+*
+*******************************************************************************/
+
+static uint8_t upload_end(void) {
+    if (upload_state != UPLOAD_RECEIVING || upload_received != upload_entries) {
+        return UPLOAD_ERR_STATE;
+    }
+    upload_state = UPLOAD_IDLE;
+    upload_select();
+    if (upload_store == UPLOAD_STORE_EEPROM) {
+        return upload_save();
+    }
+    return UPLOAD_OK;
+}
+
+/******************************************************************************
+* Function Name: upload_load
+*******************************************************************************
+*
+* Summary:
+*  U|3|Z: decode the waveform saved in the EEPROM in waveform_lut and set it.
+*  data_long, free while no procedure runs, holds the encoded values
+*
+*******************************************************************************/
+
+static uint8_t upload_load(void) {
+    uint8_t header[8];
+
+    upload_state = UPLOAD_IDLE;
+    for (uint8_t i = 0; i < sizeof(header); i++) {
+        header[i] = EEPROM_ReadByte(UPLOAD_FIRST_ROW*CYDEV_EEPROM_ROW_SIZE + i);
+    }
+    uint16_t bytes = (header[5] << 8) | header[6];
+    if (header[0] != UPLOAD_EEPROM_VERSION || bytes > UPLOAD_EEPROM_BYTES) {
+        return UPLOAD_ERR_EEPROM;
+    }
+
+    swv_mode = SWV_SEND_RAW;
+    cv_cycles = 1;
+    cv_send_last_cycle = false;
+    lut_length = 0;
+    upload_entries = (header[1] << 8) | header[2];
+    if (upload_entries == 0 || upload_entries > LUT_StartTable() || bytes > data_long_size) {
+        return UPLOAD_ERR_SIZE;
+    }
+    for (uint16_t i = 0; i < bytes; i++) {
+        data_long[i] = EEPROM_ReadByte((UPLOAD_FIRST_ROW + 1)*CYDEV_EEPROM_ROW_SIZE + i);
+    }
+    if (upload_crc8((const uint8_t *)data_long, bytes, 0) != header[7]) {
+        return UPLOAD_ERR_CRC;
+    }
+
+    upload_received = 0;
+    upload_previous = 0;
+    upload_max = DAC_MaxValue();  // saved with the other voltage source
+    uint8_t status = upload_decode((const uint8_t *)data_long, bytes);
+    memset((uint8_t *)data_long, 0, bytes);
+    if (status == UPLOAD_ERR_RANGE) {
+        return status;
+    }
+    if (status != UPLOAD_OK || upload_received != upload_entries) {
+        return UPLOAD_ERR_EEPROM;
+    }
+    upload_rate = (header[3] << 8) | header[4];
+    memset(upload_parameters, 0, JOURNAL_PARAMS_SIZE);
+    upload_parameters[0] = UPLOAD_WAVEFORM;
+    upload_parameters[1] = UPLOAD_LOAD;
+    memcpy(&upload_parameters[2], &header[1], 4);  // entries and rate
+    upload_select();
+    return UPLOAD_OK;
+}
+
+/******************************************************************************
+* Function Name: upload_select
+*******************************************************************************
+*
+* Summary:
+*  Set the waveform in waveform_lut as the next procedure, sampled and sent
+*  as a CV
+*
+*******************************************************************************/
+
+static void upload_select(void) {
+    journal_SetParameters(upload_parameters);
+    procedure_type = CHANGE_CV_PARAMETERS;
+    timing_Set(timing_ScanIncrement(upload_rate, 1));  // upload_rate steps of one "mV" each second
+    lut_length = upload_entries;
+    lut_value = LUT_Value(0);
+}
+
+/******************************************************************************
+* Function Name: upload_save
+*******************************************************************************
+*
+* Summary:
+*  Encode waveform_lut again and write it in the EEPROM rows after
+*  UPLOAD_FIRST_ROW, which holds the header: version, entries (2), step rate
+*  (2), encoded bytes (2), CRC-8 of the encoded bytes. Nothing is written if
+*  the waveform does not fit
+*
+*******************************************************************************/
+
+static uint8_t upload_save(void) {
+    uint8_t row[CYDEV_EEPROM_ROW_SIZE];
+    uint8_t token[2];
+    uint16_t index = 0;
+    uint16_t previous = 0;
+    uint16_t bytes = 0;
+    uint8_t crc = 0;
+
+    while (index < upload_entries) {  // size and CRC first
+        uint8_t token_length = upload_encode_token(&index, &previous, token);
+        crc = upload_crc8(token, token_length, crc);
+        bytes += token_length;
+    }
+    if (bytes > UPLOAD_EEPROM_BYTES) {
+        return UPLOAD_ERR_EEPROM;
+    }
+
+    EEPROM_Start();
+    CyDelayUs(10);
+    EEPROM_UpdateTemperature();
+    uint8_t outer_block = watchdog_BlockBegin(WATCHDOG_EEPROM);  // up to 120 rows, a few ms each
+
+    memset(row, 0, sizeof(row));
+    row[0] = UPLOAD_EEPROM_VERSION;
+    row[1] = upload_entries >> 8;
+    row[2] = upload_entries & 0xFF;
+    row[3] = upload_rate >> 8;
+    row[4] = upload_rate & 0xFF;
+    row[5] = bytes >> 8;
+    row[6] = bytes & 0xFF;
+    row[7] = crc;
+    cystatus status = EEPROM_Write(row, UPLOAD_FIRST_ROW);
+
+    uint8_t row_number = UPLOAD_FIRST_ROW + 1;
+    uint8_t used = 0;
+    index = 0;
+    previous = 0;
+    memset(row, 0, sizeof(row));
+    while (index < upload_entries && status == CYRET_SUCCESS) {
+        uint8_t token_length = upload_encode_token(&index, &previous, token);
+        for (uint8_t i = 0; i < token_length; i++) {
+            row[used++] = token[i];
+            if (used == CYDEV_EEPROM_ROW_SIZE) {
+                status = EEPROM_Write(row, row_number++);
+                watchdog_CheckIn(WATCHDOG_EEPROM);
+                used = 0;
+                memset(row, 0, sizeof(row));
+            }
+        }
+    }
+    if (used && status == CYRET_SUCCESS) {
+        status = EEPROM_Write(row, row_number);
+    }
+    watchdog_BlockEnd(outer_block);
+    EEPROM_Stop();
+    return status == CYRET_SUCCESS ? UPLOAD_OK : UPLOAD_ERR_EEPROM;
+}
+
+/******************************************************************************
+* Function Name: upload_decode
+*******************************************************************************
+*
+* Summary:
+*  Decode the tokens in waveform_lut after the values already received. With
+*  an error nothing is taken, the next chunk starts again from the same place.
+*  The values are checked against upload_max, the DAC would truncate them
+*
+*******************************************************************************/
+
+static uint8_t upload_decode(const uint8_t values[], uint16_t length) {
+    uint16_t received = upload_received;
+    uint16_t previous = upload_previous;
+
+    for (uint16_t i = 0; i < length; i++) {
+        uint8_t token = values[i];
+        uint8_t count = 1;
+
+        if (!(token & 0x80)) {
+            previous += (int8_t)(token << 1) >> 1;  // 7 bit signed delta
+        } else if ((token & 0xC0) == UPLOAD_TOKEN_REPEAT) {
+            count = (token & 0x3F) + 1;
+        } else if ((token & 0xF0) == UPLOAD_TOKEN_ABSOLUTE && i + 1 < length) {
+            previous = ((token & 0x0F) << 8) | values[++i];
+        } else {
+            return UPLOAD_ERR_FORMAT;
+        }
+        if (received + count > upload_entries) {
+            return UPLOAD_ERR_SIZE;
+        }
+        if (previous > upload_max) {  // also a delta below 0, which wraps
+            return UPLOAD_ERR_RANGE;
+        }
+        while (count--) {
+            waveform_lut[received++] = previous;
+        }
+    }
+    upload_received = received;
+    upload_previous = previous;
+    return UPLOAD_OK;
+}
+
+/******************************************************************************
+* Function Name: upload_encode_token
+*******************************************************************************
+*
+* Summary:
+*  Encoding of the GUI, to save the waveform: the token of waveform_lut[*index],
+*  a run of the previous value, a delta or an absolute value
+*
+* Return:
+*  bytes of the token (1 or 2)
+*
+*******************************************************************************/
+
+static uint8_t upload_encode_token(uint16_t *index, uint16_t *previous, uint8_t token[]) {
+    uint16_t value = waveform_lut[*index];
+    int16_t delta = (int16_t)(value - *previous);
+
+    if (*index > 0 && delta == 0) {
+        uint8_t run = 1;
+        while (run < 64 && *index + run < upload_entries && waveform_lut[*index + run] == value) {
+            run++;
+        }
+        *index += run;
+        token[0] = UPLOAD_TOKEN_REPEAT | (run - 1);
+        return 1;
+    }
+    *index += 1;
+    *previous = value;
+    if (delta >= -64 && delta <= 63) {
+        token[0] = delta & 0x7F;
+        return 1;
+    }
+    token[0] = UPLOAD_TOKEN_ABSOLUTE | ((value >> 8) & 0x0F);
+    token[1] = value & 0xFF;
+    return 2;
+}
+
+/******************************************************************************
+* Function Name: upload_crc8
+*******************************************************************************
+*
+* Summary:
+*  CRC-8 (polynomial 0x07), continued from crc
+*
+*******************************************************************************/
+
+static uint8_t upload_crc8(const uint8_t *data, uint16_t length, uint8_t crc) {
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/******************************************************************************
+* Function Name: upload_send_status
+*******************************************************************************
+*
+* Summary:
+*  U|command|status|sequence|entries received (2)|Z
+*
+*******************************************************************************/
+
+static void upload_send_status(uint8_t command, uint8_t status) {
+    uint8_t frame[UPLOAD_FRAME_SIZE + 1];
+
+    frame[0] = UPLOAD_DATA;
+    frame[1] = command;
+    frame[2] = status;
+    frame[3] = upload_sequence;
+    frame[4] = upload_received >> 8;
+    frame[5] = upload_received & 0xFF;
+    frame[6] = TAIL;
+    UART_BT_PutArray(frame, UPLOAD_FRAME_SIZE + 1);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,70 @@
+/*******************************************************************************
+* File Name: upload_management.h
+*
+* Description:
+*  Upload of an arbitrary waveform from the GUI. The DAC values arrive in
+*  chunks that fit in one command, each with a sequence number and a CRC-8,
+*  encoded with deltas, runs and absolute values. The GUI does not wait for
+*  the answer of a chunk before sending the next one: the RX isr queues up to
+*  RX_FRAMES chunks, and while it collects chunk N+1 the main decodes chunk N
+*  in the arena, a lost or
+*  corrupted chunk is refused with its sequence number and the GUI sends
+*  again from there. The waveform is played at the step rate given at the
+*  begin, and can be saved in the EEPROM after the parameters
+*********************************************************************************/
+
+#if !defined(UPLOAD_MANAGEMENT_H)
+#define UPLOAD_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+// sub commands of UPLOAD_WAVEFORM: U|command|data|Z, everything after the header is escaped
+#define UPLOAD_BEGIN            0   // U|0|entries (2)|step rate (Hz, 2)|store|Z
+#define UPLOAD_CHUNK            1   // U|1|sequence|encoded values|CRC-8 of sequence and values|Z
+#define UPLOAD_END              2   // U|2|Z, the waveform is set for RUN_CV (saved if asked at the begin)
+#define UPLOAD_LOAD             3   // U|3|Z, set the waveform saved in the EEPROM
+
+#define UPLOAD_STORE_RAM        0   // the waveform is lost at the next procedure
+#define UPLOAD_STORE_EEPROM     1   // saved also in the EEPROM, set again with UPLOAD_LOAD
+
+// status of the answer U|command|status|sequence|entries received (2)|Z
+#define UPLOAD_OK               0
+#define UPLOAD_ERR_CRC          1   // chunk corrupted
+#define UPLOAD_ERR_SEQUENCE     2   // not the chunk expected (one has been lost), send again from sequence
+#define UPLOAD_ERR_FORMAT       3   // unknown token in the values
+#define UPLOAD_ERR_SIZE         4   // more values than announced, or than the arena holds
+#define UPLOAD_ERR_STATE        5   // no upload in progress, or not all the values received
+#define UPLOAD_ERR_EEPROM       6   // the waveform is too long for the EEPROM, or the write failed
+#define UPLOAD_ERR_RANGE        7   // a value above DAC_MaxValue() of the voltage source selected
+
+// encoding of the values, the first token is relative to 0
+#define UPLOAD_TOKEN_DELTA      0x00 // 0ddddddd: previous value + d (-64..63)
+#define UPLOAD_TOKEN_REPEAT     0x80 // 10nnnnnn: previous value n+1 more times
+#define UPLOAD_TOKEN_ABSOLUTE   0xC0 // 1100vvvv vvvvvvvv: 12 bit value, the two bytes in the same chunk
+
+#define UPLOAD_FRAME_SIZE       6    // header + command + status + sequence + entries (2)
+
+// state of the upload
+#define UPLOAD_IDLE             0
+#define UPLOAD_RECEIVING        1   // begin received, waiting for the chunks
+
+#define UPLOAD_FIRST_ROW        8    // EEPROM row of the header of the saved waveform, after the parameters
+#define UPLOAD_EEPROM_VERSION   1
+// encoded values saved after the header, in the rows left in the EEPROM (the last one is the watchdog report)
+#define UPLOAD_EEPROM_BYTES     ((CYDEV_EE_SIZE/CYDEV_EEPROM_ROW_SIZE - UPLOAD_FIRST_ROW - 2)*CYDEV_EEPROM_ROW_SIZE)
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+void upload_Command(volatile uint8_t data_buffer[]);
+
+#endif
+
+/* [] END OF FILE */
@@ -12,6 +12,7 @@
 
 #include <project.h>
 #include "stdio.h"  // gets rid of the type errors
+#include "string.h"
 
 #include "user_inputs.h"
 
@@ -110,6 +111,8 @@ void user_voltage_source_funcs(uint8_t data_buffer[]) {
 *  Start a cyclic voltammetry experiment.  The look up table in waveform_lut should
 *  already be created.  If the dac isr is already running this will not start and throws
 *  and error through the USB.  
+*  While a TIA calibration requested by the GUI is running the procedure is
+*  refused with an empty STOPPED_DATA frame (no measure follows)
 *  
 * Global variables:
 *  uint16_t lut_value: value gotten from the look up table that is to be applied to the DAC
@@ -126,13 +129,32 @@ void user_voltage_source_funcs(uint8_t data_buffer[]) {
 *******************************************************************************/
 
 void user_run_procedure(void){
+    if (TIA_CalibrationRequested()) { // the GUI waits for the new fit, the sweep is not dropped
+        sendStopped(0);
+        glucose_request = false;
+        return;
+    }
+    TIA_AbortCalibration(); // the procedure needs the PWM_isr tick and the TIA input
     helper_HardwareWakeup(); 
-    if (!isr_dac_GetState()){  // enable the dac isr if it isnt already enabled
+    if (!isr_dac_GetState() && !procedure_ended){  // enable the dac isr if it isnt already enabled (and the last measure has been sent)
+#if (STRIP_CHECK)
+        int16_t strip_current;
+        uint8_t strip_state = glucose_request ? strip_Probe(&strip_current) : STRIP_WET;  // only a glucose measure needs the sample
+        if (strip_state != STRIP_WET) {  // no strip or no sample: nothing to measure, the run is refused
+            strip_SendStatus(strip_state, strip_current, false);
+            glucose_request = false;
+            helper_HardwareSleep();
+            return;
+        }
+#endif
         if (isr_adcAmp_GetState()) {  // User has started cyclic voltammetry while amp is already running so disable amperometry
             isr_adcAmp_Disable();
         }
         lut_index = 0;  // start at the beginning of the look up table
-        lut_value = waveform_lut[0];
+        lut_value = LUT_Value(0);
+        timing_Restart();
+        DAC_ProfileStart(LUT_Levels());
+        TIA_RangeStart();  // start from the calibrated resistor
         
         
         helper_HardwareWakeup();  // start the hardware
@@ -145,12 +167,24 @@ void user_run_procedure(void){
         CyDelay(10);
    
         
-        int16 measure = ADC_SigDel_GetResult16(); 
-        
-        data_long[lut_index]= measure >> 8;
-        data_long[lut_index+1]= measure & 0xFF;
+        int32_t measure = TIA_CountsToCurrent(ADC_SigDel_GetResult16()); 
+        uint16_t code = TIA_SampleEncode(measure);
         
-        lut_index++; 
+        data_long[0]= code >> 8;
+        data_long[1]= code & 0xFF;
+        if (cv_cycles > 1) {
+            memset(cv_accumulator, 0, 2*data_long_size);  // data_long_size/2 int32
+            cv_accumulator[0] = measure;
+        }
+        swv_steps = 0;
+        cv_cycle = 0;
+        lut_end = lut_length;
+        procedure_stopped = false;
+        glucose_FitStart();
+        watchdog_RunStarted();  // the tick of the dac isr is expected until the end
+        // lut_index stays 0: the first dac isr applies waveform_lut[0] again, so that the
+        // adc isr always saves at lut_index the answer to waveform_lut[lut_index-1]
+        // (waveform_lut[1] was skipped and the square wave steps were out of pair)
         
         isr_dac_Enable();  // enable the interrupts to start the dac
         isr_adc_Enable();  // and the adc
@@ -181,6 +215,7 @@ void user_reset_device(void) {
     isr_adc_Disable();
     isr_adcAmp_Disable();
     helper_HardwareSleep();
+    watchdog_RunEnded();
     
     lut_index = 0;  
 }
@@ -190,37 +225,30 @@ void user_reset_device(void) {
 *******************************************************************************
 *
 * Summary:
-*  Set the PWM that is used as the isr timer
+*  Set the step rate of the CV from the scan rate: the PWM that is used as the
+*  isr timer runs at the fixed tick and the phase accumulator of
+*  timing_management.c makes the steps every dac_resolution/scan_rate seconds
+*  on average
 * 
 * Parameters:
-*  uint8 data_buffer[]: array of chars used to setup the DAC or to read the DAC settings
-*  input is T|XXXXX
-*  XXXXX - uint16_t with the number to put in the period register
-*  the compare register will be loaded with XXXXX / 2
+*  uint8 data_buffer[]: CHANGE_CV_PARAMETERS command, byte 1 is the scan rate
+*  (mV/s, or tens of mV/s with SCAN_RATE_FAST) and byte 4 the type of CV
 *  
 * Return:
-*  Set the compare and period register of the pwm 
+*  None
 *
 *******************************************************************************/
 
 
 void user_set_isr_timer(volatile uint8_t data_buffer[]) {
-    PWM_isr_Wakeup();
-    uint16_t scan_rate = data_buffer[1];  //arriva il valore di scan rate
-    uint16_t resolution_dac=1;
-    
-    uint8_t voltage_source = helper_check_voltage_source();
-    
-    if(voltage_source){
-       resolution_dac = 16;
+    uint16_t scan_rate = LUT_ScanRate(data_buffer[1]);  //arriva il valore di scan rate
+    uint8_t levels = 1;
+    if (!data_buffer[4]) { // the fast linear CV makes larger steps, see LUT_MakeTriangle_Wave()
+        levels = LUT_LevelsPerStep(scan_rate);
     }
-    else if(voltage_source==2){
-       resolution_dac = 1;
-    }
-    uint16_t timer_period = (resolution_dac/scan_rate)*FREQ_CLOCK_PWM;
-    PWM_isr_WriteCompare((uint16_t)(timer_period / 2));  // not used in amperometry run so just set in the middle
-    PWM_isr_WritePeriod(timer_period-1);
-    PWM_isr_Sleep();
+    
+    // dac_resolution is cached in RAM, updated when the voltage source changes
+    timing_Set(timing_ScanIncrement(scan_rate, dac_resolution*levels));
 }
 
 /******************************************************************************
@@ -240,17 +268,15 @@ void user_set_isr_timer(volatile uint8_t data_buffer[]) {
 *  
 * Global variables:
 *  uint16_t lut_value: value gotten from the look up table that is to be applied to the DAC
-*  uint16_t waveform_lut[]:  look up table of the waveform to apply to the DAC
+*  uint16_t waveform_lut[]:  not used, the pulse is made by LUT_Value()
 *  
 * Return:
-*  4000 - how long the look up table will be
+*  how many steps the CA lasts
 *
 *******************************************************************************/
 
 uint16_t user_chrono_lut_maker(volatile uint8_t data_buffer[]) {
     
-    PWM_isr_Wakeup(); 
-    
     if(!data_buffer[1]){ // data_buffer[1]==0 da il tipo di misura 
         uint16_t ca_period; 
         
@@ -260,35 +286,115 @@ uint16_t user_chrono_lut_maker(volatile uint8_t data_buffer[]) {
     }
     else{
         uint16_t baseline = 0b01111111; // 0V = DAC value equal to 128
-        uint16_t pulse = EEPROM_ReadByte(V_DEFAULT_ADD); 
-        uint16_t ca_period = EEPROM_ReadByte(CA_PERIOD_DEFAULT_ADD); 
+        // RAM copy, no EEPROM access during the measure. The pulse is saved in mV and the period in 
+        // tenths of a second, LUT_MakePulse wants the DAC value and ms
+        uint16_t pulse = baseline + params.ca_default.pulse_voltage / dac_resolution;
+        uint16_t ca_period = params.ca_default.period * 100; 
         lut_length = LUT_MakePulse(baseline, pulse, ca_period);
     }
     
-    //cambio il periodo del PWM utilizzando 10ms (default), leggerò la misura ogni 10ms
-
-    PWM_isr_WriteCompare((uint16_t)(T_PWM_STD_CA / 2));  
-    PWM_isr_WritePeriod((uint16_t) T_PWM_STD_CA - 1);
+    //un passo ogni 10ms (default), leggerò la misura ogni 10ms
+    timing_Set(timing_PeriodIncrement(CA_STEP_MS));
                 
-    lut_value = waveform_lut[0];  // setup the dac so when it starts it will be at the correct voltage
-           
-    PWM_isr_Sleep();
+    lut_value = LUT_Value(0);  // setup the dac so when it starts it will be at the correct voltage
     return lut_length; // ritorna la lunghezza della lut creata (varia in base al tempo in cui il voltaggio è alto)
 }
 
+/******************************************************************************
+* Function Name: user_set_procedure
+*******************************************************************************
+*
+* Summary:
+*  Prepare the procedure of a CHANGE_CV_PARAMETERS or CHANGE_CA_PARAMETERS
+*  command: timer of the PWM and look up table. Used by the commands of the GUI
+*  and by the jobs of the queue
+* 
+* Parameters:
+*  uint8 data_buffer[]: command of the procedure
+*
+*******************************************************************************/
+
+void user_set_procedure(volatile uint8_t data_buffer[]) {
+    journal_SetParameters(data_buffer); // saved with the measure in the journal
+    procedure_type = data_buffer[0];
+    if (procedure_type == CHANGE_CV_PARAMETERS) {
+        user_set_isr_timer(data_buffer);
+        lut_length = LUT_MakeTriangle_Wave(data_buffer);
+    } else {
+        lut_length = user_chrono_lut_maker(data_buffer);
+    }
+}
+
+/******************************************************************************
+* Function Name: user_measure_glucose
+*******************************************************************************
+*
+* Summary:
+*  "Measure Glucose" request: G|trace|wait|Z. Start the CA with the default
+*  values, from the flash library unless the defaults saved on the device are
+*  not the ones of the library (then its pulse is made as usual). When the CA is finished the glucose is computed
+*  on the device and only the glucose frame is sent, the whole measure is sent
+*  after it only if trace is GLUCOSE_SEND_TRACE. If wait is STRIP_WAIT_FILL the
+*  CA is started by the main loop as soon as the strip is filled
+* 
+* Parameters:
+*  uint8 data_buffer[]: command received from the BT
+*
+*******************************************************************************/
+
+void user_measure_glucose(volatile uint8_t data_buffer[]) {
+    uint8_t ca_command[JOURNAL_PARAMS_SIZE] = {CHANGE_CA_PARAMETERS, 1};  // CA with the default values
+    
+    if (params.ca_default.pulse_voltage != V_DEFAULT || params.ca_default.period != CA_PERIOD_DEFAULT ||
+        !waveform_Select(WAVEFORM_GLUCOSE_CA)) {
+        lut_length = user_chrono_lut_maker(ca_command);
+        journal_SetParameters(ca_command);
+        procedure_type = CHANGE_CA_PARAMETERS;
+    }
+    glucose_send_trace = (data_buffer[1] == GLUCOSE_SEND_TRACE);
+    glucose_request = true;
+    if (data_buffer[2] == STRIP_WAIT_FILL) {
+        strip_Arm();
+        return;
+    }
+    user_run_procedure();
+}
+
+/******************************************************************************
+* Function Name: user_button_measure
+*******************************************************************************
+*
+* Summary:
+*  Glucose measure started by the button of the device: the same as G|0|1|Z,
+*  the standard CA is started as soon as the strip is filled and only the
+*  glucose is computed (and sent, if the GUI is there)
+*
+*******************************************************************************/
+
+void user_button_measure(void) {
+    uint8_t command[] = {MEASURE_GLUCOSE, !GLUCOSE_SEND_TRACE, STRIP_WAIT_FILL, TAIL};
+    
+    user_measure_glucose(command);
+}
+
 /******************************************************************************
 * Function Name: user_EEPROM_management
 *******************************************************************************
 *
 * Summary:
-*  We use this function in order to read the default values stored in the EEPROM (if data_buffer[1]==1)
-*  or to write new default values (if data_buffer[2]==0).
+*  We use this function in order to read the default values stored in the EEPROM (if data_buffer[1]==0 or 1)
+*  or to write new user values (if data_buffer[1]==2 or 3).
+*  With data_buffer[1]==4 the calibration curve of the glucose is written:
+*  R|4|slope (4)|intercept (4)|sample (2)|window (1)|Z, Q16.16 and big endian,
+*  the data escaped with BT_ESCAPE. A frame too short is an error
+*  The values are read from the RAM shadow of the EEPROM, the writes change the 
+*  shadow and then only the modified EEPROM rows are saved
 * 
 * Parameters: 
 *  uint8 data_buffer[]: array of chars that is used to pass the values that we want to write in the EEPROM  
 *  
 * Global variables:
-*  cystatus return_value: return value of the EEPROM_WriteByte function, if it is != CYRET_SUCCESS an error has occurred
+*  params: RAM shadow of the EEPROM parameters
 *  
 * Return:
 *  None
@@ -299,52 +405,317 @@ void user_EEPROM_management(uint8_t data_buffer[]){
     uint8_t i = 1;
     if (!data_buffer[i]){  // if data_buffer[1] is equal to 0 the user reads the default CV values from the EEPROM
         data_to_send[0] = EEPROM_DATA_CV;
-        data_to_send[i++] = EEPROM_ReadByte(SCAN_RATE_DEFAULT_ADD);
-        data_to_send[i++] = EEPROM_ReadByte(START_DEFAULT_ADD);
-        data_to_send[i++] = EEPROM_ReadByte(END_DEFAULT_ADD);
-        data_to_send[i++] = EEPROM_ReadByte(INCREMENT_DEFAULT_ADD);
-        data_to_send[i++] = EEPROM_ReadByte(HEIGH_DEFAULT_ADD);
+        data_to_send[i++] = params.cv_default.scan_rate;
+        data_to_send[i++] = params.cv_default.start;
+        data_to_send[i++] = params.cv_default.end;
+        data_to_send[i++] = params.cv_default.increment;
+        data_to_send[i++] = params.cv_default.height;
         
         writeBT(i);
     }
     else if (data_buffer[i] == 1){
         data_to_send[0] = EEPROM_DATA_CA;
-        data_to_send[i++] = EEPROM_ReadByte(V_DEFAULT_ADD);
-        data_to_send[i++] = EEPROM_ReadByte(T_DEFAULT_ADD);
+        data_to_send[i++] = params.ca_default.pulse_voltage;
+        data_to_send[i++] = params.ca_default.period;
+        
+        writeBT(i);
     }
     else if (data_buffer[i] == 2){ // if data_buffer[1] is equal to 2 the user writes new CV default values in the EEPROM
-        return_value = EEPROM_WriteByte(data_buffer[2],SCAN_RATE_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
-        }
-        return_value = EEPROM_WriteByte(data_buffer[3],START_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
-        }
-        return_value = EEPROM_WriteByte(data_buffer[4],END_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
-        }
-        return_value = EEPROM_WriteByte(data_buffer[5],INCREMENT_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
+        params.cv_user.scan_rate = data_buffer[2];
+        params.cv_user.start     = data_buffer[3];
+        params.cv_user.end       = data_buffer[4];
+        params.cv_user.increment = data_buffer[5];
+        params.cv_user.height    = data_buffer[6];
+        params_MarkDirty();
+        
+        return_value = params_Commit();
+        if(return_value != CYRET_SUCCESS){
+            errorBT();
         }
-        return_value = EEPROM_WriteByte(data_buffer[6],HEIGH_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
+    }
+    else if (data_buffer[i] == 3){ // if data_buffer[1] is equal to 3 the user writes new CA default values in the EEPROM
+        params.ca_user.pulse_voltage = data_buffer[2];
+        params.ca_user.period        = data_buffer[3];
+        params_MarkDirty();
+        
+        return_value = params_Commit();
+        if(return_value != CYRET_SUCCESS){
+            errorBT();
         }
     }
-    else if (data_buffer[i] == 3){ // if data_buffer[1] is equal to 3 the user writes new CV default values in the EEPROM
-        return_value = EEPROM_WriteByte(data_buffer[2],V_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
+    else if (data_buffer[i] == 4){ // if data_buffer[1] is equal to 4 the user writes a new glucose calibration curve
+        uint8_t curve[DATA_MAX_READING_SIZE]; // curve[0] is the 4
+        if (BT_Unescape(data_buffer, curve) < 12) {
+            errorBT();
+            return;
         }
-        return_value = EEPROM_WriteByte(data_buffer[3],CA_PERIOD_DEFAULT_ADD_USER);
-             if(return_value != CYRET_SUCCESS){
-               errorBT();
+        params.glucose.slope_q16     = ((uint32_t)curve[1] << 24) | ((uint32_t)curve[2] << 16) |
+                                       ((uint32_t)curve[3] << 8) | curve[4];
+        params.glucose.intercept_q16 = ((uint32_t)curve[5] << 24) | ((uint32_t)curve[6] << 16) |
+                                       ((uint32_t)curve[7] << 8) | curve[8];
+        params.glucose.sample_index  = (curve[9] << 8) | curve[10];
+        params.glucose.window_half   = curve[11];
+        params_MarkDirty();
+        
+        return_value = params_Commit();
+        if(return_value != CYRET_SUCCESS){
+            errorBT();
         }
     }
 }
 
+/******************************************************************************
+* Function Name: user_journal_management
+*******************************************************************************
+*
+* Summary:
+*  Commands of the measurement journal saved in flash, L|command|data|Z, the
+*  data escaped with BT_ESCAPE. A frame too short for its command is an error:
+*  - JOURNAL_SYNC: L|0|epoch (4 bytes)|Z set the clock, answer L|0|entries|Z
+*  - JOURNAL_LIST: L|1|first|Z answer L|1|entries|first|n|n entries|Z, from the newest
+*  - JOURNAL_FETCH: L|2|run id (2 bytes)|Z answer L|2|entry|Z
+*  - JOURNAL_CLEAR: L|3|Z erase all the entries, answer L|3|Z
+* 
+* Parameters: 
+*  uint8 data_buffer[]: command received from the BT
+*  
+* Return:
+*  None
+*
+*******************************************************************************/
+
+void user_journal_management(volatile uint8_t data_buffer[]){
+    static const uint8_t command_length[] = {5, 2, 3, 1}; // command + data, by command
+    uint8_t command[DATA_MAX_READING_SIZE];
+    uint8_t frame[JOURNAL_FRAME_SIZE + 3];
+    uint8_t length = BT_Unescape(data_buffer, command);
+    
+    if (length == 0 || command[0] > JOURNAL_CLEAR || length < command_length[command[0]]) {
+        errorBT();
+        return;
+    }
+    data_to_send[0] = JOURNAL_DATA;
+    data_to_send[1] = command[0];
+    switch (command[0]) {
+        case JOURNAL_SYNC:
+            journal_SetTime(((uint32_t)command[1] << 24) | ((uint32_t)command[2] << 16) |
+                            ((uint32_t)command[3] << 8) | command[4]);
+            data_to_send[2] = journal_Count();
+            writeBT(3);
+        break;
+        
+        case JOURNAL_LIST:
+            data_to_send[2] = journal_Count();
+            data_to_send[3] = command[1];
+            data_to_send[4] = journal_List(command[1], &data_to_send[5]);
+            writeBT(5 + JOURNAL_HEADER_SIZE*data_to_send[4]);
+        break;
+        
+        case JOURNAL_FETCH: // the entry is longer than data_to_send
+            frame[0] = JOURNAL_DATA;
+            frame[1] = JOURNAL_FETCH;
+            length = journal_Fetch((command[1] << 8) | command[2], &frame[2]);
+            if (length == 0) {
+                errorBT();
+                break;
+            }
+            frame[length + 2] = TAIL;
+            UART_BT_PutArray(frame, length + 3);
+        break;
+        
+        case JOURNAL_CLEAR:
+            if (journal_Clear() != CYRET_SUCCESS) {
+                errorBT();
+                break;
+            }
+            writeBT(2);
+        break;
+    }
+}
+
+/******************************************************************************
+* Function Name: user_benchmark
+*******************************************************************************
+*
+* Summary:
+*  BENCHMARK command: cycles taken by the dac and adc isrs at every step of
+*  the last procedure (phase accumulator, DAC, ADC read, conversion to nA),
+*  counted with the DWT cycle counter, and the maximum step rate that keeps
+*  the isrs within BENCHMARK_MAX_LOAD of the CPU, limited by TIMING_TICK_HZ.
+*  The levels of the DAC given by each step tell how much the fast linear CV
+*  has been coarsened to keep that rate:
+*  X|average cycles (4)|max cycles (4)|max step rate (4, Hz)|levels per step|Z
+*  An error is sent if no procedure has run since the power on
+*
+*******************************************************************************/
+
+void user_benchmark(void){
+    uint8_t interrupt_state = CyEnterCriticalSection();  // a procedure may be running
+    dac_profile_t dac = dac_profile;
+    dac_profile_t adc = adc_profile;
+    uint8_t levels = dac_profile_levels;
+    CyExitCriticalSection(interrupt_state);
+    
+    if (dac.steps == 0 || adc.steps == 0) {
+        errorBT();
+        return;
+    }
+    uint32_t max_cycles = dac.max_cycles + adc.max_cycles;
+    uint32_t max_rate = (BCLK__BUS_CLK__HZ / 100 * BENCHMARK_MAX_LOAD) / (max_cycles + BENCHMARK_ISR_CYCLES);
+    if (max_rate > TIMING_TICK_HZ) {
+        max_rate = TIMING_TICK_HZ;
+    }
+    uint32_t values[3] = {dac.total_cycles / dac.steps + adc.total_cycles / adc.steps, max_cycles, max_rate};
+    
+    data_to_send[0] = BENCHMARK_DATA;
+    for (uint8_t i = 0; i < 12; i++) {
+        data_to_send[1+i] = values[i/4] >> (24 - 8*(i%4));
+    }
+    data_to_send[13] = levels;
+    writeBT(14);
+}
+
+/******************************************************************************
+* Function Name: user_queue_management
+*******************************************************************************
+*
+* Summary:
+*  Commands of the queue of jobs, J|command|data|Z:
+*  - QUEUE_ADD: J|0|id|command (10 bytes)|Z add a CV or CA job
+*  - QUEUE_START: J|1|Z run the jobs, user_queue_task() starts them
+*  - QUEUE_CLEAR: J|2|Z remove all the jobs
+*  - QUEUE_STATUS: J|3|Z
+*  The answer is J|command|id|jobs left|Z, an error if the job can't be added
+* 
+* Parameters: 
+*  uint8 data_buffer[]: command received from the BT
+*
+*******************************************************************************/
+
+void user_queue_management(volatile uint8_t data_buffer[]){
+    switch (data_buffer[1]) {
+        case QUEUE_ADD:
+            if (!queue_Add(data_buffer[2], &data_buffer[3])) {
+                errorBT();
+                return;
+            }
+            queue_SendEvent(QUEUE_ADD, data_buffer[2]);
+        break;
+        
+        case QUEUE_START:
+            procedure_stopped = false; // a STOP sent before the queue must not abort it
+            queue_Start();
+            queue_SendEvent(QUEUE_START, 0);
+        break;
+        
+        case QUEUE_CLEAR:
+            queue_Clear();
+            queue_SendEvent(QUEUE_CLEAR, 0);
+        break;
+        
+        case QUEUE_STATUS:
+            queue_SendEvent(QUEUE_STATUS, queue_Current());
+        break;
+    }
+}
+
+static uint8_t user_queue_ready;  // the next job has been made by user_queue_prepare()
+
+/******************************************************************************
+* Function Name: user_queue_make
+*******************************************************************************
+*
+* Summary:
+*  Make the look up table of a job in the half of the arena not used by the
+*  last procedure, so that the measures of a job of the queue being sent are
+*  not overwritten
+*
+*******************************************************************************/
+
+static void user_queue_make(queue_job_t *job){
+    memory_UseBank(memory_LayoutBank() == MEMORY_BANK_LOW ? MEMORY_BANK_HIGH : MEMORY_BANK_LOW);
+    user_set_procedure(job->command);
+    memory_UseBank(MEMORY_BANK_ALL);  // the procedures set by the GUI take the whole arena
+}
+
+/******************************************************************************
+* Function Name: user_queue_prepare
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop between the frames of a job of the queue, once its
+*  voltages have been copied in data_long: the look up table of the next job
+*  is made in the other half of the arena while the job is sent, and
+*  user_queue_task() only has to start it
+*
+*******************************************************************************/
+
+void user_queue_prepare(void){
+    if (user_queue_ready || procedure_stopped || memory_LayoutBank() == MEMORY_BANK_ALL) {
+        return;  // already made, the queue is going to stop, or the procedure sent is not a job
+    }
+    queue_job_t *job = queue_Peek();
+    if (job == NULL) {
+        return;
+    }
+    user_queue_make(job);
+    user_queue_ready = true;
+}
+
+/******************************************************************************
+* Function Name: user_queue_discard
+*******************************************************************************
+*
+* Summary:
+*  A command from the GUI can change the procedure: the job made in advance
+*  is made again when it is started
+*
+*******************************************************************************/
+
+void user_queue_discard(void){
+    user_queue_ready = false;
+}
+
+/******************************************************************************
+* Function Name: user_queue_task
+*******************************************************************************
+*
+* Summary:
+*  Called by the main loop while the device is idle: when the job in progress
+*  has been sent, the next job is started, with the look up table made while
+*  the previous one was sent (or made now). The queue stops if a job has been
+*  stopped by the user or has not started, and waits for a TIA calibration
+*  requested by the GUI
+*
+*******************************************************************************/
+
+void user_queue_task(void){
+    if (!queue_Running() || isr_dac_GetState() || TIA_CalibrationRequested()) {
+        return;
+    }
+    if (procedure_stopped) {
+        queue_SendEvent(QUEUE_ABORTED, queue_Current());
+        queue_Stop();
+        return;
+    }
+    
+    uint8_t last_id = queue_Current();
+    queue_job_t *job = queue_Next();
+    if (job == NULL) {
+        queue_SendEvent(QUEUE_DONE, last_id);
+        return;
+    }
+    if (!user_queue_ready) {  // first job, or made again after a command
+        user_queue_make(job);
+    }
+    user_queue_ready = false;
+    queue_SendEvent(QUEUE_JOB_START, job->id);
+    user_run_procedure();
+    if (!isr_dac_GetState()) { // not started, the reason has been sent
+        queue_SendEvent(QUEUE_ABORTED, job->id);
+        queue_Stop();
+    }
+}
+
 /* [] END OF FILE */
 
@@ -12,8 +12,22 @@
 #include "hardware_management.h"
 #include "BT_protocols.h"
 #include "parametric_lut.h"
+#include "TIA_calibrate.h"
+#include "params_management.h"
+#include "journal_management.h"
+#include "glucose_management.h"
+#include "strip_management.h"
+#include "queue_management.h"
+#include "timing_management.h"
+#include "waveform_management.h"
+#include "watchdog_management.h"
+#include "memory_management.h"
     
 #define DO_NOT_RESTART_ADC      0
+
+// BENCHMARK: cycles of the isrs during the last procedure
+#define BENCHMARK_ISR_CYCLES    100 // entry and exit of the two isrs and the phase accumulator, not timed
+#define BENCHMARK_MAX_LOAD      50  // % of the CPU that the procedure can take, the rest is for the BT
    
 /***************************************
 *        Function Prototypes
@@ -25,7 +39,16 @@ void user_run_procedure(void);
 void user_reset_device(void);
 void user_set_isr_timer(volatile uint8_t data_buffer[]);
 void user_EEPROM_management(uint8_t data_buffer[]);
+void user_journal_management(volatile uint8_t data_buffer[]);
 uint16_t user_chrono_lut_maker(volatile uint8_t data_buffer[]);
+void user_set_procedure(volatile uint8_t data_buffer[]);
+void user_measure_glucose(volatile uint8_t data_buffer[]);
+void user_button_measure(void);
+void user_queue_management(volatile uint8_t data_buffer[]);
+void user_queue_prepare(void);
+void user_queue_discard(void);
+void user_queue_task(void);
+void user_benchmark(void);
 
 /***************************************
 * Global variables external identifier
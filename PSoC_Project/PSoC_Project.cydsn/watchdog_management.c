@@ -0,0 +1,359 @@
+/*******************************************************************************
+* File Name: watchdog_management.c
+*
+* Description:
+*  Check ins of the tasks and clear of the hardware watchdog. The record is
+*  in the .noinit section: the startup code does not clear it, so after a
+*  watchdog reset it still holds the tasks that had not checked in and the
+*  step of the run in progress
+*********************************************************************************/
+
+#include "watchdog_management.h"
+#include "hardware_management.h"
+#include "upload_management.h"
+#include "string.h"
+#include "stddef.h"
+
+_Static_assert(UPLOAD_FIRST_ROW + 1 + UPLOAD_EEPROM_BYTES/CYDEV_EEPROM_ROW_SIZE <= WATCHDOG_EEPROM_ROW,
+               "the uploaded waveform overlaps the report of the watchdog");
+_Static_assert(WATCHDOG_FRAME_SIZE + 1 <= CYDEV_EEPROM_ROW_SIZE, "the report does not fit in one EEPROM row");
+
+static CY_NOINIT watchdog_record_t watchdog_record;
+static uint8_t watchdog_report[WATCHDOG_FRAME_SIZE + 1];   // report of the reset, sent by watchdog_Start()
+static uint8_t watchdog_recovered;                         // the device has been reset by the watchdog
+
+/***************************************
+* Forward function references
+***************************************/
+static void watchdog_make_report(uint8_t cause);
+static void watchdog_save_report(void);
+static uint16_t watchdog_calibration_crc(void);
+static uint16_t watchdog_crc(const uint8_t *data, uint16_t length);
+
+/******************************************************************************
+* Function Name: watchdog_Recover
+*******************************************************************************
+*
+* Summary:
+*  Called at power on before the TIA calibration. After a watchdog reset the
+*  report of the interrupted run is prepared and the TIA calibration of the
+*  record is applied again; after any other reset the record is cleared
+*
+* Return:
+*  true if the TIA calibration has been restored, the sweep is not needed
+*
+*******************************************************************************/
+
+uint8_t watchdog_Recover(void) {
+    uint8_t restored = false;
+
+    if (watchdog_record.magic == WATCHDOG_MAGIC && (CyResetStatus & CY_RESET_WD)) {
+        watchdog_record.resets++;
+        watchdog_make_report(CyResetStatus);
+        watchdog_recovered = true;
+        if (watchdog_record.calibration_crc != 0 && watchdog_record.calibration_crc == watchdog_calibration_crc()) {
+            tia_fit = watchdog_record.fit;
+            tia_calibration_length = watchdog_record.calibration_length;
+            memcpy(tia_calibration_values, watchdog_record.calibration_values, TIA_CAL_FRAME_SIZE);
+            TIA_RestoreCalibration(watchdog_record.resistor_index);
+            restored = true;
+        }
+    } else {
+        memset(&watchdog_record, 0, sizeof(watchdog_record_t));
+        watchdog_record.magic = WATCHDOG_MAGIC;
+    }
+    watchdog_record.expected = WATCHDOG_MAIN;
+    watchdog_record.seen = 0;
+    watchdog_record.blocking = 0;
+    watchdog_record.procedure = 0;
+    watchdog_record.step = 0;
+    watchdog_record.steps = 0;
+    return restored;
+}
+
+/******************************************************************************
+* Function Name: watchdog_Start
+*******************************************************************************
+*
+* Summary:
+*  Called when the BT is ready: after a watchdog reset sends the report of
+*  the interrupted run and saves it in the EEPROM, then starts the watchdog.
+*  Once started it cannot be stopped until the next reset
+*
+*******************************************************************************/
+
+void watchdog_Start(void) {
+    if (watchdog_recovered) {
+        UART_BT_PutArray(watchdog_report, WATCHDOG_FRAME_SIZE + 1);
+        watchdog_save_report();
+    }
+    CyWdtStart(WATCHDOG_TICKS, CYWDT_LPMODE_NOCHANGE);
+}
+
+/******************************************************************************
+* Function Name: watchdog_CheckIn
+*******************************************************************************
+*
+* Summary:
+*  The task is alive. The watchdog is cleared when all the expected tasks
+*  have checked in, or only the blocking one while it is in progress.
+*  Called also by the isrs
+*
+* Parameters:
+*  uint8_t task: WATCHDOG_xxx
+*
+*******************************************************************************/
+
+void watchdog_CheckIn(uint8_t task) {
+    uint8 interrupt_state = CyEnterCriticalSection();
+
+    watchdog_record.seen |= task;
+    if (task == WATCHDOG_MAIN) {
+        watchdog_record.uptime_ms = helper_Millis();
+    } else if (task == WATCHDOG_TICK) {
+        watchdog_record.step = lut_index;
+    }
+    uint8_t expected = watchdog_record.blocking ? watchdog_record.blocking : watchdog_record.expected;
+    if ((watchdog_record.seen & expected) == expected) {
+        CyWdtClear();
+        watchdog_record.seen = 0;
+    }
+    CyExitCriticalSection(interrupt_state);
+}
+
+/******************************************************************************
+* Function Name: watchdog_RunStarted
+*******************************************************************************
+*
+* Summary:
+*  A procedure is started: the tick of the dac isr is expected until the end
+*  of it, and the record keeps the procedure and its steps
+*
+*******************************************************************************/
+
+void watchdog_RunStarted(void) {
+    uint8 interrupt_state = CyEnterCriticalSection();
+
+    watchdog_record.procedure = procedure_type;
+    watchdog_record.step = 0;
+    watchdog_record.steps = lut_end;
+    watchdog_record.expected |= WATCHDOG_TICK;
+    CyExitCriticalSection(interrupt_state);
+}
+
+/******************************************************************************
+* Function Name: watchdog_RunEnded
+*******************************************************************************
+*
+* Summary:
+*  The procedure is finished (or stopped), the tick is no longer expected
+*
+*******************************************************************************/
+
+void watchdog_RunEnded(void) {
+    uint8 interrupt_state = CyEnterCriticalSection();
+
+    watchdog_record.procedure = 0;
+    watchdog_record.expected &= ~WATCHDOG_TICK;
+    CyExitCriticalSection(interrupt_state);
+}
+
+/******************************************************************************
+* Function Name: watchdog_BlockBegin
+*******************************************************************************
+*
+* Summary:
+*  A long job that blocks the other tasks is started: until
+*  watchdog_BlockEnd() only its check ins are expected. The blocks nest, a
+*  job started inside another one gives it back when it ends
+*
+* Parameters:
+*  uint8_t task: WATCHDOG_SEND or WATCHDOG_EEPROM
+*
+* Return:
+*  the block in progress (0 if none), to pass to watchdog_BlockEnd()
+*
+*******************************************************************************/
+
+uint8_t watchdog_BlockBegin(uint8_t task) {
+    uint8 interrupt_state = CyEnterCriticalSection();
+    uint8_t outer_block = watchdog_record.blocking;
+
+    watchdog_record.blocking = task;
+    watchdog_record.seen &= ~task;
+    CyExitCriticalSection(interrupt_state);
+    return outer_block;
+}
+
+/******************************************************************************
+* Function Name: watchdog_BlockEnd
+*******************************************************************************
+*
+* Summary:
+*  End of the long job: the block it was started in is expected again, or
+*  the usual tasks if there was none
+*
+* Parameters:
+*  uint8_t outer_block: value returned by watchdog_BlockBegin()
+*
+*******************************************************************************/
+
+void watchdog_BlockEnd(uint8_t outer_block) {
+    uint8 interrupt_state = CyEnterCriticalSection();
+
+    watchdog_record.blocking = outer_block;
+    if (outer_block) {
+        watchdog_record.seen &= ~outer_block;
+    }
+    CyExitCriticalSection(interrupt_state);
+}
+
+/******************************************************************************
+* Function Name: watchdog_SaveCalibration
+*******************************************************************************
+*
+* Summary:
+*  Copy in the record the TIA calibration just completed (tia_fit and the
+*  TIA_SET frame), used again after a watchdog reset
+*
+* Parameters:
+*  uint8_t resistor_index: TIA resistor of the calibration
+*
+*******************************************************************************/
+
+void watchdog_SaveCalibration(uint8_t resistor_index) {
+    watchdog_record.resistor_index = resistor_index;
+    watchdog_record.calibration_length = tia_calibration_length;
+    watchdog_record.fit = tia_fit;
+    memcpy(watchdog_record.calibration_values, tia_calibration_values, TIA_CAL_FRAME_SIZE);
+    watchdog_record.calibration_crc = watchdog_calibration_crc();
+}
+
+/******************************************************************************
+* Function Name: watchdog_SendReport
+*******************************************************************************
+*
+* Summary:
+*  Answer to RESET_REPORT: the report of the last watchdog reset saved in the
+*  EEPROM, also after a power off. The cause is WATCHDOG_NO_REPORT if no
+*  reset has been saved
+*
+*******************************************************************************/
+
+void watchdog_SendReport(void) {
+    uint8_t row[CYDEV_EEPROM_ROW_SIZE];
+    uint8_t frame[WATCHDOG_FRAME_SIZE + 1];
+    uint16_t address = WATCHDOG_EEPROM_ROW * CYDEV_EEPROM_ROW_SIZE;
+
+    for (uint8_t i = 0; i < CYDEV_EEPROM_ROW_SIZE; i++) {
+        row[i] = EEPROM_ReadByte(address + i);
+    }
+    memset(frame, 0, sizeof(frame));
+    if (row[0] == WATCHDOG_EEPROM_VERSION &&
+        row[WATCHDOG_FRAME_SIZE] == (watchdog_crc(row, WATCHDOG_FRAME_SIZE) & 0xFF)) {
+        memcpy(&frame[1], &row[1], WATCHDOG_FRAME_SIZE - 1);
+    }
+    frame[0] = WATCHDOG_DATA;
+    frame[WATCHDOG_FRAME_SIZE] = TAIL;
+    UART_BT_PutArray(frame, WATCHDOG_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: watchdog_make_report
+*******************************************************************************
+*
+* Summary:
+*  Report of the reset from the record left by the previous run:
+*  I|cause|missing|blocking|procedure|step (2)|steps (2)|resets (2)|uptime (s, 4)|Z
+*  missing are the tasks that had not checked in when the watchdog expired
+*
+* Parameters:
+*  uint8_t cause: RESET_SR0 (CyResetStatus), CY_RESET_WD for the watchdog
+*
+*******************************************************************************/
+
+static void watchdog_make_report(uint8_t cause) {
+    watchdog_record_t *record = &watchdog_record;
+    uint8_t expected = record->blocking ? record->blocking : record->expected;
+    uint32_t uptime_s = record->uptime_ms / 1000;
+
+    watchdog_report[0] = WATCHDOG_DATA;
+    watchdog_report[1] = cause;
+    watchdog_report[2] = expected & ~record->seen;
+    watchdog_report[3] = record->blocking;
+    watchdog_report[4] = record->procedure;
+    watchdog_report[5] = record->step >> 8;
+    watchdog_report[6] = record->step & 0xFF;
+    watchdog_report[7] = record->steps >> 8;
+    watchdog_report[8] = record->steps & 0xFF;
+    watchdog_report[9] = record->resets >> 8;
+    watchdog_report[10] = record->resets & 0xFF;
+    for (uint8_t i = 0; i < 4; i++) {
+        watchdog_report[11+i] = uptime_s >> (24 - 8*i);
+    }
+    watchdog_report[WATCHDOG_FRAME_SIZE] = TAIL;
+}
+
+/******************************************************************************
+* Function Name: watchdog_save_report
+*******************************************************************************
+*
+* Summary:
+*  Write the report in WATCHDOG_EEPROM_ROW: version, the report without
+*  header and tail, low byte of its CRC-16
+*
+*******************************************************************************/
+
+static void watchdog_save_report(void) {
+    uint8_t row[CYDEV_EEPROM_ROW_SIZE];
+
+    memset(row, 0, sizeof(row));
+    memcpy(row, watchdog_report, WATCHDOG_FRAME_SIZE);
+    row[0] = WATCHDOG_EEPROM_VERSION;
+    row[WATCHDOG_FRAME_SIZE] = watchdog_crc(row, WATCHDOG_FRAME_SIZE) & 0xFF;
+
+    EEPROM_Start();
+    CyDelayUs(10);
+    EEPROM_UpdateTemperature();
+    EEPROM_Write(row, WATCHDOG_EEPROM_ROW);
+    EEPROM_Stop();
+}
+
+/******************************************************************************
+* Function Name: watchdog_calibration_crc
+*******************************************************************************
+*
+* Summary:
+*  CRC of the TIA calibration kept in the record, never 0 (0 means no
+*  calibration saved)
+*
+*******************************************************************************/
+
+static uint16_t watchdog_calibration_crc(void) {
+    uint16_t crc = watchdog_crc((const uint8_t *)&watchdog_record.resistor_index,
+                                offsetof(watchdog_record_t, calibration_crc) - offsetof(watchdog_record_t, resistor_index));
+    return crc ? crc : 1;
+}
+
+/******************************************************************************
+* Function Name: watchdog_crc
+*******************************************************************************
+*
+* Summary:
+*  CRC-16 CCITT (polynomial 0x1021, initial value 0xFFFF)
+*
+*******************************************************************************/
+
+static uint16_t watchdog_crc(const uint8_t *data, uint16_t length) {
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* [] END OF FILE */
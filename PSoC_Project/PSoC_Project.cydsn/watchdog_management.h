@@ -0,0 +1,82 @@
+/*******************************************************************************
+* File Name: watchdog_management.h
+*
+* Description:
+*  Watchdog of the device. Each task checks in while it is alive: the main
+*  loop, the 1 ms tick of a running procedure, and the long blocking jobs
+*  (sending a measure, writing the EEPROM), which stand for the tasks they
+*  block. The hardware watchdog is cleared only when all the expected tasks
+*  have checked in. The state of the check ins is kept in a record that is
+*  not cleared by the startup code, so after a watchdog reset the device
+*  knows which task was stuck and where the run was: the record is sent to
+*  the GUI, saved in the last EEPROM row, and the TIA calibration kept in
+*  the record is used again instead of repeating the sweep
+*********************************************************************************/
+
+#if !defined(WATCHDOG_MANAGEMENT_H)
+#define WATCHDOG_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+#include "TIA_calibrate.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+#define WATCHDOG_TICKS          CYWDT_1024_TICKS // reset after 2 to 3 s without a clear
+
+// tasks that check in
+#define WATCHDOG_MAIN           0x01    // iteration of the main loop
+#define WATCHDOG_TICK           0x02    // tick of the dac isr, expected while a procedure runs
+#define WATCHDOG_SEND           0x04    // BT_sending_manager(), for each frame sent
+#define WATCHDOG_EEPROM         0x08    // each row written in the EEPROM
+
+#define WATCHDOG_MAGIC          0x57444F47u // "WDOG", the record is random after a power on
+#define WATCHDOG_EEPROM_ROW     (CYDEV_EE_SIZE/CYDEV_EEPROM_ROW_SIZE - 1) // copy of the last report
+#define WATCHDOG_EEPROM_VERSION 1
+
+// report of a reset: I|cause|missing|blocking|procedure|step (2)|steps (2)|resets (2)|uptime (s, 4)|Z
+#define WATCHDOG_FRAME_SIZE     15
+#define WATCHDOG_NO_REPORT      0       // cause sent when no watchdog reset has been recorded
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef struct {
+    uint32_t magic;                 // WATCHDOG_MAGIC if the record is valid
+    uint8_t expected;               // tasks that must check in before the next clear
+    uint8_t seen;                   // tasks checked in since the last clear
+    uint8_t blocking;               // long job in progress, the only task expected
+    uint8_t procedure;              // procedure_type of the run in progress, 0 if idle
+    uint16_t step;                  // lut_index at the last tick
+    uint16_t steps;                 // lut_end of the run
+    uint16_t resets;                // watchdog resets since the power on
+    uint32_t uptime_ms;             // helper_Millis() at the last check in of the main loop
+    // TIA calibration, used again after a reset
+    uint8_t resistor_index;
+    uint8_t calibration_length;
+    tia_fit_t fit;
+    uint8_t calibration_values[TIA_CAL_FRAME_SIZE];
+    uint16_t calibration_crc;       // CRC-16 CCITT of the calibration, 0 if none
+} watchdog_record_t;
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint8_t watchdog_Recover(void);
+void watchdog_Start(void);
+void watchdog_CheckIn(uint8_t task);
+void watchdog_RunStarted(void);
+void watchdog_RunEnded(void);
+uint8_t watchdog_BlockBegin(uint8_t task);
+void watchdog_BlockEnd(uint8_t outer_block);
+void watchdog_SaveCalibration(uint8_t resistor_index);
+void watchdog_SendReport(void);
+
+#endif
+
+/* [] END OF FILE */
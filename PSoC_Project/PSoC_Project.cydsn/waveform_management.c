@@ -0,0 +1,104 @@
+/*******************************************************************************
+* File Name: waveform_management.c
+*
+* Description:
+*  Selection of a procedure of the flash library: the same state that
+*  user_set_procedure() prepares, but the look up table is not made
+*********************************************************************************/
+
+#include "waveform_management.h"
+#include "parametric_lut.h"
+#include "timing_management.h"
+
+/***************************************
+* Forward function references
+***************************************/
+static const waveform_t *waveform_find(uint8_t id);
+
+/******************************************************************************
+* Function Name: waveform_Select
+*******************************************************************************
+*
+* Summary:
+*  Set the procedure id of the library, made for the DAC in use: timing, look
+*  up table in flash, parameters for the journal. The run is started as usual
+*  with RUN_CV or RUN_CA
+*
+* Parameters:
+*  uint8_t id: WAVEFORM_xxx
+*
+* Return:
+*  steps of the procedure, 0 if the library has no such procedure for the DAC
+*  in use (nothing is changed)
+*
+*******************************************************************************/
+
+uint16_t waveform_Select(uint8_t id) {
+    const waveform_t *waveform = waveform_find(id);
+
+    if (waveform == NULL) {
+        return 0;
+    }
+    journal_SetParameters((volatile uint8_t *)waveform->command);
+    procedure_type = waveform->command[0];
+    swv_mode = SWV_SEND_RAW;
+    cv_cycles = 1;
+    cv_send_last_cycle = false;
+
+    if (procedure_type == CHANGE_CV_PARAMETERS) {
+        // the library has no fast scan, one DAC level for each step
+        timing_Set(timing_ScanIncrement(LUT_ScanRate(waveform->command[1]), dac_resolution));
+        if (waveform->command[4] && (waveform->command[7] == SWV_SEND_NET || waveform->command[7] == SWV_SEND_ALL)) {
+            swv_mode = waveform->command[7];
+        }
+    } else {
+        timing_Set(timing_PeriodIncrement(CA_STEP_MS));
+        ca_pulse_samples = waveform->pulse_samples;
+    }
+    lut_length = LUT_PlayTable(waveform->lut, waveform->length);
+    lut_value = LUT_Value(0);
+    return lut_length;
+}
+
+/******************************************************************************
+* Function Name: waveform_SendSelected
+*******************************************************************************
+*
+* Summary:
+*  Answer to WAVEFORM_SELECT: O|id|steps (2)|Z, steps is 0 if the procedure
+*  is not in the library
+*
+*******************************************************************************/
+
+void waveform_SendSelected(uint8_t id, uint16_t steps) {
+    uint8_t frame[WAVEFORM_FRAME_SIZE + 1];
+
+    frame[0] = WAVEFORM_DATA;
+    frame[1] = id;
+    frame[2] = steps >> 8;
+    frame[3] = steps & 0xFF;
+    frame[4] = TAIL;
+    UART_BT_PutArray(frame, WAVEFORM_FRAME_SIZE + 1);
+}
+
+/******************************************************************************
+* Function Name: waveform_find
+*******************************************************************************
+*
+* Summary:
+*  Entry of the library for the procedure id and the DAC in use
+*
+*******************************************************************************/
+
+static const waveform_t *waveform_find(uint8_t id) {
+    for (uint8_t i = 0; i < waveform_library_size; i++) {
+        const waveform_t *waveform = &waveform_library[i];
+        if (waveform->id == id &&
+            (waveform->resolution == 0 || waveform->resolution == dac_resolution)) {
+            return waveform;
+        }
+    }
+    return NULL;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,61 @@
+/*******************************************************************************
+* File Name: waveform_management.h
+*
+* Description:
+*  Library of the standard procedures, with the look up tables already made in
+*  flash. The tables are written in waveform_tables.c by
+*  PSoC_Project/tools/make_waveforms.py from the default values of globals.h,
+*  the build fails if the defaults have been changed without running it again.
+*  A procedure of the library is played directly from flash, so it is ready
+*  without making the LUT and the whole arena is left to the samples
+*********************************************************************************/
+
+#if !defined(WAVEFORM_MANAGEMENT_H)
+#define WAVEFORM_MANAGEMENT_H
+
+#include <project.h>
+#include "cytypes.h"
+#include "globals.h"
+#include "journal_management.h"
+
+/**************************************
+*        Constants
+**************************************/
+
+// procedures of the library, O|id|Z selects one of them
+#define WAVEFORM_GLUCOSE_CA     0   // CA with the default pulse, used by MEASURE_GLUCOSE
+#define WAVEFORM_DEFAULT_CV     1   // linear CV with the default start, end and scan rate
+#define WAVEFORM_DEFAULT_SWV    2   // square wave voltammetry with the default increment and height
+
+#define WAVEFORM_FRAME_SIZE     4   // header + id + steps (2)
+
+/***************************************
+*        Structures
+***************************************/
+
+typedef struct {
+    uint8_t id;                             // WAVEFORM_xxx
+    uint8_t resolution;                     // mV for each DAC level the values are made for, 0 for any DAC
+    uint16_t length;                        // entries of lut
+    uint16_t pulse_samples;                 // CA only: samples of the pulse, for the Cottrell fit
+    uint8_t command[JOURNAL_PARAMS_SIZE];   // CHANGE_CV_PARAMETERS or CHANGE_CA_PARAMETERS command of the same procedure
+    const uint16_t *lut;
+} waveform_t;
+
+/***************************************
+* Global variables external identifier
+***************************************/
+
+extern const waveform_t waveform_library[];   // in waveform_tables.c
+extern const uint8_t waveform_library_size;
+
+/***************************************
+*        Function Prototypes
+***************************************/
+
+uint16_t waveform_Select(uint8_t id);
+void waveform_SendSelected(uint8_t id, uint16_t steps);
+
+#endif
+
+/* [] END OF FILE */
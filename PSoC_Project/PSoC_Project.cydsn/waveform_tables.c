@@ -0,0 +1,77 @@
+/*******************************************************************************
+* File Name: waveform_tables.c
+*
+* Description:
+*  Look up tables of the flash library, made by PSoC_Project/tools/make_waveforms.py
+*  from the default values of globals.h. Do not edit, run the script again
+*********************************************************************************/
+
+#include "waveform_management.h"
+
+#if (V_DEFAULT != 56) || \
+    (CA_PERIOD_DEFAULT != 10) || \
+    (SCAN_RATE_DEFAULT != 5) || \
+    (START_DEFAULT != 226) || \
+    (END_DEFAULT != 30) || \
+    (INCREMENT_DEFAULT != 1) || \
+    (HEIGH_DEFAULT != 2) || \
+    (CA_STEP_MS != 10) || \
+    (CA_BASELINE_SAMPLES != 20)
+#error "The defaults of globals.h have changed: run PSoC_Project/tools/make_waveforms.py"
+#endif
+
+static const uint16_t waveform_glucose_ca_16mv[140] = {
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130,
+    130, 130, 130, 130, 130, 130, 130, 130, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127
+};
+
+static const uint16_t waveform_glucose_ca_1mv[140] = {
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183, 183,
+    183, 183, 183, 183, 183, 183, 183, 183, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127
+};
+
+static const uint16_t waveform_default_cv[78] = {
+    108, 109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123,
+    124, 125, 126, 127, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139,
+    140, 141, 142, 143, 144, 145, 146, 145, 144, 143, 142, 141, 140, 139, 138, 137,
+    136, 135, 134, 133, 132, 131, 130, 129, 128, 127, 126, 125, 124, 123, 122, 121,
+    120, 119, 118, 117, 116, 115, 114, 113, 112, 111, 110, 109, 108, 108
+};
+
+static const uint16_t waveform_default_swv[157] = {
+    109, 107, 110, 108, 111, 109, 112, 110, 113, 111, 114, 112, 115, 113, 116, 114,
+    117, 115, 118, 116, 119, 117, 120, 118, 121, 119, 122, 120, 123, 121, 124, 122,
+    125, 123, 126, 124, 127, 125, 128, 126, 129, 127, 130, 128, 131, 129, 132, 130,
+    133, 131, 134, 132, 135, 133, 136, 134, 137, 135, 138, 136, 139, 137, 140, 138,
+    141, 139, 142, 140, 143, 141, 144, 142, 145, 143, 146, 144, 147, 145, 147, 145,
+    146, 144, 145, 143, 144, 142, 143, 141, 142, 140, 141, 139, 140, 138, 139, 137,
+    138, 136, 137, 135, 136, 134, 135, 133, 134, 132, 133, 131, 132, 130, 131, 129,
+    130, 128, 129, 127, 128, 126, 127, 125, 126, 124, 125, 123, 124, 122, 123, 121,
+    122, 120, 121, 119, 120, 118, 119, 117, 118, 116, 117, 115, 116, 114, 115, 113,
+    114, 112, 113, 111, 112, 110, 111, 109, 110, 108, 109, 107, 108
+};
+
+const waveform_t waveform_library[] = {
+    {WAVEFORM_GLUCOSE_CA, 16, 140, 100, {CHANGE_CA_PARAMETERS, 1, 0, 0, 0, 0, 0, 0}, waveform_glucose_ca_16mv},
+    {WAVEFORM_GLUCOSE_CA, 1, 140, 100, {CHANGE_CA_PARAMETERS, 1, 0, 0, 0, 0, 0, 0}, waveform_glucose_ca_1mv},
+    {WAVEFORM_DEFAULT_CV, 0, 78, 0, {CHANGE_CV_PARAMETERS, 5, 108, 146, 0, 1, 2, SWV_SEND_RAW}, waveform_default_cv},
+    {WAVEFORM_DEFAULT_SWV, 0, 157, 0, {CHANGE_CV_PARAMETERS, 5, 108, 146, 1, 1, 2, SWV_SEND_RAW}, waveform_default_swv}
+};
+
+const uint8_t waveform_library_size = sizeof(waveform_library)/sizeof(waveform_t);
+
+/* [] END OF FILE */
@@ -0,0 +1,167 @@
+"""
+@brief Make waveform_tables.c, the flash library of the standard procedures.
+
+The look up tables are the same that LUT_MakeTriangle_Wave() and LUT_MakePulse()
+make on the PSoC with the default values of globals.h. Run it again every time
+those defaults are changed (the build stops with an #error until then), e.g.
+as a pre-build command of PSoC Creator:
+    python make_waveforms.py
+"""
+
+import os
+import re
+
+PROJECT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'PSoC_Project.cydsn')
+GLOBALS_FILE = os.path.join(PROJECT_DIR, 'globals.h')
+OUTPUT_FILE = os.path.join(PROJECT_DIR, 'waveform_tables.c')
+
+# default values the tables are made from, checked again by the compiler
+DEFAULTS = ['V_DEFAULT', 'CA_PERIOD_DEFAULT', 'SCAN_RATE_DEFAULT', 'START_DEFAULT', 'END_DEFAULT',
+            'INCREMENT_DEFAULT', 'HEIGH_DEFAULT', 'CA_STEP_MS', 'CA_BASELINE_SAMPLES']
+
+DAC_RESOLUTIONS = [16, 1]   # mV for each level of the VDAC and of the DVDAC, as in hardware_management.c
+CA_BASELINE = 0b01111111    # 0V, as in user_chrono_lut_maker()
+SCAN_RATE_FAST = 0x80
+
+
+def read_defaults():
+    """
+    @brief Values of the DEFAULTS macros in globals.h
+    """
+    values = {}
+    with open(GLOBALS_FILE) as globals_file:
+        for line in globals_file:
+            match = re.match(r'\s*#define\s+(\w+)\s+(0x[0-9A-Fa-f]+|0b[01]+|\d+)', line)
+            if match and match.group(1) in DEFAULTS:
+                values[match.group(1)] = int(match.group(2), 0)
+    missing = [name for name in DEFAULTS if name not in values]
+    if missing:
+        raise SystemExit('Not found in globals.h: ' + ', '.join(missing))
+    return values
+
+
+def mv_to_dac(mv):
+    """
+    @brief Byte of the CV command for a potential, same conversion of the GUI
+    """
+    return int(((mv + 2000) / 4000) * 255)
+
+
+def make_line(lut, start, end, index):
+    """
+    @brief LUT_make_line() with one level for each step
+    """
+    step = 1 if start < end else -1
+    del lut[index:]
+    lut.extend(range(start, end + step, step))
+    return len(lut)
+
+
+def make_swv_line(lut, start, end, pulse_inc, pulse_height):
+    """
+    @brief LUT_make_swv_line(), forward and reverse pulse of each step
+    """
+    half_pulse = pulse_height // 2
+    step = pulse_inc if start < end else -pulse_inc
+    value = start
+    while (value <= end) if start < end else (value >= end):
+        lut.extend([value + half_pulse, value - half_pulse])
+        value += step
+    return len(lut)
+
+
+def make_cv(start, end, square_wave, pulse_inc, pulse_height):
+    """
+    @brief LUT_MakeTriangle_Wave()
+    """
+    lut = []
+    if not square_wave:
+        index = make_line(lut, start, end, 0)
+        make_line(lut, lut[index - 1], start, index - 1)
+    else:
+        make_swv_line(lut, start, end, pulse_inc, pulse_height)
+        make_swv_line(lut, end, start, pulse_inc, pulse_height)
+    lut.append(start)
+    return lut
+
+
+def make_pulse(base, pulse, samples, baseline):
+    """
+    @brief LUT_MakePulse()
+    """
+    return [base]*baseline + [pulse]*samples + [base]*baseline
+
+
+def c_array(name, values):
+    lines = ['static const uint16_t {}[{}] = {{'.format(name, len(values))]
+    for i in range(0, len(values), 16):
+        lines.append('    ' + ', '.join(str(value) for value in values[i:i+16]) + ',')
+    lines[-1] = lines[-1][:-1]
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def main():
+    d = read_defaults()
+    if d['SCAN_RATE_DEFAULT'] & SCAN_RATE_FAST:
+        raise SystemExit('The library has no fast scan CV')
+
+    start_mv = (d['START_DEFAULT'] - 256 if d['START_DEFAULT'] > 127 else d['START_DEFAULT']) * 10
+    end_mv = (d['END_DEFAULT'] - 256 if d['END_DEFAULT'] > 127 else d['END_DEFAULT']) * 10
+    start, end = mv_to_dac(start_mv), mv_to_dac(end_mv)
+    cv_command = ['CHANGE_CV_PARAMETERS', d['SCAN_RATE_DEFAULT'], start, end, 0,
+                  d['INCREMENT_DEFAULT'], d['HEIGH_DEFAULT'], 'SWV_SEND_RAW']
+    swv_command = list(cv_command)
+    swv_command[4] = 1
+
+    # id, resolution, pulse samples, command, table name, table
+    entries = []
+    pulse_samples = d['CA_PERIOD_DEFAULT']*100 // d['CA_STEP_MS']
+    for resolution in DAC_RESOLUTIONS:
+        pulse = CA_BASELINE + d['V_DEFAULT'] // resolution
+        entries.append(('WAVEFORM_GLUCOSE_CA', resolution, pulse_samples,
+                        ['CHANGE_CA_PARAMETERS', 1, 0, 0, 0, 0, 0, 0],
+                        'waveform_glucose_ca_{}mv'.format(resolution),
+                        make_pulse(CA_BASELINE, pulse, pulse_samples, d['CA_BASELINE_SAMPLES'])))
+    entries.append(('WAVEFORM_DEFAULT_CV', 0, 0, cv_command, 'waveform_default_cv',
+                    make_cv(start, end, False, 0, 0)))
+    entries.append(('WAVEFORM_DEFAULT_SWV', 0, 0, swv_command, 'waveform_default_swv',
+                    make_cv(start, end, True, d['INCREMENT_DEFAULT'], d['HEIGH_DEFAULT'])))
+
+    out = []
+    out.append('/*******************************************************************************')
+    out.append('* File Name: waveform_tables.c')
+    out.append('*')
+    out.append('* Description:')
+    out.append('*  Look up tables of the flash library, made by PSoC_Project/tools/make_waveforms.py')
+    out.append('*  from the default values of globals.h. Do not edit, run the script again')
+    out.append('*********************************************************************************/')
+    out.append('')
+    out.append('#include "waveform_management.h"')
+    out.append('')
+    out.append('#if ' + ' || \\\n    '.join('({} != {})'.format(name, d[name]) for name in DEFAULTS))
+    out.append('#error "The defaults of globals.h have changed: run PSoC_Project/tools/make_waveforms.py"')
+    out.append('#endif')
+    for entry in entries:
+        out.append('')
+        out.append(c_array(entry[4], entry[5]))
+    out.append('')
+    out.append('const waveform_t waveform_library[] = {')
+    rows = []
+    for entry_id, resolution, samples, command, name, lut in entries:
+        rows.append('    {{{}, {}, {}, {}, {{{}}}, {}}}'.format(
+            entry_id, resolution, len(lut), samples, ', '.join(str(byte) for byte in command), name))
+    out.append(',\n'.join(rows))
+    out.append('};')
+    out.append('')
+    out.append('const uint8_t waveform_library_size = sizeof(waveform_library)/sizeof(waveform_t);')
+    out.append('')
+    out.append('/* [] END OF FILE */')
+
+    with open(OUTPUT_FILE, 'w') as output_file:
+        output_file.write('\n'.join(out) + '\n')
+    print('{}: {} procedures'.format(OUTPUT_FILE, len(entries)))
+
+
+if __name__ == '__main__':
+    main()
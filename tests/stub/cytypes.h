@@ -0,0 +1,25 @@
+/*******************************************************************************
+* File Name: cytypes.h
+*
+* Description:
+*  Host stand-in for the PSoC Creator header, only the types used by the
+*  modules under test
+*********************************************************************************/
+
+#if !defined(STUB_CYTYPES_H)
+#define STUB_CYTYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t   int8;
+typedef int16_t  int16;
+typedef int32_t  int32;
+typedef float    float32;
+typedef uint8_t  cystatus;
+
+#endif
+
+/* [] END OF FILE */
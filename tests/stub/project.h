@@ -0,0 +1,21 @@
+/*******************************************************************************
+* File Name: project.h
+*
+* Description:
+*  Host stand-in for the generated project.h: the APIs of the components
+*  used by the modules under test, defined by the test itself
+*********************************************************************************/
+
+#if !defined(STUB_PROJECT_H)
+#define STUB_PROJECT_H
+
+#include "cytypes.h"
+
+void PWM_isr_Wakeup(void);
+void PWM_isr_Sleep(void);
+void PWM_isr_WriteCompare(uint16 compare);
+void PWM_isr_WritePeriod(uint16 period);
+
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,121 @@
+/*******************************************************************************
+* File Name: test_timing.c
+*
+* Description:
+*  Host test of the phase accumulator of timing_management.c: for the scan
+*  rates of the CV, from 1 mV/s to the fast scan, and for the CA period the
+*  step rate given by the increment and the steps actually counted by
+*  timing_Step() over a long run match the requested rate within the
+*  tolerance, above TIMING_TICK_HZ the rate is capped at one step for each
+*  tick, and timing_LastTick() announces every step. Built and run with:
+*
+*  gcc -std=gnu99 -fcommon -Wall -I tests/stub -I PSoC_Project/PSoC_Project.cydsn \
+*      tests/test_timing.c PSoC_Project/PSoC_Project.cydsn/timing_management.c -lm -o test_timing
+*  ./test_timing
+*
+*  (-fcommon as with the ARM GCC of PSoC Creator, globals.h defines the
+*  globals in every file that includes it; add -DTIMING_TICK_HZ=... to check
+*  another tick)
+*********************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include "timing_management.h"
+
+// half a unit of the smallest increment (1 mV/s with 16 mV per level): 1.9 ppm at 1 kHz
+#define TEST_TOLERANCE          (2e-6 * TIMING_TICK_HZ / 1000)
+#define TEST_RUN_TICKS          10000000UL  // 10^4 s with the 1 kHz tick
+
+static const uint8_t test_resolutions[] = {1, 16};  // mV for each level of the DVDAC and of the VDAC
+static const uint16_t test_scan_rates[] = {1, 2, 3, 7, 10, 33, 100, 250, 499, 500, 999, 1000, 1270, 20000};
+
+static uint16_t pwm_period;
+static uint16_t pwm_compare;
+static int failures;
+
+void PWM_isr_Wakeup(void) {}
+void PWM_isr_Sleep(void) {}
+void PWM_isr_WriteCompare(uint16 compare) { pwm_compare = compare; }
+void PWM_isr_WritePeriod(uint16 period) { pwm_period = period; }
+
+/******************************************************************************
+* Function Name: test_check
+*******************************************************************************
+*
+* Summary:
+*  Count a failure and print it
+*
+*******************************************************************************/
+
+static void test_check(int condition, const char *what, double requested, double achieved) {
+    if (!condition) {
+        failures++;
+        printf("FAIL %s: requested %.9g steps/s, achieved %.9g\n", what, requested, achieved);
+    }
+}
+
+/******************************************************************************
+* Function Name: test_rate
+*******************************************************************************
+*
+* Summary:
+*  Step rate of an increment, and the steps counted by the dac isr over
+*  TEST_RUN_TICKS ticks, both compared with the requested rate
+*
+*******************************************************************************/
+
+static void test_rate(const char *what, uint32_t increment, double requested, int counted) {
+    double expected = requested > TIMING_TICK_HZ ? TIMING_TICK_HZ : requested;
+    double achieved = (double)increment * TIMING_TICK_HZ / 4294967296.0;
+    
+    test_check(fabs(achieved - expected) <= TEST_TOLERANCE * expected + TIMING_TICK_HZ / 4294967296.0,
+               what, expected, achieved);
+    if (!counted) {
+        return;
+    }
+    
+    timing_Set(increment);
+    timing_Restart();
+    unsigned long steps = 0;
+    int announced = 1;
+    for (unsigned long tick = 0; tick < TEST_RUN_TICKS; tick++) {
+        uint8_t last = timing_LastTick();  // the adc isr of the previous tick
+        uint8_t step = timing_Step();
+        announced &= (last == step);
+        steps += step;
+    }
+    double steps_expected = expected * TEST_RUN_TICKS / TIMING_TICK_HZ;
+    test_check(fabs(steps - steps_expected) <= 1 + TEST_TOLERANCE * steps_expected, what,
+               expected, (double)steps * TIMING_TICK_HZ / TEST_RUN_TICKS);
+    test_check(announced, "timing_LastTick() before each step", expected, achieved);
+}
+
+int main(void) {
+    char what[64];
+    
+    for (uint16_t scan_rate = 1; scan_rate <= 1270; scan_rate++) {  // every scan rate of the GUI, increment only
+        for (uint8_t r = 0; r < sizeof(test_resolutions); r++) {
+            snprintf(what, sizeof(what), "%u mV/s, %u mV/level", scan_rate, test_resolutions[r]);
+            test_rate(what, timing_ScanIncrement(scan_rate, test_resolutions[r]),
+                      (double)scan_rate / test_resolutions[r], 0);
+        }
+    }
+    for (uint8_t s = 0; s < sizeof(test_scan_rates)/sizeof(test_scan_rates[0]); s++) {  // counted by timing_Step()
+        for (uint8_t r = 0; r < sizeof(test_resolutions); r++) {
+            snprintf(what, sizeof(what), "%u mV/s, %u mV/level, counted", test_scan_rates[s], test_resolutions[r]);
+            test_rate(what, timing_ScanIncrement(test_scan_rates[s], test_resolutions[r]),
+                      (double)test_scan_rates[s] / test_resolutions[r], 1);
+        }
+    }
+    test_rate("CA step", timing_PeriodIncrement(CA_STEP_MS), 1000.0 / CA_STEP_MS, 1);
+    test_rate("1 ms period", timing_PeriodIncrement(1), 1000.0, 1);
+    test_rate("0 ms period", timing_PeriodIncrement(0), TIMING_TICK_HZ, 0);
+    
+    test_check(pwm_period == TIMING_TICK_PERIOD - 1, "period of PWM_isr", TIMING_TICK_PERIOD - 1, pwm_period);
+    test_check(pwm_compare == TIMING_TICK_PERIOD / 2, "compare of PWM_isr", TIMING_TICK_PERIOD / 2, pwm_compare);
+    
+    printf("%s: tick %u Hz, tolerance %.2g\n", failures ? "FAILED" : "passed", TIMING_TICK_HZ, TEST_TOLERANCE);
+    return failures != 0;
+}
+
+/* [] END OF FILE */